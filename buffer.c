@@ -34,8 +34,11 @@
 #include <windows.h>
 #endif
 
-#ifdef HAVE_VASPRINTF
-/* If we have vasprintf, we need to define this before we include stdio.h. */
+#if defined(HAVE_VASPRINTF) || defined(HAVE_MMAP)
+/*
+ * If we have vasprintf, we need to define this before we include stdio.h.
+ * mremap(2) is only declared with it as well.
+ */
 #define _GNU_SOURCE
 #endif
 
@@ -48,9 +51,20 @@
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
+#include <sys/queue.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,18 +74,396 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 
 #include "event.h"
 #include "config.h"
 #include "evutil.h"
+#include "event-internal.h"
 #include "./log.h"
+#include "mm-internal.h"
+
+/* see evbuffer_defer_callbacks() */
+struct evbuffer_deferred {
+    struct deferred_cb dcb;
+    struct event_base* base;
+    size_t old;     /* length before the first change not yet reported */
+};
+
+static void
+evbuffer_run_deferred(struct deferred_cb* dcb, void* arg)
+{
+    struct evbuffer* buf = arg;
+
+    if (buf->cb != NULL)
+        (*buf->cb)(buf, buf->deferred->old, buf->off, buf->cbarg);
+}
+
+/* tells the callback, now or later, that the length used to be old */
+static void
+evbuffer_invoke_cb(struct evbuffer* buf, size_t old)
+{
+    struct evbuffer_deferred* deferred = buf->deferred;
+
+    if (buf->cb == NULL)
+        return;
+
+    if (deferred == NULL) {
+        (*buf->cb)(buf, old, buf->off, buf->cbarg);
+        return;
+    }
+
+    if (deferred->dcb.base == NULL) {
+        deferred->old = old;
+        event_deferred_cb_schedule(deferred->base, &deferred->dcb);
+    }
+}
+
+int
+evbuffer_defer_callbacks(struct evbuffer* buffer, struct event_base* base)
+{
+    struct evbuffer_deferred* deferred = buffer->deferred;
+
+    if (base == NULL) {
+        if (deferred == NULL)
+            return (0);
+        buffer->deferred = NULL;
+        /* a pending notification is delivered right away */
+        if (deferred->dcb.base != NULL) {
+            event_deferred_cb_cancel(&deferred->dcb);
+            evbuffer_invoke_cb(buffer, deferred->old);
+        }
+        mm_free(deferred);
+        return (0);
+    }
+
+    if (deferred == NULL) {
+        if ((deferred = mm_calloc(1, sizeof(struct evbuffer_deferred))) == NULL)
+            return (-1);
+        event_deferred_cb_init(&deferred->dcb, evbuffer_run_deferred, buffer);
+        buffer->deferred = deferred;
+    } else if (deferred->dcb.base != NULL && deferred->base != base) {
+        event_deferred_cb_cancel(&deferred->dcb);
+        event_deferred_cb_schedule(base, &deferred->dcb);
+    }
+    deferred->base = base;
+
+    return (0);
+}
+
+/*
+ * Storage of buffers attached to an event_base comes from per-base
+ * caches of power-of-two blocks, so allocating a buffer of a common
+ * size usually just pops a block off a list.  Larger blocks and the
+ * storage of other buffers come straight from malloc.
+ */
+
+/* Returns the size class of a block of length bytes, or -1 */
+static int
+evbuffer_pool_class(const struct evbuffer_pool* pool, size_t length)
+{
+    int i;
+
+    if (pool == NULL || length < EVBUFFER_POOL_MINSIZE ||
+        (length & (length - 1)) != 0)
+        return (-1);
+
+    for (i = 0; (size_t)EVBUFFER_POOL_MINSIZE << i != length; i++)
+        if (i == EVBUFFER_POOL_CLASSES - 1)
+            return (-1);
+
+    return (i);
+}
+
+static u_char*
+evbuffer_mem_get(struct evbuffer_pool* pool, size_t length)
+{
+    struct evbuffer_pool_class* pc;
+    u_char* chunk;
+    int i;
+
+    if ((i = evbuffer_pool_class(pool, length)) == -1)
+        return (mm_malloc(length));
+
+    pc = &pool->classes[i];
+    if (pc->nchunks)
+        chunk = pc->chunks[--pc->nchunks];
+    else if ((chunk = mm_malloc(length)) == NULL)
+        return (NULL);
+
+    pc->inuse += length;
+    return (chunk);
+}
+
+static void
+evbuffer_mem_put(struct evbuffer_pool* pool, u_char* chunk, size_t length)
+{
+    struct evbuffer_pool_class* pc;
+    int i;
+
+    if (chunk == NULL)
+        return;
+    if ((i = evbuffer_pool_class(pool, length)) == -1) {
+        mm_free(chunk);
+        return;
+    }
+
+    pc = &pool->classes[i];
+    pc->inuse -= length;
+
+    /* give half of a full cache back at once rather than one per put */
+    if (pc->nchunks == EVBUFFER_POOL_MAX) {
+        while (pc->nchunks > EVBUFFER_POOL_MAX / 2)
+            mm_free(pc->chunks[--pc->nchunks]);
+    }
+    pc->chunks[pc->nchunks++] = chunk;
+}
+
+void
+evbuffer_pool_clear(struct evbuffer_pool* pool)
+{
+    struct evbuffer_pool_class* pc;
+    int i;
+
+    for (i = 0; i < EVBUFFER_POOL_CLASSES; i++) {
+        pc = &pool->classes[i];
+        while (pc->nchunks)
+            mm_free(pc->chunks[--pc->nchunks]);
+    }
+}
+
+void
+evbuffer_set_pool(struct evbuffer* buf, struct event_base* base)
+{
+    struct evbuffer_pool* pool = base != NULL ? &base->rpool : NULL;
+    int i;
+
+    /*
+     * Storage from the pool of another base goes back to malloc when
+     * it is freed, since that base may run on another thread by then.
+     */
+    if (buf->storage_pool != NULL && buf->storage_pool != pool) {
+        i = evbuffer_pool_class(buf->storage_pool, buf->totallen);
+        if (i != -1)
+            buf->storage_pool->classes[i].inuse -= buf->totallen;
+        buf->storage_pool = NULL;
+    }
+
+    buf->pool = pool;
+}
+
+int
+event_base_get_buffer_stats(struct event_base* base, int size_class,
+                            size_t* size, size_t* inuse, size_t* cached)
+{
+    struct evbuffer_pool_class* pc;
+
+    if (size_class < 0 || size_class >= EVBUFFER_POOL_CLASSES)
+        return (-1);
+
+    pc = &base->rpool.classes[size_class];
+    if (size != NULL)
+        *size = EVBUFFER_POOL_MINSIZE << size_class;
+    if (inuse != NULL)
+        *inuse = pc->inuse;
+    if (cached != NULL)
+        *cached = (size_t)pc->nchunks * (EVBUFFER_POOL_MINSIZE << size_class);
+
+    return (0);
+}
+
+/*
+ * Buffers with a spill threshold keep storage larger than that in an
+ * unlinked temporary file instead of in memory.  The file is mapped,
+ * so the data stays contiguous and everything that looks at the buffer
+ * keeps working, but the kernel can write it out and drop it from
+ * memory whenever it likes.
+ */
+#define EVBUFFER_MAPPED(buf) ((buf)->spill != NULL && (buf)->spill->mapped)
+
+/* Frees the storage of buf, wherever it came from */
+static void
+evbuffer_storage_free(struct evbuffer* buf)
+{
+#ifdef HAVE_MMAP
+    if (EVBUFFER_MAPPED(buf)) {
+        munmap(buf->orig_buffer, buf->totallen);
+        /* give the disk space back too */
+        ftruncate(buf->spill->fd, 0);
+        buf->spill->mapped = 0;
+        return;
+    }
+#endif
+    evbuffer_mem_put(buf->storage_pool, buf->orig_buffer, buf->totallen);
+}
+
+#ifdef HAVE_MMAP
+static int
+evbuffer_spill_open(void)
+{
+    const char* dir = evutil_getenv("TMPDIR");
+    char path[1024];
+    int fd;
+
+    if (dir == NULL || *dir == '\0')
+        dir = "/tmp";
+    evutil_snprintf(path, sizeof(path), "%s/libevent.XXXXXX", dir);
+
+    if ((fd = mkstemp(path)) == -1) {
+        event_warn("%s: mkstemp(%s)", __func__, path);
+        return (-1);
+    }
+    /* nobody else needs to find it; it goes away when closed */
+    unlink(path);
+#ifdef HAVE_SETFD
+    fcntl(fd, F_SETFD, 1);
+#endif
+
+    return (fd);
+}
+
+/*
+ * Makes the spill file length bytes long.  The blocks are allocated up
+ * front: a write through the mapping into a hole that the file system
+ * cannot fill raises SIGBUS instead of returning an error.
+ */
+static int
+evbuffer_spill_grow(int fd, size_t oldlength, size_t length)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+    int res;
+
+    if ((res = posix_fallocate(fd, oldlength, length - oldlength)) != 0) {
+        ftruncate(fd, oldlength);
+        errno = res;
+        return (-1);
+    }
+    return (0);
+#else
+    char zero = 0;
+    size_t off;
+
+    /* write a byte into every page so that nothing is left sparse */
+    for (off = oldlength; off < length; off += 4096) {
+        if (pwrite(fd, &zero, 1, off) != 1) {
+            ftruncate(fd, oldlength);
+            return (-1);
+        }
+    }
+    return (ftruncate(fd, length));
+#endif
+}
+
+/* Maps length bytes of the spill file, growing or shrinking the file */
+static u_char*
+evbuffer_spill_map(struct evbuffer* buf, size_t length)
+{
+    struct evbuffer_spill* spill = buf->spill;
+    size_t oldlength = spill->mapped ? buf->totallen : 0;
+    void* p;
+
+    if (length > oldlength) {
+        if (evbuffer_spill_grow(spill->fd, oldlength, length) == -1) {
+            event_warn("%s: cannot grow the spill file to %lu bytes",
+                       __func__, (unsigned long)length);
+            return (NULL);
+        }
+    }
+
+    if (!spill->mapped) {
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 spill->fd, 0);
+    } else {
+#ifdef MREMAP_MAYMOVE
+        p = mremap(buf->orig_buffer, buf->totallen, length, MREMAP_MAYMOVE);
+#else
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 spill->fd, 0);
+        if (p != MAP_FAILED)
+            munmap(buf->orig_buffer, buf->totallen);
+#endif
+    }
+    if (p == MAP_FAILED)
+        return (NULL);
+
+    if (length < buf->totallen && spill->mapped)
+        ftruncate(spill->fd, length);
+
+    return (p);
+}
+
+/* Moves the data of a buffer with a spill threshold into length bytes */
+static int
+evbuffer_spill_resize(struct evbuffer* buf, size_t length)
+{
+    struct evbuffer_spill* spill = buf->spill;
+    u_char* newbuf = NULL;
+
+    if (spill->threshold != 0 && length > spill->threshold) {
+        if (spill->mapped) {
+            if (buf->orig_buffer != buf->buffer) {
+                memmove(buf->orig_buffer, buf->buffer, buf->off);
+                buf->buffer = buf->orig_buffer;
+            }
+            newbuf = evbuffer_spill_map(buf, length);
+        } else if (spill->fd != -1 ||
+                   (spill->fd = evbuffer_spill_open()) != -1) {
+            newbuf = evbuffer_spill_map(buf, length);
+            if (newbuf != NULL) {
+                if (buf->off)
+                    memcpy(newbuf, buf->buffer, buf->off);
+                evbuffer_storage_free(buf);
+                buf->storage_pool = NULL;
+                spill->mapped = 1;
+            }
+        }
+        /* without room in the file system, memory beats failing */
+    }
+
+    if (newbuf == NULL) {
+        if ((newbuf = evbuffer_mem_get(buf->pool, length)) == NULL)
+            return (-1);
+        if (buf->off)
+            memcpy(newbuf, buf->buffer, buf->off);
+        evbuffer_storage_free(buf);
+        buf->storage_pool = buf->pool;
+    }
+
+    buf->orig_buffer = buf->buffer = newbuf;
+    buf->misalign = 0;
+    buf->totallen = length;
+
+    return (0);
+}
+#endif
+
+int
+evbuffer_set_spill(struct evbuffer* buf, size_t threshold)
+{
+#ifdef HAVE_MMAP
+    if (buf->spill == NULL) {
+        if (threshold == 0)
+            return (0);
+        if ((buf->spill = mm_calloc(1, sizeof(struct evbuffer_spill))) == NULL)
+            return (-1);
+        buf->spill->fd = -1;
+    }
+    buf->spill->threshold = threshold;
+
+    return (0);
+#else
+    return (threshold == 0 ? 0 : -1);
+#endif
+}
 
 struct evbuffer*
 evbuffer_new(void)
 {
     struct evbuffer* buffer;
 
-    buffer = calloc(1, sizeof(struct evbuffer));
+    buffer = mm_calloc(1, sizeof(struct evbuffer));
 
     return (buffer);
 }
@@ -79,9 +471,26 @@ evbuffer_new(void)
 void
 evbuffer_free(struct evbuffer* buffer)
 {
-    if (buffer->orig_buffer != NULL)
-        free(buffer->orig_buffer);
-    free(buffer);
+    evbuffer_storage_free(buffer);
+    if (buffer->spill != NULL) {
+        if (buffer->spill->fd != -1)
+            close(buffer->spill->fd);
+        mm_free(buffer->spill);
+    }
+    if (buffer->deferred != NULL) {
+        event_deferred_cb_cancel(&buffer->deferred->dcb);
+        mm_free(buffer->deferred);
+    }
+    mm_free(buffer);
+}
+
+/* Releases the storage of an empty buffer if it grew past its threshold */
+static void
+evbuffer_autoshrink(struct evbuffer* buf)
+{
+    if (buf->off == 0 && buf->shrink_threshold != 0 &&
+        buf->totallen > buf->shrink_threshold)
+        evbuffer_shrink(buf, 0);
 }
 
 /*
@@ -92,9 +501,12 @@ evbuffer_free(struct evbuffer* buffer)
 #define SWAP(x,y) do { \
     (x)->buffer = (y)->buffer; \
     (x)->orig_buffer = (y)->orig_buffer; \
+    (x)->storage_pool = (y)->storage_pool; \
     (x)->misalign = (y)->misalign; \
     (x)->totallen = (y)->totallen; \
     (x)->off = (y)->off; \
+    (x)->eol_scanned = (y)->eol_scanned; \
+    (x)->eol_style = (y)->eol_style; \
 } while (0)
 
 int
@@ -104,7 +516,9 @@ evbuffer_add_buffer(struct evbuffer* outbuf, struct evbuffer* inbuf)
 
     /* Short cut for better performance */
     // outbuf内存为0，直接交换即可
-    if (outbuf->off == 0) {
+    // 映射到临时文件的内存只属于其所在的缓冲区，不能交换
+    if (outbuf->off == 0 && !EVBUFFER_MAPPED(outbuf) &&
+        !EVBUFFER_MAPPED(inbuf)) {
         struct evbuffer tmp;
         size_t oldoff = inbuf->off;
 
@@ -112,16 +526,17 @@ evbuffer_add_buffer(struct evbuffer* outbuf, struct evbuffer* inbuf)
         SWAP(&tmp, outbuf);
         SWAP(outbuf, inbuf);
         SWAP(inbuf, &tmp);
+        evbuffer_autoshrink(inbuf);
 
         /*
          * Optimization comes with a price; we need to notify the
          * buffer if necessary of the changes. oldoff is the amount
          * of data that we transfered from inbuf to outbuf
          */
-        if (inbuf->off != oldoff && inbuf->cb != NULL)
-            (*inbuf->cb)(inbuf, oldoff, inbuf->off, inbuf->cbarg);
-        if (oldoff && outbuf->cb != NULL)
-            (*outbuf->cb)(outbuf, 0, oldoff, outbuf->cbarg);
+        if (inbuf->off != oldoff)
+            evbuffer_invoke_cb(inbuf, oldoff);
+        if (oldoff)
+            evbuffer_invoke_cb(outbuf, 0);
 
         return (0);
     }
@@ -138,41 +553,32 @@ evbuffer_add_buffer(struct evbuffer* outbuf, struct evbuffer* inbuf)
 int
 evbuffer_add_vprintf(struct evbuffer* buf, const char* fmt, va_list ap)
 {
-    char* buffer;
-    size_t space;
-    size_t oldoff = buf->off;
+    struct evbuffer_iovec vec;
     int sz;
     va_list aq;
 
     /* make sure that at least some space is available */
-    if (evbuffer_expand(buf, 64) < 0)
+    if (evbuffer_reserve_space(buf, 64, &vec, 1) < 0)
         return (-1);
     for (;;) {
-        size_t used = buf->misalign + buf->off;
-        buffer = (char*)buf->buffer + buf->off;
-        assert(buf->totallen >= used);
-        space = buf->totallen - used;
-
 #ifndef va_copy
 #define    va_copy(dst, src)    memcpy(&(dst), &(src), sizeof(va_list))
 #endif
         va_copy(aq, ap);
 
-        sz = evutil_vsnprintf(buffer, space, fmt, aq);
+        sz = evutil_vsnprintf(vec.iov_base, vec.iov_len, fmt, aq);
 
         va_end(aq);
 
         if (sz < 0)
             return (-1);
-        if ((size_t)sz < space) {
-            buf->off += sz;
-            if (buf->cb != NULL)
-                (*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+        if ((size_t)sz < vec.iov_len) {
+            vec.iov_len = sz;
+            evbuffer_commit_space(buf, &vec, 1);
             return (sz);
         }
-        if (evbuffer_expand(buf, sz + 1) == -1)
+        if (evbuffer_reserve_space(buf, sz + 1, &vec, 1) < 0)
             return (-1);
-
     }
     /* NOTREACHED */
 }
@@ -205,6 +611,36 @@ evbuffer_remove(struct evbuffer* buf, void* data, size_t datlen)
     return (nread);
 }
 
+/*
+ * A search for an end of line that fails remembers how far it got, and
+ * the next search for the same style resumes there; draining moves the
+ * mark along with the data.  A line that arrives in many small pieces
+ * is thus scanned once instead of once per piece.
+ */
+static size_t
+evbuffer_eol_resume(struct evbuffer* buffer, enum evbuffer_eol_style style)
+{
+    if (buffer->eol_style != (int)style ||
+        buffer->eol_scanned > buffer->off) {
+        buffer->eol_style = style;
+        buffer->eol_scanned = 0;
+    }
+    return (buffer->eol_scanned);
+}
+
+/* index of the first '\r' or '\n' at or after start, or len */
+static size_t
+evbuffer_find_eol_any(const u_char* data, size_t start, size_t len)
+{
+    size_t i;
+
+    for (i = start; i < len; i++) {
+        if (data[i] == '\r' || data[i] == '\n')
+            break;
+    }
+    return (i);
+}
+
 /*
  * Reads a line terminated by either '\r\n', '\n\r' or '\r' or '\n'.
  * The returned buffer needs to be freed by the called.
@@ -216,17 +652,17 @@ evbuffer_readline(struct evbuffer* buffer)
     u_char* data = EVBUFFER_DATA(buffer);
     size_t len = EVBUFFER_LENGTH(buffer);
     char* line;
-    unsigned int i;
+    size_t i;
 
-    for (i = 0; i < len; i++) {
-        if (data[i] == '\r' || data[i] == '\n')
-            break;
-    }
+    i = evbuffer_find_eol_any(data,
+                              evbuffer_eol_resume(buffer, EVBUFFER_EOL_ANY), len);
 
-    if (i == len)
+    if (i == len) {
+        buffer->eol_scanned = len;
         return (NULL);
+    }
 
-    if ((line = malloc(i + 1)) == NULL) {
+    if ((line = mm_malloc(i + 1)) == NULL) {
         fprintf(stderr, "%s: out of memory\n", __func__);
         return (NULL);
     }
@@ -258,6 +694,7 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
     u_char* data = EVBUFFER_DATA(buffer);
     u_char* start_of_eol, *end_of_eol;
     size_t len = EVBUFFER_LENGTH(buffer);
+    size_t start = evbuffer_eol_resume(buffer, eol_style);
     char* line;
     unsigned int i, n_to_copy, n_to_drain;
 
@@ -272,12 +709,11 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
         // aaaa\r\n\nbbb\r\n -> aaa bbb
         // \r\r\aaa\nbbb     -> "" aaa NULL
     case EVBUFFER_EOL_ANY:
-        for (i = 0; i < len; i++) {
-            if (data[i] == '\r' || data[i] == '\n')
-                break;
-        }
-        if (i == len)
+        i = evbuffer_find_eol_any(data, start, len);
+        if (i == len) {
+            buffer->eol_scanned = len;
             return (NULL);
+        }
         start_of_eol = data + i;
         ++i;
         for ( ; i < len; i++) {
@@ -290,9 +726,11 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
         // aaa\r\nbbb\r\n -> aaa bbb
         // \naaa\nbbb -> "" aaa NULL
     case EVBUFFER_EOL_CRLF:
-        end_of_eol = memchr(data, '\n', len);
-        if (!end_of_eol)
+        end_of_eol = memchr(data + start, '\n', len - start);
+        if (!end_of_eol) {
+            buffer->eol_scanned = len;
             return (NULL);
+        }
         if (end_of_eol > data && *(end_of_eol - 1) == '\r')
             start_of_eol = end_of_eol - 1;
         else
@@ -301,7 +739,7 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
         break;
         // \r\n作为换行
     case EVBUFFER_EOL_CRLF_STRICT: {
-        u_char* cp = data;
+        u_char* cp = data + start;
         while ((cp = memchr(cp, '\r', len - (cp - data)))) {
             if (cp < data + len - 1 && *(cp + 1) == '\n')
                 break;
@@ -310,17 +748,23 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
                 break;
             }
         }
-        if (!cp)
+        if (!cp) {
+            /* a trailing '\r' may still be followed by its '\n' */
+            buffer->eol_scanned =
+                (len > 0 && data[len - 1] == '\r') ? len - 1 : len;
             return (NULL);
+        }
         start_of_eol = cp;
         end_of_eol = cp + 2;
         break;
     }
     // \n 作为换行
     case EVBUFFER_EOL_LF:
-        start_of_eol = memchr(data, '\n', len);
-        if (!start_of_eol)
+        start_of_eol = memchr(data + start, '\n', len - start);
+        if (!start_of_eol) {
+            buffer->eol_scanned = len;
             return (NULL);
+        }
         end_of_eol = start_of_eol + 1;
         break;
     default:
@@ -330,7 +774,7 @@ evbuffer_readln(struct evbuffer* buffer, size_t* n_read_out,
     n_to_copy = start_of_eol - data;
     n_to_drain = end_of_eol - data;
 
-    if ((line = malloc(n_to_copy + 1)) == NULL) {
+    if ((line = mm_malloc(n_to_copy + 1)) == NULL) {
         event_warn("%s: out of memory\n", __func__);
         return (NULL);
     }
@@ -360,6 +804,42 @@ evbuffer_align(struct evbuffer* buf)
 #define SIZE_MAX ((size_t)-1)
 #endif
 
+/* Moves the data of buf into storage of exactly length bytes */
+static int
+evbuffer_resize(struct evbuffer* buf, size_t length)
+{
+    u_char* newbuf;
+
+#ifdef HAVE_MMAP
+    if (buf->spill != NULL &&
+        (buf->spill->mapped ||
+         (buf->spill->threshold != 0 && length > buf->spill->threshold)))
+        return (evbuffer_spill_resize(buf, length));
+#endif
+
+    if (evbuffer_pool_class(buf->pool, length) == -1 &&
+        evbuffer_pool_class(buf->storage_pool, buf->totallen) == -1) {
+        /* neither block is cached; let realloc move the data */
+        if (buf->orig_buffer != buf->buffer)
+            evbuffer_align(buf);
+        if ((newbuf = mm_realloc(buf->orig_buffer, length)) == NULL)
+            return (-1);
+    } else {
+        if ((newbuf = evbuffer_mem_get(buf->pool, length)) == NULL)
+            return (-1);
+        if (buf->off)
+            memcpy(newbuf, buf->buffer, buf->off);
+        evbuffer_mem_put(buf->storage_pool, buf->orig_buffer, buf->totallen);
+        buf->misalign = 0;
+    }
+
+    buf->orig_buffer = buf->buffer = newbuf;
+    buf->storage_pool = buf->pool;
+    buf->totallen = length;
+
+    return (0);
+}
+
 /* Expands the available space in the event buffer to at least datlen */
 // 扩充datlen大小的内存
 int
@@ -388,7 +868,6 @@ evbuffer_expand(struct evbuffer* buf, size_t datlen)
     if (buf->totallen - buf->off >= datlen) {
         evbuffer_align(buf);
     } else {
-        void* newbuf;
         size_t length = buf->totallen;
         size_t need = buf->off + datlen; // 需要申请的内存大小
 
@@ -402,18 +881,111 @@ evbuffer_expand(struct evbuffer* buf, size_t datlen)
             length = need;
         }
 
-        if (buf->orig_buffer != buf->buffer)
-            evbuffer_align(buf);
-        if ((newbuf = realloc(buf->buffer, length)) == NULL)
+        if (evbuffer_resize(buf, length) == -1)
             return (-1);
+    }
 
-        buf->orig_buffer = buf->buffer = newbuf;
-        buf->totallen = length;
+    return (0);
+}
+
+int
+evbuffer_shrink(struct evbuffer* buf, size_t size)
+{
+    size_t length;
+    int i;
+
+    if (size > SIZE_MAX - buf->off)
+        return (0);
+    length = buf->off + size;
+    if (buf->totallen <= length)
+        return (0);
+
+    if (length == 0) {
+        evbuffer_release_pooled(buf);
+        return (0);
     }
 
+    /* stay with the sizes the pool caches */
+    if (buf->pool != NULL) {
+        for (i = 0; i < EVBUFFER_POOL_CLASSES; i++) {
+            if (length <= (size_t)EVBUFFER_POOL_MINSIZE << i) {
+                length = (size_t)EVBUFFER_POOL_MINSIZE << i;
+                break;
+            }
+        }
+    }
+    if (buf->totallen <= length)
+        return (0);
+
+    return (evbuffer_resize(buf, length));
+}
+
+void
+evbuffer_set_shrink(struct evbuffer* buf, size_t threshold)
+{
+    buf->shrink_threshold = threshold;
+    evbuffer_autoshrink(buf);
+}
+
+/*
+ * The buffer is a single block of memory, so the reserved space is
+ * always the one region between the data and the end of the block.
+ */
+int
+evbuffer_reserve_space(struct evbuffer* buf, size_t size,
+                       struct evbuffer_iovec* vec, int n_vecs)
+{
+    if (n_vecs < 1)
+        return (-1);
+    if (evbuffer_expand(buf, size) == -1)
+        return (-1);
+
+    vec[0].iov_base = buf->buffer + buf->off;
+    vec[0].iov_len = buf->totallen - buf->misalign - buf->off;
+
+    return (1);
+}
+
+int
+evbuffer_commit_space(struct evbuffer* buf,
+                      struct evbuffer_iovec* vec, int n_vecs)
+{
+    size_t oldoff = buf->off;
+
+    if (n_vecs == 0)
+        return (0);
+    if (n_vecs != 1 || vec[0].iov_base != buf->buffer + buf->off ||
+        vec[0].iov_len > buf->totallen - buf->misalign - buf->off)
+        return (-1);
+
+    buf->off += vec[0].iov_len;
+    if (vec[0].iov_len)
+        evbuffer_invoke_cb(buf, oldoff);
+
     return (0);
 }
 
+int
+evbuffer_peek(struct evbuffer* buf, int len, size_t start,
+              struct evbuffer_iovec* vec, int n_vecs)
+{
+    size_t avail;
+
+    if (start >= buf->off || len == 0)
+        return (0);
+
+    avail = buf->off - start;
+    if (len > 0 && (size_t)len < avail)
+        avail = len;
+
+    if (n_vecs > 0) {
+        vec[0].iov_base = buf->buffer + start;
+        vec[0].iov_len = avail;
+    }
+
+    return (1);
+}
+
 int
 evbuffer_add(struct evbuffer* buf, const void* data, size_t datlen)
 {
@@ -428,8 +1000,8 @@ evbuffer_add(struct evbuffer* buf, const void* data, size_t datlen)
     memcpy(buf->buffer + buf->off, data, datlen);
     buf->off += datlen;
 
-    if (datlen && buf->cb != NULL)
-        (*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+    if (datlen)
+        evbuffer_invoke_cb(buf, oldoff);
 
     return (0);
 }
@@ -444,6 +1016,8 @@ evbuffer_drain(struct evbuffer* buf, size_t len)
         buf->off = 0;
         buf->buffer = buf->orig_buffer;
         buf->misalign = 0;
+        buf->eol_scanned = 0;
+        evbuffer_autoshrink(buf);
         goto done;
     }
     // 前移
@@ -451,11 +1025,12 @@ evbuffer_drain(struct evbuffer* buf, size_t len)
     buf->misalign += len;
     // 可用内存相应减少
     buf->off -= len;
+    buf->eol_scanned = buf->eol_scanned > len ? buf->eol_scanned - len : 0;
 
 done:
     /* Tell someone about changes in this buffer */
-    if (buf->off != oldoff && buf->cb != NULL)
-        (*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+    if (buf->off != oldoff)
+        evbuffer_invoke_cb(buf, oldoff);
 
 }
 
@@ -517,21 +1092,106 @@ evbuffer_read(struct evbuffer* buf, int fd, int howmuch)
     buf->off += n;
 
     /* Tell someone about changes in this buffer */
-    if (buf->off != oldoff && buf->cb != NULL)
-        (*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+    if (buf->off != oldoff)
+        evbuffer_invoke_cb(buf, oldoff);
+
+    return (n);
+}
+
+/*
+ * Gives the storage of an empty evbuffer back to the pool it came from,
+ * so idle buffers do not pin any memory.
+ */
+void
+evbuffer_release_pooled(struct evbuffer* buf)
+{
+    if (buf->off != 0 || buf->orig_buffer == NULL)
+        return;
+
+    evbuffer_storage_free(buf);
+
+    buf->orig_buffer = buf->buffer = NULL;
+    buf->storage_pool = NULL;
+    buf->misalign = 0;
+    buf->totallen = 0;
+}
+
+/*
+ * Like evbuffer_read(), but reads into an empty buffer go through a
+ * chunk borrowed from the receive pool of base.  The chunk is handed
+ * to buf only if data arrived; otherwise it goes back to the pool and
+ * buf stays without storage.
+ */
+int
+evbuffer_read_pooled(struct evbuffer* buf, struct event_base* base,
+                     int fd, int howmuch)
+{
+    u_char* chunk;
+    int n;
+
+    if (base == NULL || buf->off != 0)
+        return (evbuffer_read(buf, fd, howmuch));
+
+    evbuffer_release_pooled(buf);
+
+    if ((chunk = evbuffer_mem_get(&base->rpool, EVBUFFER_POOL_CHUNK)) == NULL)
+        return (-1);
+
+    if (howmuch < 0 || howmuch > EVBUFFER_POOL_CHUNK)
+        howmuch = EVBUFFER_POOL_CHUNK;
+
+#ifndef WIN32
+    n = read(fd, chunk, howmuch);
+#else
+    n = recv(fd, chunk, howmuch, 0);
+#endif
+    if (n <= 0) {
+        int save_errno = errno;
+        evbuffer_mem_put(&base->rpool, chunk, EVBUFFER_POOL_CHUNK);
+        errno = save_errno;
+        return (n);
+    }
+
+    buf->orig_buffer = buf->buffer = chunk;
+    buf->storage_pool = &base->rpool;
+    buf->misalign = 0;
+    buf->totallen = EVBUFFER_POOL_CHUNK;
+    buf->off = n;
+
+    /* Tell someone about changes in this buffer */
+    evbuffer_invoke_cb(buf, 0);
 
     return (n);
 }
 
 int
 evbuffer_write(struct evbuffer* buffer, int fd)
+{
+    return (evbuffer_write_atmost(buffer, fd, -1));
+}
+
+/* like evbuffer_write() but writes no more than howmuch bytes if >= 0 */
+int
+evbuffer_write_atmost(struct evbuffer* buffer, int fd, int howmuch)
 {
     int n;
 
+    if (howmuch < 0 || (size_t)howmuch > buffer->off)
+        howmuch = buffer->off;
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_MMAP)
+    /* spilled data goes out straight from the file */
+    if (EVBUFFER_MAPPED(buffer)) {
+        off_t offset = buffer->misalign;
+        n = sendfile(fd, buffer->spill->fd, &offset, howmuch);
+        if (n == -1 && errno == EINVAL)
+            n = write(fd, buffer->buffer, howmuch);
+    } else
+#endif
 #ifndef WIN32
-    n = write(fd, buffer->buffer, buffer->off);
+    n = write(fd, buffer->buffer, howmuch);
 #else
-    n = send(fd, buffer->buffer, buffer->off, 0);
+    n = send(fd, buffer->buffer, howmuch, 0);
 #endif
     if (n == -1)
         return (-1);
@@ -545,21 +1205,84 @@ evbuffer_write(struct evbuffer* buffer, int fd)
 u_char*
 evbuffer_find(struct evbuffer* buffer, const u_char* what, size_t len)
 {
-    u_char* search = buffer->buffer, *end = search + buffer->off;
-    u_char* p;
+    return (evbuffer_search(buffer, what, len, 0));
+}
 
-    while (search < end &&
-           (p = memchr(search, *what, end - search)) != NULL) {
-        if (p + len > end)
-            break;
-        if (memcmp(p, what, len) == 0)
-            return (p);
-        search = p + 1;
+/*
+ * Needles at least this long are searched with Boyer-Moore-Horspool
+ * once the haystack is big enough to pay for the skip table; shorter
+ * ones use memchr on the first byte and check the last byte before
+ * comparing the rest.
+ */
+#define EVBUFFER_SEARCH_SKIP_MINLEN     4
+#define EVBUFFER_SEARCH_SKIP_MINDATA    1024
+
+static u_char*
+evbuffer_search_short(const u_char* data, size_t datlen,
+                      const u_char* what, size_t len)
+{
+    const u_char* p = data;
+    const u_char* end = data + datlen - len + 1; /* past the last start */
+
+    while (p < end && (p = memchr(p, what[0], end - p)) != NULL) {
+        if (p[len - 1] == what[len - 1] &&
+            memcmp(p + 1, what + 1, len - 2) == 0)
+            return ((u_char*)p);
+        ++p;
     }
 
     return (NULL);
 }
 
+static u_char*
+evbuffer_search_skip(const u_char* data, size_t datlen,
+                     const u_char* what, size_t len)
+{
+    size_t skip[256];
+    const u_char* p = data;
+    const u_char* last = data + datlen - len;
+    u_char tail = what[len - 1];
+    size_t i;
+
+    for (i = 0; i < 256; ++i)
+        skip[i] = len;
+    for (i = 0; i < len - 1; ++i)
+        skip[what[i]] = len - 1 - i;
+
+    while (p <= last) {
+        u_char c = p[len - 1];
+        if (c == tail && p[0] == what[0] &&
+            memcmp(p + 1, what + 1, len - 2) == 0)
+            return ((u_char*)p);
+        p += skip[c];
+    }
+
+    return (NULL);
+}
+
+u_char*
+evbuffer_search(struct evbuffer* buffer, const u_char* what, size_t len,
+                size_t start)
+{
+    u_char* data = buffer->buffer + start;
+    size_t datlen;
+
+    if (start > buffer->off)
+        return (NULL);
+    datlen = buffer->off - start;
+    if (len > datlen)
+        return (NULL);
+    if (len == 0)
+        return (data);
+    if (len == 1)
+        return (memchr(data, what[0], datlen));
+
+    if (len >= EVBUFFER_SEARCH_SKIP_MINLEN &&
+        datlen >= EVBUFFER_SEARCH_SKIP_MINDATA)
+        return (evbuffer_search_skip(data, datlen, what, len));
+    return (evbuffer_search_short(data, datlen, what, len));
+}
+
 void evbuffer_setcb(struct evbuffer* buffer,
                     void (*cb)(struct evbuffer*, size_t, size_t, void*),
                     void* cbarg)
@@ -50,6 +50,7 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 /* due to limitations in the devpoll interface, we need to keep track of
  * all file descriptors outself.
@@ -135,7 +136,7 @@ devpoll_init(struct event_base* base)
     if (evutil_getenv("EVENT_NODEVPOLL"))
         return (NULL);
 
-    if (!(devpollop = calloc(1, sizeof(struct devpollop))))
+    if (!(devpollop = mm_calloc(1, sizeof(struct devpollop))))
         return (NULL);
 
     if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
@@ -145,35 +146,35 @@ devpoll_init(struct event_base* base)
     /* Initialize the kernel queue */
     if ((dpfd = open("/dev/poll", O_RDWR)) == -1) {
         event_warn("open: /dev/poll");
-        free(devpollop);
+        mm_free(devpollop);
         return (NULL);
     }
 
     devpollop->dpfd = dpfd;
 
     /* Initialize fields */
-    devpollop->events = calloc(nfiles, sizeof(struct pollfd));
+    devpollop->events = mm_calloc(nfiles, sizeof(struct pollfd));
     if (devpollop->events == NULL) {
-        free(devpollop);
+        mm_free(devpollop);
         close(dpfd);
         return (NULL);
     }
     devpollop->nevents = nfiles;
 
-    devpollop->fds = calloc(nfiles, sizeof(struct evdevpoll));
+    devpollop->fds = mm_calloc(nfiles, sizeof(struct evdevpoll));
     if (devpollop->fds == NULL) {
-        free(devpollop->events);
-        free(devpollop);
+        mm_free(devpollop->events);
+        mm_free(devpollop);
         close(dpfd);
         return (NULL);
     }
     devpollop->nfds = nfiles;
 
-    devpollop->changes = calloc(nfiles, sizeof(struct pollfd));
+    devpollop->changes = mm_calloc(nfiles, sizeof(struct pollfd));
     if (devpollop->changes == NULL) {
-        free(devpollop->fds);
-        free(devpollop->events);
-        free(devpollop);
+        mm_free(devpollop->fds);
+        mm_free(devpollop->events);
+        mm_free(devpollop);
         close(dpfd);
         return (NULL);
     }
@@ -196,7 +197,7 @@ devpoll_recalc(struct event_base* base, void* arg, int max)
         while (nfds <= max)
             nfds <<= 1;
 
-        fds = realloc(devpollop->fds, nfds * sizeof(struct evdevpoll));
+        fds = mm_realloc(devpollop->fds, nfds * sizeof(struct evdevpoll));
         if (fds == NULL) {
             event_warn("realloc");
             return (-1);
@@ -405,14 +406,14 @@ devpoll_dealloc(struct event_base* base, void* arg)
 
     evsignal_dealloc(base);
     if (devpollop->fds)
-        free(devpollop->fds);
+        mm_free(devpollop->fds);
     if (devpollop->events)
-        free(devpollop->events);
+        mm_free(devpollop->events);
     if (devpollop->changes)
-        free(devpollop->changes);
+        mm_free(devpollop->changes);
     if (devpollop->dpfd >= 0)
         close(devpollop->dpfd);
 
     memset(devpollop, 0, sizeof(struct devpollop));
-    free(devpollop);
+    mm_free(devpollop);
 }
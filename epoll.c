@@ -52,6 +52,7 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 /* due to limitations in the epoll interface, we need to keep track of
  * all file descriptors outself.
@@ -130,23 +131,23 @@ epoll_init(struct event_base* base)
 
     FD_CLOSEONEXEC(epfd);
 
-    if (!(epollop = calloc(1, sizeof(struct epollop))))
+    if (!(epollop = mm_calloc(1, sizeof(struct epollop))))
         return (NULL);
 
     epollop->epfd = epfd;
 
     /* Initalize fields */
-    epollop->events = malloc(INITIAL_NEVENTS * sizeof(struct epoll_event));
+    epollop->events = mm_malloc(INITIAL_NEVENTS * sizeof(struct epoll_event));
     if (epollop->events == NULL) {
-        free(epollop);
+        mm_free(epollop);
         return (NULL);
     }
     epollop->nevents = INITIAL_NEVENTS;
 
-    epollop->fds = calloc(INITIAL_NFILES, sizeof(struct evepoll));
+    epollop->fds = mm_calloc(INITIAL_NFILES, sizeof(struct evepoll));
     if (epollop->fds == NULL) {
-        free(epollop->events);
-        free(epollop);
+        mm_free(epollop->events);
+        mm_free(epollop);
         return (NULL);
     }
     epollop->nfds = INITIAL_NFILES;
@@ -171,7 +172,7 @@ epoll_recalc(struct event_base* base, void* arg, int max)
         while (nfds <= max)
             nfds <<= 1;
 
-        fds = realloc(epollop->fds, nfds * sizeof(struct evepoll));
+        fds = mm_realloc(epollop->fds, nfds * sizeof(struct evepoll));
         if (fds == NULL) {
             event_warn("realloc");
             return (-1);
@@ -258,7 +259,7 @@ epoll_dispatch(struct event_base* base, void* arg, struct timeval* tv)
         int new_nevents = epollop->nevents * 2;
         struct epoll_event* new_events;
 
-        new_events = realloc(epollop->events,
+        new_events = mm_realloc(epollop->events,
                              new_nevents * sizeof(struct epoll_event));
         if (new_events) {
             epollop->events = new_events;
@@ -378,12 +379,12 @@ epoll_dealloc(struct event_base* base, void* arg)
 
     evsignal_dealloc(base);
     if (epollop->fds)
-        free(epollop->fds);
+        mm_free(epollop->fds);
     if (epollop->events)
-        free(epollop->events);
+        mm_free(epollop->events);
     if (epollop->epfd >= 0)
         close(epollop->epfd);
 
     memset(epollop, 0, sizeof(struct epollop));
-    free(epollop);
+    mm_free(epollop);
 }
@@ -25,23 +25,36 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <sys/types.h>
-
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#ifdef HAVE_SPLICE
+/* splice(2) is only declared with _GNU_SOURCE */
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#include <sys/queue.h>
 
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_STDARG_H
 #include <stdarg.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#endif
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -49,6 +62,9 @@
 
 #include "evutil.h"
 #include "event.h"
+#include "event-internal.h"
+#include "mm-internal.h"
+#include "log.h"
 
 
 // bufferevent 读写缓冲区，当读完成或者写完成的时候，就会通知用户
@@ -64,17 +80,377 @@
 void bufferevent_read_pressure_cb(struct evbuffer*, size_t, size_t, void*);
 
 static int
-bufferevent_add(struct event* ev, int timeout)
+bufferevent_add(struct event* ev, const struct timeval* timeout)
+{
+    if (!evutil_timerisset(timeout))
+        timeout = NULL;
+
+    return (event_add(ev, timeout));
+}
+
+/*
+ * Deferred callbacks.  The user callbacks of a bufferevent are collected
+ * and run at the end of the loop iteration, each at most once.
+ */
+struct bufferevent_deferred {
+    struct deferred_cb dcb;
+    struct deferred_cb uncork;  /* see bufferevent_cork() */
+    int enabled;
+    short pending;      /* EV_READ and/or EV_WRITE callbacks to run */
+    short error;        /* what for the error callback, 0 if none */
+    int running;
+    int freed;          /* bufferevent_free() was called from a callback */
+};
+
+static void bufferevent_free_internal(struct bufferevent* bufev);
+
+static void
+bufferevent_run_deferred(struct deferred_cb* dcb, void* arg)
 {
-    struct timeval tv, *ptv = NULL;
+    struct bufferevent* bufev = arg;
+    struct bufferevent_deferred* deferred = bufev->deferred;
+    short pending = deferred->pending, error = deferred->error;
+
+    deferred->pending = deferred->error = 0;
+    deferred->running = 1;
+
+    if ((pending & EV_READ) && bufev->readcb != NULL)
+        (*bufev->readcb)(bufev, bufev->cbarg);
+    if ((pending & EV_WRITE) && !deferred->freed && bufev->writecb != NULL)
+        (*bufev->writecb)(bufev, bufev->cbarg);
+    if (error && !deferred->freed)
+        (*bufev->errorcb)(bufev, error, bufev->cbarg);
+
+    deferred->running = 0;
+    if (deferred->freed)
+        bufferevent_free_internal(bufev);
+}
+
+static void bufferevent_uncork_cb(struct deferred_cb* dcb, void* arg);
+
+static struct bufferevent_deferred*
+bufferevent_deferred_get(struct bufferevent* bufev)
+{
+    struct bufferevent_deferred* deferred = bufev->deferred;
+
+    if (deferred != NULL)
+        return (deferred);
+
+    if ((deferred = mm_calloc(1, sizeof(struct bufferevent_deferred))) == NULL)
+        return (NULL);
+    event_deferred_cb_init(&deferred->dcb, bufferevent_run_deferred, bufev);
+    event_deferred_cb_init(&deferred->uncork, bufferevent_uncork_cb, bufev);
+
+    bufev->deferred = deferred;
+    return (deferred);
+}
+
+/* returns 1 if the callback has been deferred */
+static int
+bufferevent_defer(struct bufferevent* bufev, short pending, short error)
+{
+    struct bufferevent_deferred* deferred = bufev->deferred;
+
+    if (deferred == NULL || !deferred->enabled)
+        return (0);
+
+    deferred->pending |= pending;
+    if (error)
+        deferred->error = error;
+    event_deferred_cb_schedule(bufev->ev_read.ev_base, &deferred->dcb);
+    return (1);
+}
+
+static void
+bufferevent_run_readcb(struct bufferevent* bufev)
+{
+    if (bufev->readcb == NULL || bufferevent_defer(bufev, EV_READ, 0))
+        return;
+    (*bufev->readcb)(bufev, bufev->cbarg);
+}
+
+static void
+bufferevent_run_writecb(struct bufferevent* bufev)
+{
+    if (bufev->writecb == NULL || bufferevent_defer(bufev, EV_WRITE, 0))
+        return;
+    (*bufev->writecb)(bufev, bufev->cbarg);
+}
+
+static void
+bufferevent_run_errorcb(struct bufferevent* bufev, short what)
+{
+    if (bufferevent_defer(bufev, 0, what))
+        return;
+    (*bufev->errorcb)(bufev, what, bufev->cbarg);
+}
+
+/*
+ * Rate limiting.  Every bufferevent may have its own token bucket, and
+ * may in addition share one with the other members of a group.  A read
+ * or write moves no more bytes than the buckets allow; once a bucket is
+ * empty the event is suspended until the bucket is refilled.
+ */
+
+/* the smallest share of a group bucket handed to a single member */
+#define RATE_LIMIT_MIN_SHARE 64
+
+struct bufferevent_rate_limit {
+    TAILQ_ENTRY(bufferevent_rate_limit) next;  /* in group->members */
+    struct bufferevent* bufev;
+    struct bufferevent_rate_limit_group* group;
+
+    long read_rate;     /* bytes per tick, 0 if not limited */
+    long write_rate;
+    long read_limit;    /* bytes left in the current tick */
+    long write_limit;
+    struct timeval tick;
+    struct timeval last_refill;
+
+    // 只有在令牌用完被挂起时才启动，组成员由组的定时器补充
+    struct event refill_ev;
+    short suspended;    /* EV_READ/EV_WRITE held back for lack of tokens */
+};
+
+struct bufferevent_rate_limit_group {
+    TAILQ_HEAD(rate_limit_list, bufferevent_rate_limit) members;
+    int nmembers;
+
+    long read_rate;
+    long write_rate;
+    long read_limit;
+    long write_limit;
+    struct timeval tick;
 
-    if (timeout) {
-        evutil_timerclear(&tv);
-        tv.tv_sec = timeout;
-        ptv = &tv;
+    // 整个组共用一个定时器，每个tick补充一次令牌
+    struct event refill_ev;
+};
+
+#define BEV_RATE_SUSPENDED(bufev, what) \
+    ((bufev)->rate_limit != NULL && ((bufev)->rate_limit->suspended & (what)))
+
+static void
+bufferevent_rate_refill(struct bufferevent_rate_limit* rl,
+                        const struct timeval* now)
+{
+    rl->read_limit = rl->read_rate;
+    rl->write_limit = rl->write_rate;
+    rl->last_refill = *now;
+}
+
+/* a bucket that was not touched for a whole tick is full again */
+static void
+bufferevent_rate_update(struct bufferevent_rate_limit* rl)
+{
+    struct timeval now, next;
+
+    if (!rl->read_rate && !rl->write_rate)
+        return;
+
+    evutil_gettimeofday(&now, NULL);
+    evutil_timeradd(&rl->last_refill, &rl->tick, &next);
+    if (!evutil_timercmp(&now, &next, <))
+        bufferevent_rate_refill(rl, &now);
+}
+
+/*
+ * Returns how many bytes may be transferred in direction what right now,
+ * or -1 if there is no limit.
+ */
+static long
+bufferevent_rate_allowed(struct bufferevent* bufev, short what)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+    struct bufferevent_rate_limit_group* group;
+    long allowed = -1, rate, limit, share;
+
+    if (rl == NULL)
+        return (-1);
+
+    bufferevent_rate_update(rl);
+    rate = what == EV_READ ? rl->read_rate : rl->write_rate;
+    limit = what == EV_READ ? rl->read_limit : rl->write_limit;
+    if (rate)
+        allowed = limit > 0 ? limit : 0;
+
+    if ((group = rl->group) == NULL)
+        return (allowed);
+
+    rate = what == EV_READ ? group->read_rate : group->write_rate;
+    limit = what == EV_READ ? group->read_limit : group->write_limit;
+    if (rate) {
+        /* divide the bucket so that one member cannot starve the rest */
+        share = limit / group->nmembers;
+        if (share < RATE_LIMIT_MIN_SHARE)
+            share = RATE_LIMIT_MIN_SHARE;
+        if (share > limit)
+            share = limit > 0 ? limit : 0;
+        if (allowed == -1 || share < allowed)
+            allowed = share;
+    }
+
+    return (allowed);
+}
+
+static void
+bufferevent_rate_suspend(struct bufferevent* bufev, short what)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+    long own;
+
+    rl->suspended |= what;
+    if (what & EV_READ)
+        event_del(&bufev->ev_read);
+    if (what & EV_WRITE)
+        event_del(&bufev->ev_write);
+
+    /* the group timer refills the buckets of its members */
+    if (rl->group != NULL)
+        return;
+    own = what & EV_READ ? rl->read_limit : rl->write_limit;
+    if ((what & EV_READ ? rl->read_rate : rl->write_rate) && own <= 0 &&
+        !evtimer_pending(&rl->refill_ev, NULL))
+        evtimer_add(&rl->refill_ev, &rl->tick);
+}
+
+/*
+ * Takes n bytes out of the buckets.  Returns -1 if that emptied one of
+ * them, in which case the event has been suspended and must not be
+ * rescheduled.
+ */
+static int
+bufferevent_rate_consume(struct bufferevent* bufev, short what, long n)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+    struct bufferevent_rate_limit_group* group;
+    int empty = 0;
+
+    if (rl == NULL)
+        return (0);
+
+    if (what == EV_READ) {
+        if (rl->read_rate && (rl->read_limit -= n) <= 0)
+            empty = 1;
+    } else {
+        if (rl->write_rate && (rl->write_limit -= n) <= 0)
+            empty = 1;
+    }
+
+    if ((group = rl->group) != NULL) {
+        if (what == EV_READ) {
+            if (group->read_rate && (group->read_limit -= n) <= 0)
+                empty = 1;
+        } else {
+            if (group->write_rate && (group->write_limit -= n) <= 0)
+                empty = 1;
+        }
+    }
+
+    if (!empty)
+        return (0);
+
+    bufferevent_rate_suspend(bufev, what);
+    return (-1);
+}
+
+static void
+bufferevent_rate_resume(struct bufferevent* bufev)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+
+    if ((rl->suspended & EV_READ) &&
+        bufferevent_rate_allowed(bufev, EV_READ) != 0) {
+        rl->suspended &= ~EV_READ;
+        /* unless the high watermark is holding reading back */
+        if ((bufev->enabled & EV_READ) &&
+            (bufev->wm_read.high == 0 ||
+             EVBUFFER_LENGTH(bufev->input) < bufev->wm_read.high))
+            bufferevent_add(&bufev->ev_read, &bufev->tv_read);
+    }
+
+    if ((rl->suspended & EV_WRITE) &&
+        bufferevent_rate_allowed(bufev, EV_WRITE) != 0) {
+        rl->suspended &= ~EV_WRITE;
+        if ((bufev->enabled & EV_WRITE) && EVBUFFER_LENGTH(bufev->output))
+            bufferevent_add(&bufev->ev_write, &bufev->tv_write);
     }
+}
+
+static void
+bufferevent_rate_refillcb(int fd, short event, void* arg)
+{
+    struct bufferevent* bufev = arg;
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+    struct timeval now;
+
+    evutil_gettimeofday(&now, NULL);
+    bufferevent_rate_refill(rl, &now);
+    bufferevent_rate_resume(bufev);
+}
+
+static void
+bufferevent_rate_group_refillcb(int fd, short event, void* arg)
+{
+    struct bufferevent_rate_limit_group* group = arg;
+    struct bufferevent_rate_limit* rl;
+
+    group->read_limit = group->read_rate;
+    group->write_limit = group->write_rate;
+
+    /* own buckets whose tick has passed are refilled on the way */
+    TAILQ_FOREACH(rl, &group->members, next) {
+        if (rl->suspended)
+            bufferevent_rate_resume(rl->bufev);
+    }
+
+    evtimer_add(&group->refill_ev, &group->tick);
+}
 
-    return (event_add(ev, ptv));
+static struct bufferevent_rate_limit*
+bufferevent_rate_limit_get(struct bufferevent* bufev)
+{
+    struct bufferevent_rate_limit* rl;
+
+    if (bufev->rate_limit != NULL)
+        return (bufev->rate_limit);
+
+    if ((rl = mm_calloc(1, sizeof(struct bufferevent_rate_limit))) == NULL)
+        return (NULL);
+
+    rl->bufev = bufev;
+    evtimer_set(&rl->refill_ev, bufferevent_rate_refillcb, bufev);
+    if (bufev->ev_read.ev_base != NULL)
+        event_base_set(bufev->ev_read.ev_base, &rl->refill_ev);
+
+    bufev->rate_limit = rl;
+    return (rl);
+}
+
+static void
+bufferevent_rate_group_unlink(struct bufferevent_rate_limit* rl)
+{
+    TAILQ_REMOVE(&rl->group->members, rl, next);
+    rl->group->nmembers--;
+    rl->group = NULL;
+}
+
+/* drops the rate limit state once neither bucket applies any more */
+static void
+bufferevent_rate_limit_put(struct bufferevent* bufev, int force)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+
+    if (rl == NULL)
+        return;
+    if (!force && (rl->group != NULL || rl->read_rate || rl->write_rate))
+        return;
+
+    if (rl->group != NULL)
+        bufferevent_rate_group_unlink(rl);
+    event_del(&rl->refill_ev);
+
+    bufev->rate_limit = NULL;
+    mm_free(rl);
 }
 
 /*
@@ -95,8 +471,9 @@ bufferevent_read_pressure_cb(struct evbuffer* buf, size_t old, size_t now,
     if (bufev->wm_read.high == 0 || now < bufev->wm_read.high) {
         evbuffer_setcb(buf, NULL, NULL);
 
-        if (bufev->enabled & EV_READ)
-            bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+        if ((bufev->enabled & EV_READ) &&
+            !BEV_RATE_SUSPENDED(bufev, EV_READ))
+            bufferevent_add(&bufev->ev_read, &bufev->tv_read);
     }
 }
 
@@ -130,8 +507,18 @@ bufferevent_readcb(int fd, short event, void* arg)
             return;
         }
     }
+    if (bufev->rate_limit != NULL) {
+        long allowed = bufferevent_rate_allowed(bufev, EV_READ);
+        if (allowed == 0) {
+            bufferevent_rate_suspend(bufev, EV_READ);
+            return;
+        }
+        if (allowed != -1 && (howmuch == -1 || howmuch > allowed))
+            howmuch = allowed;
+    }
     // howmuch 为-1或者距离高水位的值
-    res = evbuffer_read(bufev->input, fd, howmuch);
+    res = evbuffer_read_pooled(bufev->input, bufev->ev_read.ev_base,
+                               fd, howmuch);
     if (res == -1) {
         if (errno == EAGAIN || errno == EINTR)
             goto reschedule;
@@ -145,7 +532,8 @@ bufferevent_readcb(int fd, short event, void* arg)
     if (res <= 0)
         goto error;
 
-    bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+    if (bufferevent_rate_consume(bufev, EV_READ, res) == 0)
+        bufferevent_add(&bufev->ev_read, &bufev->tv_read);
 
     /* See if this callbacks meets the water marks */
     len = EVBUFFER_LENGTH(bufev->input);
@@ -162,16 +550,15 @@ bufferevent_readcb(int fd, short event, void* arg)
     }
 
     /* Invoke the user callback - must always be called last */
-    if (bufev->readcb != NULL)
-        (*bufev->readcb)(bufev, bufev->cbarg);
+    bufferevent_run_readcb(bufev);
     return;
 
 reschedule:
-    bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+    bufferevent_add(&bufev->ev_read, &bufev->tv_read);
     return;
 
 error:
-    (*bufev->errorcb)(bufev, what, bufev->cbarg);
+    bufferevent_run_errorcb(bufev, what);
 }
 
 static void
@@ -187,7 +574,12 @@ bufferevent_writecb(int fd, short event, void* arg)
     }
     // 有数据就写
     if (EVBUFFER_LENGTH(bufev->output)) {
-        res = evbuffer_write(bufev->output, fd);
+        long allowed = bufferevent_rate_allowed(bufev, EV_WRITE);
+        if (allowed == 0) {
+            bufferevent_rate_suspend(bufev, EV_WRITE);
+            return;
+        }
+        res = evbuffer_write_atmost(bufev->output, fd, allowed);
         if (res == -1) {
 #ifndef WIN32
             /*todo. evbuffer uses WriteFile when WIN32 is set. WIN32 system calls do not
@@ -209,30 +601,346 @@ bufferevent_writecb(int fd, short event, void* arg)
         }
         if (res <= 0)
             goto error;
+        bufferevent_rate_consume(bufev, EV_WRITE, res);
     }
 
     // 还有数据需要写
-    if (EVBUFFER_LENGTH(bufev->output) != 0)
-        bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+    if (EVBUFFER_LENGTH(bufev->output) != 0 &&
+        !BEV_RATE_SUSPENDED(bufev, EV_WRITE))
+        bufferevent_add(&bufev->ev_write, &bufev->tv_write);
 
     /*
      * Invoke the user callback if our buffer is drained or below the
      * low watermark.
      */
     // 输出缓冲区已经降到底水位，通知用户充水
-    if (bufev->writecb != NULL &&
-        EVBUFFER_LENGTH(bufev->output) <= bufev->wm_write.low)
-        (*bufev->writecb)(bufev, bufev->cbarg);
+    if (EVBUFFER_LENGTH(bufev->output) <= bufev->wm_write.low)
+        bufferevent_run_writecb(bufev);
 
     return;
 
 reschedule:
     if (EVBUFFER_LENGTH(bufev->output) != 0)
-        bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+        bufferevent_add(&bufev->ev_write, &bufev->tv_write);
     return;
 
 error:
-    (*bufev->errorcb)(bufev, what, bufev->cbarg);
+    bufferevent_run_errorcb(bufev, what);
+}
+
+/*
+ * Relaying between two bufferevents.  Data read from src waits in
+ * src->splice_pipe (or, without splice(2), in the output buffer of its
+ * peer) until the peer's fd is writable.
+ */
+
+#define SPLICE_MAX_PENDING 65536
+
+static size_t
+bufferevent_splice_limit(struct bufferevent* src)
+{
+    size_t limit = src->wm_read.high ? src->wm_read.high : SPLICE_MAX_PENDING;
+
+    /* splicing into a full pipe would fail with EAGAIN forever */
+    if (src->splice_pipe[0] != -1 && limit > src->splice_pipe_size)
+        limit = src->splice_pipe_size;
+    return (limit);
+}
+
+/* bytes that the peer of src still has to write */
+static size_t
+bufferevent_splice_pending(struct bufferevent* src)
+{
+    return (src->splice_len + EVBUFFER_LENGTH(src->splice_peer->output));
+}
+
+static void
+bufferevent_splice_close(struct bufferevent* bufev)
+{
+    if (bufev->splice_pipe[0] != -1) {
+        close(bufev->splice_pipe[0]);
+        close(bufev->splice_pipe[1]);
+    }
+    bufev->splice_pipe[0] = bufev->splice_pipe[1] = -1;
+    bufev->splice_len = 0;
+}
+
+/* move what is still in the pipe of src to the output buffer of dst */
+static void
+bufferevent_splice_drain(struct bufferevent* src, struct bufferevent* dst)
+{
+    int res;
+
+    while (src->splice_len > 0) {
+        res = evbuffer_read(dst->output, src->splice_pipe[0],
+                            src->splice_len);
+        if (res <= 0) {
+            event_warn("%s: lost %lu spliced bytes", __func__,
+                       (unsigned long)src->splice_len);
+            break;
+        }
+        src->splice_len -= res;
+    }
+}
+
+static void
+bufferevent_splice_unlink(struct bufferevent* bufev)
+{
+    struct bufferevent* peer = bufev->splice_peer;
+
+    if (peer == NULL)
+        return;
+
+    /* data already taken off one fd still has to reach the other one */
+    bufferevent_splice_drain(bufev, peer);
+    bufferevent_splice_drain(peer, bufev);
+
+    /* the peer falls back to the regular callbacks */
+    peer->splice_peer = NULL;
+    bufferevent_splice_close(peer);
+    if ((peer->enabled & EV_WRITE) && EVBUFFER_LENGTH(peer->output))
+        bufferevent_add(&peer->ev_write, &peer->tv_write);
+
+    bufev->splice_peer = NULL;
+    bufferevent_splice_close(bufev);
+}
+
+static int
+bufferevent_splice_read(struct bufferevent* src, int fd, size_t howmuch)
+{
+    int res;
+
+#ifdef HAVE_SPLICE
+    if (src->splice_pipe[0] != -1) {
+        res = splice(fd, NULL, src->splice_pipe[1], NULL, howmuch,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (res > 0) {
+            src->splice_len += res;
+            return (res);
+        }
+        /* this kind of fd cannot be spliced; copy instead */
+        if (res == -1 && errno == EINVAL && src->splice_len == 0)
+            bufferevent_splice_close(src);
+        else
+            return (res);
+    }
+#endif
+
+    res = evbuffer_read(src->input, fd, howmuch);
+    if (res > 0)
+        evbuffer_add_buffer(src->splice_peer->output, src->input);
+    return (res);
+}
+
+static void
+bufferevent_splice_readcb(int fd, short event, void* arg)
+{
+    struct bufferevent* src = arg;
+    struct bufferevent* dst = src->splice_peer;
+    short what = EVBUFFER_READ;
+    size_t pending, limit;
+    int res;
+
+    if (dst == NULL) {
+        bufferevent_readcb(fd, event, arg);
+        return;
+    }
+
+    if (event == EV_TIMEOUT) {
+        what |= EVBUFFER_TIMEOUT;
+        goto error;
+    }
+
+    /* the peer is behind; its write callback resumes reading */
+    limit = bufferevent_splice_limit(src);
+    pending = bufferevent_splice_pending(src);
+    if (pending >= limit)
+        return;
+
+    res = bufferevent_splice_read(src, fd, limit - pending);
+    if (res == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            goto reschedule;
+        /* error case */
+        what |= EVBUFFER_ERROR;
+    } else if (res == 0) {
+        /* eof case */
+        what |= EVBUFFER_EOF;
+    }
+
+    if (res <= 0)
+        goto error;
+
+    if (dst->enabled & EV_WRITE)
+        bufferevent_add(&dst->ev_write, &dst->tv_write);
+
+reschedule:
+    if (bufferevent_splice_pending(src) < limit)
+        bufferevent_add(&src->ev_read, &src->tv_read);
+    return;
+
+error:
+    bufferevent_run_errorcb(src, what);
+}
+
+static int
+bufferevent_splice_write(struct bufferevent* dst, int fd)
+{
+    struct bufferevent* src = dst->splice_peer;
+    int res = 0;
+
+    /* data in the output buffer is older than data in the pipe */
+    if (EVBUFFER_LENGTH(dst->output))
+        return (evbuffer_write(dst->output, fd));
+
+#ifdef HAVE_SPLICE
+    if (src->splice_len) {
+        res = splice(src->splice_pipe[0], NULL, fd, NULL, src->splice_len,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (res > 0)
+            src->splice_len -= res;
+    }
+#endif
+
+    return (res);
+}
+
+static void
+bufferevent_splice_writecb(int fd, short event, void* arg)
+{
+    struct bufferevent* dst = arg;
+    struct bufferevent* src = dst->splice_peer;
+    short what = EVBUFFER_WRITE;
+    size_t pending;
+    int res;
+
+    if (src == NULL) {
+        bufferevent_writecb(fd, event, arg);
+        return;
+    }
+
+    if (event == EV_TIMEOUT) {
+        what |= EVBUFFER_TIMEOUT;
+        goto error;
+    }
+
+    if (bufferevent_splice_pending(src)) {
+        res = bufferevent_splice_write(dst, fd);
+        if (res == -1) {
+            if (errno == EAGAIN ||
+                errno == EINTR ||
+                errno == EINPROGRESS)
+                goto reschedule;
+            /* error case */
+            what |= EVBUFFER_ERROR;
+        } else if (res == 0) {
+            /* eof case */
+            what |= EVBUFFER_EOF;
+        }
+        if (res <= 0)
+            goto error;
+    }
+
+    pending = bufferevent_splice_pending(src);
+    if (pending != 0)
+        bufferevent_add(&dst->ev_write, &dst->tv_write);
+
+    /* we made room for more data from src */
+    if ((src->enabled & EV_READ) &&
+        pending < bufferevent_splice_limit(src) &&
+        !event_pending(&src->ev_read, EV_READ, NULL))
+        bufferevent_add(&src->ev_read, &src->tv_read);
+
+    if (pending <= dst->wm_write.low)
+        bufferevent_run_writecb(dst);
+
+    return;
+
+reschedule:
+    if (bufferevent_splice_pending(src) != 0)
+        bufferevent_add(&dst->ev_write, &dst->tv_write);
+    return;
+
+error:
+    bufferevent_run_errorcb(dst, what);
+}
+
+static void
+bufferevent_splice_setcb(struct bufferevent* bufev)
+{
+    int pri = bufev->ev_read.ev_pri;
+
+    event_del(&bufev->ev_read);
+    event_del(&bufev->ev_write);
+
+    event_set(&bufev->ev_read, bufev->ev_read.ev_fd, EV_READ,
+              bufferevent_splice_readcb, bufev);
+    event_set(&bufev->ev_write, bufev->ev_write.ev_fd, EV_WRITE,
+              bufferevent_splice_writecb, bufev);
+    if (bufev->ev_base != NULL) {
+        event_base_set(bufev->ev_base, &bufev->ev_read);
+        event_base_set(bufev->ev_base, &bufev->ev_write);
+    }
+    bufferevent_priority_set(bufev, pri);
+}
+
+#ifdef HAVE_SPLICE
+/* let the pipe hold a full read watermark where the system allows it */
+static void
+bufferevent_splice_pipe_size(struct bufferevent* bufev)
+{
+    int size = SPLICE_MAX_PENDING;
+
+    if (bufev->splice_pipe[0] == -1)
+        return;
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    if (bufev->wm_read.high > SPLICE_MAX_PENDING)
+        fcntl(bufev->splice_pipe[1], F_SETPIPE_SZ, (int)bufev->wm_read.high);
+    if ((size = fcntl(bufev->splice_pipe[1], F_GETPIPE_SZ)) <= 0)
+        size = SPLICE_MAX_PENDING;
+#endif
+    bufev->splice_pipe_size = size;
+}
+#endif
+
+int
+bufferevent_pair_splice(struct bufferevent* a, struct bufferevent* b)
+{
+    struct bufferevent* bufevs[2];
+    int i;
+
+    if (a == b || a->splice_peer != NULL || b->splice_peer != NULL)
+        return (-1);
+
+#ifdef HAVE_SPLICE
+    /* without a pipe we fall back to copying through the evbuffers */
+    if (pipe(a->splice_pipe) == -1)
+        a->splice_pipe[0] = a->splice_pipe[1] = -1;
+    if (pipe(b->splice_pipe) == -1)
+        b->splice_pipe[0] = b->splice_pipe[1] = -1;
+    bufferevent_splice_pipe_size(a);
+    bufferevent_splice_pipe_size(b);
+#endif
+
+    a->splice_peer = b;
+    b->splice_peer = a;
+
+    /* whatever has been read already goes out first */
+    evbuffer_add_buffer(b->output, a->input);
+    evbuffer_add_buffer(a->output, b->input);
+
+    bufevs[0] = a;
+    bufevs[1] = b;
+    for (i = 0; i < 2; i++) {
+        struct bufferevent* bufev = bufevs[i];
+        bufferevent_splice_setcb(bufev);
+        if (bufev->enabled & EV_READ)
+            bufferevent_add(&bufev->ev_read, &bufev->tv_read);
+        if ((bufev->enabled & EV_WRITE) && EVBUFFER_LENGTH(bufev->output))
+            bufferevent_add(&bufev->ev_write, &bufev->tv_write);
+    }
+
+    return (0);
 }
 
 /*
@@ -252,25 +960,33 @@ bufferevent_new(int fd, evbuffercb readcb, evbuffercb writecb,
 {
     struct bufferevent* bufev;
 
-    if ((bufev = calloc(1, sizeof(struct bufferevent))) == NULL)
+    if ((bufev = mm_calloc(1, sizeof(struct bufferevent))) == NULL)
         return (NULL);
 
     if ((bufev->input = evbuffer_new()) == NULL) {
-        free(bufev);
+        mm_free(bufev);
         return (NULL);
     }
 
     if ((bufev->output = evbuffer_new()) == NULL) {
         evbuffer_free(bufev->input);
-        free(bufev);
+        mm_free(bufev);
         return (NULL);
     }
 
+    evbuffer_set_shrink(bufev->input, EVBUFFER_SHRINK_THRESHOLD);
+    evbuffer_set_shrink(bufev->output, EVBUFFER_SHRINK_THRESHOLD);
+
     event_set(&bufev->ev_read, fd, EV_READ, bufferevent_readcb, bufev);
     event_set(&bufev->ev_write, fd, EV_WRITE, bufferevent_writecb, bufev);
+    evbuffer_set_pool(bufev->input, bufev->ev_read.ev_base);
+    evbuffer_set_pool(bufev->output, bufev->ev_read.ev_base);
+    event_base_busy_poll_socket(bufev->ev_read.ev_base, fd);
 
     bufferevent_setcb(bufev, readcb, writecb, errorcb, cbarg);
 
+    bufev->splice_pipe[0] = bufev->splice_pipe[1] = -1;
+
     /*
      * Set to EV_WRITE so that using bufferevent_write is going to
      * trigger a callback.  Reading needs to be explicitly enabled
@@ -298,12 +1014,15 @@ bufferevent_setfd(struct bufferevent* bufev, int fd)
     event_del(&bufev->ev_read);
     event_del(&bufev->ev_write);
 
+    bufferevent_splice_unlink(bufev);
+
     event_set(&bufev->ev_read, fd, EV_READ, bufferevent_readcb, bufev);
     event_set(&bufev->ev_write, fd, EV_WRITE, bufferevent_writecb, bufev);
     if (bufev->ev_base != NULL) {
         event_base_set(bufev->ev_base, &bufev->ev_read);
         event_base_set(bufev->ev_base, &bufev->ev_write);
     }
+    event_base_busy_poll_socket(bufev->ev_read.ev_base, fd);
 
     /* might have to manually trigger event registration */
 }
@@ -324,13 +1043,85 @@ bufferevent_priority_set(struct bufferevent* bufev, int priority)
 void
 bufferevent_free(struct bufferevent* bufev)
 {
+    /* called from a deferred callback; finish once that returns */
+    if (bufev->deferred != NULL && bufev->deferred->running) {
+        bufev->deferred->freed = 1;
+        return;
+    }
+
+    bufferevent_free_internal(bufev);
+}
+
+static void
+bufferevent_free_internal(struct bufferevent* bufev)
+{
+    bufferevent_rate_limit_put(bufev, 1);
+
+    if (bufev->deferred != NULL) {
+        event_deferred_cb_cancel(&bufev->deferred->dcb);
+        event_deferred_cb_cancel(&bufev->deferred->uncork);
+        mm_free(bufev->deferred);
+    }
+
     event_del(&bufev->ev_read);
     event_del(&bufev->ev_write);
 
+    bufferevent_splice_unlink(bufev);
+
     evbuffer_free(bufev->input);
     evbuffer_free(bufev->output);
 
-    free(bufev);
+    mm_free(bufev);
+}
+
+/*
+ * Tries to write the output buffer right away instead of waiting for the
+ * fd to become writable.  Returns 0 if EV_WRITE still has to be armed.
+ */
+static int
+bufferevent_write_eager(struct bufferevent* bufev)
+{
+    long allowed;
+    int res;
+
+    /* the socket was full, or data in the splice pipe has to go first */
+    if ((bufev->ev_write.ev_flags & EVLIST_INSERTED) ||
+        bufev->splice_peer != NULL)
+        return (0);
+
+    if ((allowed = bufferevent_rate_allowed(bufev, EV_WRITE)) == 0)
+        return (0);
+
+    /* errors are left to bufferevent_writecb() to report */
+    res = evbuffer_write_atmost(bufev->output, bufev->ev_write.ev_fd, allowed);
+    if (res <= 0)
+        return (0);
+    if (bufferevent_rate_consume(bufev, EV_WRITE, res) == -1)
+        return (1);
+
+    if (EVBUFFER_LENGTH(bufev->output) != 0)
+        return (0);
+
+    /*
+     * The write callback must not run from inside bufferevent_write();
+     * activating the event delivers it from the loop without involving
+     * the backend.
+     */
+    if (bufev->writecb != NULL)
+        event_active(&bufev->ev_write, EV_WRITE, 1);
+    return (1);
+}
+
+static void
+bufferevent_schedule_write(struct bufferevent* bufev)
+{
+    if (!(bufev->enabled & EV_WRITE) || bufev->corked ||
+        BEV_RATE_SUSPENDED(bufev, EV_WRITE))
+        return;
+
+    if (bufev->eager_write && bufferevent_write_eager(bufev))
+        return;
+    bufferevent_add(&bufev->ev_write, &bufev->tv_write);
 }
 
 /*
@@ -349,12 +1140,55 @@ bufferevent_write(struct bufferevent* bufev, const void* data, size_t size)
         return (res);
 
     /* If everything is okay, we need to schedule a write */
-    if (size > 0 && (bufev->enabled & EV_WRITE))
-        bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+    if (size > 0)
+        bufferevent_schedule_write(bufev);
 
     return (res);
 }
 
+/* the data stays in the output buffer until the uncork */
+int
+bufferevent_cork(struct bufferevent* bufev)
+{
+    struct bufferevent_deferred* deferred;
+
+    if (bufev->ev_write.ev_base == NULL ||
+        (deferred = bufferevent_deferred_get(bufev)) == NULL)
+        return (-1);
+
+    /* in case nobody uncorks before the loop iteration ends */
+    if (bufev->corked++ == 0)
+        event_deferred_cb_schedule(bufev->ev_write.ev_base, &deferred->uncork);
+
+    return (0);
+}
+
+void
+bufferevent_uncork(struct bufferevent* bufev)
+{
+    if (bufev->corked == 0 || --bufev->corked != 0)
+        return;
+
+    event_deferred_cb_cancel(&bufev->deferred->uncork);
+    if (EVBUFFER_LENGTH(bufev->output) != 0)
+        bufferevent_schedule_write(bufev);
+}
+
+static void
+bufferevent_uncork_cb(struct deferred_cb* dcb, void* arg)
+{
+    struct bufferevent* bufev = arg;
+
+    bufev->corked = 1;
+    bufferevent_uncork(bufev);
+}
+
+void
+bufferevent_set_eager_write(struct bufferevent* bufev, int enable)
+{
+    bufev->eager_write = enable;
+}
+
 int
 bufferevent_write_buffer(struct bufferevent* bufev, struct evbuffer* buf)
 {
@@ -381,18 +1215,21 @@ bufferevent_read(struct bufferevent* bufev, void* data, size_t size)
     if (size)
         evbuffer_drain(buf, size);
 
+    /* an idle connection does not need to hold on to any storage */
+    evbuffer_release_pooled(buf);
+
     return (size);
 }
 
 int
 bufferevent_enable(struct bufferevent* bufev, short event)
 {
-    if (event & EV_READ) {
-        if (bufferevent_add(&bufev->ev_read, bufev->timeout_read) == -1)
+    if ((event & EV_READ) && !BEV_RATE_SUSPENDED(bufev, EV_READ)) {
+        if (bufferevent_add(&bufev->ev_read, &bufev->tv_read) == -1)
             return (-1);
     }
-    if (event & EV_WRITE) {
-        if (bufferevent_add(&bufev->ev_write, bufev->timeout_write) == -1)
+    if ((event & EV_WRITE) && !BEV_RATE_SUSPENDED(bufev, EV_WRITE)) {
+        if (bufferevent_add(&bufev->ev_write, &bufev->tv_write) == -1)
             return (-1);
     }
 
@@ -424,13 +1261,37 @@ void
 bufferevent_settimeout(struct bufferevent* bufev,
                        int timeout_read, int timeout_write)
 {
-    bufev->timeout_read = timeout_read;
-    bufev->timeout_write = timeout_write;
+    struct timeval tv_read, tv_write;
+
+    evutil_timerclear(&tv_read);
+    tv_read.tv_sec = timeout_read;
+    evutil_timerclear(&tv_write);
+    tv_write.tv_sec = timeout_write;
+
+    bufferevent_set_timeouts(bufev, &tv_read, &tv_write);
+}
+
+void
+bufferevent_set_timeouts(struct bufferevent* bufev,
+                         const struct timeval* tv_read, const struct timeval* tv_write)
+{
+    if (tv_read != NULL)
+        bufev->tv_read = *tv_read;
+    else
+        evutil_timerclear(&bufev->tv_read);
+    if (tv_write != NULL)
+        bufev->tv_write = *tv_write;
+    else
+        evutil_timerclear(&bufev->tv_write);
+
+    /* kept for code that still looks at the whole seconds */
+    bufev->timeout_read = bufev->tv_read.tv_sec;
+    bufev->timeout_write = bufev->tv_write.tv_sec;
 
     if (event_pending(&bufev->ev_read, EV_READ, NULL))
-        bufferevent_add(&bufev->ev_read, timeout_read);
+        bufferevent_add(&bufev->ev_read, &bufev->tv_read);
     if (event_pending(&bufev->ev_write, EV_WRITE, NULL))
-        bufferevent_add(&bufev->ev_write, timeout_write);
+        bufferevent_add(&bufev->ev_write, &bufev->tv_write);
 }
 
 /*
@@ -462,11 +1323,306 @@ bufferevent_base_set(struct event_base* base, struct bufferevent* bufev)
     int res;
 
     bufev->ev_base = base;
+    evbuffer_set_pool(bufev->input, base);
+    evbuffer_set_pool(bufev->output, base);
+    event_base_busy_poll_socket(base, bufev->ev_read.ev_fd);
 
     res = event_base_set(base, &bufev->ev_read);
     if (res == -1)
         return (res);
 
     res = event_base_set(base, &bufev->ev_write);
+    if (res == -1)
+        return (res);
+
+    if (bufev->rate_limit != NULL)
+        res = event_base_set(base, &bufev->rate_limit->refill_ev);
+    if (res == -1)
+        return (res);
+
+    if (bufev->deferred != NULL && bufev->deferred->enabled)
+        res = bufferevent_set_deferred_callbacks(bufev, 1);
     return (res);
 }
+
+/*
+ * Moving a bufferevent to another base.  Everything it has scheduled is
+ * taken off the old base on the thread of that base; what was pending
+ * is added again from the thread of the new one.
+ */
+struct bufferevent_migration {
+    struct bufferevent* bufev;
+    struct event_base* base;
+    int pri;
+    short pending;              /* EV_READ/EV_WRITE that were scheduled */
+    int refill;                 /* the refill timer was running */
+    struct timeval read_expiry; /* when the timeouts were due, if set */
+    struct timeval write_expiry;
+    struct timeval refill_expiry;
+    void (*cb)(struct bufferevent*, void*);
+    void* arg;
+};
+
+/* removes ev; returns 1 if it was pending */
+static int
+bufferevent_migrate_del(struct event* ev, short what, struct timeval* expiry)
+{
+    evutil_timerclear(expiry);
+    if (!event_pending(ev, what | EV_TIMEOUT, expiry))
+        return (0);
+
+    event_del(ev);
+    return (1);
+}
+
+/* adds ev again with what is left of its timeout */
+static int
+bufferevent_migrate_add(struct event* ev, const struct timeval* expiry)
+{
+    struct timeval now, left;
+
+    if (!evutil_timerisset(expiry))
+        return (event_add(ev, NULL));
+
+    evutil_gettimeofday(&now, NULL);
+    evutil_timersub(expiry, &now, &left);
+    /* it expired on the way; let it fire right away */
+    if (left.tv_sec < 0 || !evutil_timerisset(&left)) {
+        left.tv_sec = 0;
+        left.tv_usec = 1;
+    }
+
+    return (event_add(ev, &left));
+}
+
+static void
+bufferevent_migrate_attach(void* arg)
+{
+    struct bufferevent_migration* mig = arg;
+    struct bufferevent* bufev = mig->bufev;
+    struct bufferevent_deferred* deferred = bufev->deferred;
+
+    bufferevent_base_set(mig->base, bufev);
+    if (mig->pri < mig->base->nactivequeues)
+        bufferevent_priority_set(bufev, mig->pri);
+
+    if (mig->pending & EV_READ)
+        bufferevent_migrate_add(&bufev->ev_read, &mig->read_expiry);
+    if (mig->pending & EV_WRITE)
+        bufferevent_migrate_add(&bufev->ev_write, &mig->write_expiry);
+    if (mig->refill)
+        bufferevent_migrate_add(&bufev->rate_limit->refill_ev,
+                                &mig->refill_expiry);
+
+    if (deferred != NULL) {
+        if (deferred->pending || deferred->error)
+            event_deferred_cb_schedule(mig->base, &deferred->dcb);
+        if (bufev->corked)
+            event_deferred_cb_schedule(mig->base, &deferred->uncork);
+    }
+
+    if (mig->cb != NULL)
+        (*mig->cb)(bufev, mig->arg);
+    mm_free(mig);
+}
+
+int
+bufferevent_migrate(struct bufferevent* bufev, struct event_base* base,
+                    void (*cb)(struct bufferevent*, void*), void* arg)
+{
+    struct bufferevent_deferred* deferred = bufev->deferred;
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+    struct bufferevent_migration* mig;
+
+    /* a relay partner or a group timer would stay behind */
+    if (bufev->ev_read.ev_base == NULL || bufev->splice_peer != NULL ||
+        (rl != NULL && rl->group != NULL) ||
+        (deferred != NULL && deferred->running))
+        return (-1);
+
+    if ((mig = mm_calloc(1, sizeof(struct bufferevent_migration))) == NULL)
+        return (-1);
+    mig->bufev = bufev;
+    mig->base = base;
+    mig->pri = bufev->ev_read.ev_pri;
+    mig->cb = cb;
+    mig->arg = arg;
+
+    /* buffer changes not reported yet are reported on this loop */
+    if (deferred != NULL && deferred->enabled) {
+        evbuffer_defer_callbacks(bufev->input, NULL);
+        evbuffer_defer_callbacks(bufev->output, NULL);
+    }
+
+    if (bufferevent_migrate_del(&bufev->ev_read, EV_READ, &mig->read_expiry))
+        mig->pending |= EV_READ;
+    if (bufferevent_migrate_del(&bufev->ev_write, EV_WRITE, &mig->write_expiry))
+        mig->pending |= EV_WRITE;
+    if (rl != NULL)
+        mig->refill = bufferevent_migrate_del(&rl->refill_ev, EV_TIMEOUT,
+                                              &mig->refill_expiry);
+    if (deferred != NULL) {
+        event_deferred_cb_cancel(&deferred->dcb);
+        event_deferred_cb_cancel(&deferred->uncork);
+    }
+
+    evbuffer_set_pool(bufev->input, NULL);
+    evbuffer_set_pool(bufev->output, NULL);
+
+    /* a base nobody can post to runs on this thread */
+    if (base->notify == NULL) {
+        bufferevent_migrate_attach(mig);
+        return (0);
+    }
+
+    if (event_base_post(base, bufferevent_migrate_attach, mig) == -1) {
+        mig->base = bufev->ev_read.ev_base;
+        mig->cb = NULL;
+        bufferevent_migrate_attach(mig);
+        return (-1);
+    }
+
+    return (0);
+}
+
+int
+bufferevent_set_rate_limit(struct bufferevent* bufev,
+                           size_t read_rate, size_t write_rate, const struct timeval* tick)
+{
+    struct bufferevent_rate_limit* rl;
+
+    if ((read_rate || write_rate) &&
+        (tick == NULL || !evutil_timerisset(tick)))
+        return (-1);
+
+    if (!read_rate && !write_rate) {
+        if ((rl = bufev->rate_limit) == NULL)
+            return (0);
+        rl->read_rate = rl->write_rate = 0;
+        event_del(&rl->refill_ev);
+        bufferevent_rate_resume(bufev);
+        bufferevent_rate_limit_put(bufev, 0);
+        return (0);
+    }
+
+    if ((rl = bufferevent_rate_limit_get(bufev)) == NULL)
+        return (-1);
+
+    rl->read_rate = read_rate;
+    rl->write_rate = write_rate;
+    rl->tick = *tick;
+    evutil_gettimeofday(&rl->last_refill, NULL);
+    bufferevent_rate_refill(rl, &rl->last_refill);
+
+    /* the new buckets start out full */
+    event_del(&rl->refill_ev);
+    bufferevent_rate_resume(bufev);
+
+    return (0);
+}
+
+struct bufferevent_rate_limit_group*
+bufferevent_rate_limit_group_new(struct event_base* base,
+                                 size_t read_rate, size_t write_rate, const struct timeval* tick)
+{
+    struct bufferevent_rate_limit_group* group;
+
+    if (tick == NULL || !evutil_timerisset(tick))
+        return (NULL);
+
+    if ((group = mm_calloc(1, sizeof(struct bufferevent_rate_limit_group))) == NULL)
+        return (NULL);
+
+    TAILQ_INIT(&group->members);
+    group->read_limit = group->read_rate = read_rate;
+    group->write_limit = group->write_rate = write_rate;
+    group->tick = *tick;
+
+    evtimer_set(&group->refill_ev, bufferevent_rate_group_refillcb, group);
+    if (base != NULL)
+        event_base_set(base, &group->refill_ev);
+    evtimer_add(&group->refill_ev, &group->tick);
+
+    return (group);
+}
+
+void
+bufferevent_rate_limit_group_free(struct bufferevent_rate_limit_group* group)
+{
+    struct bufferevent_rate_limit* rl;
+
+    while ((rl = TAILQ_FIRST(&group->members)) != NULL)
+        bufferevent_remove_from_rate_limit_group(rl->bufev);
+
+    event_del(&group->refill_ev);
+    mm_free(group);
+}
+
+int
+bufferevent_add_to_rate_limit_group(struct bufferevent* bufev,
+                                    struct bufferevent_rate_limit_group* group)
+{
+    struct bufferevent_rate_limit* rl;
+
+    if (bufev->rate_limit != NULL && bufev->rate_limit->group == group)
+        return (0);
+
+    if ((rl = bufferevent_rate_limit_get(bufev)) == NULL)
+        return (-1);
+
+    if (rl->group != NULL)
+        bufferevent_rate_group_unlink(rl);
+
+    rl->group = group;
+    TAILQ_INSERT_TAIL(&group->members, rl, next);
+    group->nmembers++;
+
+    /* from now on the group timer refills the own buckets as well */
+    event_del(&rl->refill_ev);
+
+    return (0);
+}
+
+int
+bufferevent_remove_from_rate_limit_group(struct bufferevent* bufev)
+{
+    struct bufferevent_rate_limit* rl = bufev->rate_limit;
+
+    if (rl == NULL || rl->group == NULL)
+        return (0);
+
+    bufferevent_rate_group_unlink(rl);
+    bufferevent_rate_resume(bufev);
+    /* still waiting for its own bucket, which needs its own timer again */
+    if (rl->suspended && (rl->read_rate || rl->write_rate) &&
+        !evtimer_pending(&rl->refill_ev, NULL))
+        evtimer_add(&rl->refill_ev, &rl->tick);
+    bufferevent_rate_limit_put(bufev, 0);
+
+    return (0);
+}
+
+int
+bufferevent_set_deferred_callbacks(struct bufferevent* bufev, int enable)
+{
+    struct bufferevent_deferred* deferred = bufev->deferred;
+    struct event_base* base = bufev->ev_read.ev_base;
+
+    if (enable && base == NULL)
+        return (-1);
+
+    if (deferred == NULL) {
+        if (!enable)
+            return (0);
+        if ((deferred = bufferevent_deferred_get(bufev)) == NULL)
+            return (-1);
+    }
+
+    /* callbacks that are already queued still run at the end */
+    deferred->enabled = enable;
+    if (evbuffer_defer_callbacks(bufev->input, enable ? base : NULL) == -1 ||
+        evbuffer_defer_callbacks(bufev->output, enable ? base : NULL) == -1)
+        return (-1);
+
+    return (0);
+}
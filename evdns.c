@@ -98,10 +98,13 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <sys/queue.h>
 
 #include "evdns.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 #ifdef WIN32
 #include <winsock2.h>
 #include <windows.h>
@@ -135,6 +138,7 @@ typedef ev_uint8_t u_char;
 typedef unsigned int uint;
 #endif
 #include <event.h>
+#include "event-internal.h"
 
 #define u64 ev_uint64_t
 #define u32 ev_uint32_t
@@ -235,8 +239,9 @@ struct nameserver {
     char write_waiting;  /* true if we are waiting for EV_WRITE events */
 };
 
-static struct request* req_head = NULL, *req_waiting_head = NULL;
-static struct nameserver* server_head = NULL;
+/* The resolver state is per thread, like current_base in event.c */
+static EVENT_THREAD_LOCAL struct request* req_head = NULL, *req_waiting_head = NULL;
+static EVENT_THREAD_LOCAL struct nameserver* server_head = NULL;
 
 /* Represents a local port where we're listening for DNS requests. Right now, */
 /* only UDP is supported. */
@@ -305,22 +310,22 @@ struct server_request {
      (((char*)(base_ptr) - OFFSET_OF(struct server_request, base))))
 
 /* The number of good nameservers that we have */
-static int global_good_nameservers = 0;
+static EVENT_THREAD_LOCAL int global_good_nameservers = 0;
 
 /* inflight requests are contained in the req_head list */
 /* and are actually going out across the network */
-static int global_requests_inflight = 0;
+static EVENT_THREAD_LOCAL int global_requests_inflight = 0;
 /* requests which aren't inflight are in the waiting list */
 /* and are counted here */
-static int global_requests_waiting = 0;
+static EVENT_THREAD_LOCAL int global_requests_waiting = 0;
 
-static int global_max_requests_inflight = 64;
+static EVENT_THREAD_LOCAL int global_max_requests_inflight = 64;
 
-static struct timeval global_timeout = {5, 0};  /* 5 seconds */
-static int global_max_reissues = 1;  /* a reissue occurs when we get some errors from the server */
-static int global_max_retransmits = 3;  /* number of times we'll retransmit a request which timed out */
+static EVENT_THREAD_LOCAL struct timeval global_timeout = {5, 0};  /* 5 seconds */
+static EVENT_THREAD_LOCAL int global_max_reissues = 1;  /* a reissue occurs when we get some errors from the server */
+static EVENT_THREAD_LOCAL int global_max_retransmits = 3;  /* number of times we'll retransmit a request which timed out */
 /* number of timeouts in a row before we consider this server to be down */
-static int global_max_nameserver_timeout = 3;
+static EVENT_THREAD_LOCAL int global_max_nameserver_timeout = 3;
 
 /* These are the timeout values for nameservers. If we find a nameserver is down */
 /* we try to probe it at intervals as given below. Values are in seconds. */
@@ -395,7 +400,7 @@ inet_aton(const char* c, struct in_addr* addr)
 static const char*
 debug_ntoa(u32 address)
 {
-    static char buf[32];
+    static EVENT_THREAD_LOCAL char buf[32];
     u32 a = ntohl(address);
     evutil_snprintf(buf, sizeof(buf), "%d.%d.%d.%d",
                     (int)(u8)((a >> 24) & 0xff),
@@ -424,7 +429,7 @@ static void
 _evdns_log(int warn, const char* fmt, ...)
 {
     va_list args;
-    static char buf[512];
+    static EVENT_THREAD_LOCAL char buf[512];
     if (!evdns_log_fn)
         return;
     va_start(args, fmt);
@@ -589,13 +594,13 @@ request_finished(struct request* const req, struct request** head)
 
     if (!req->request_appended) {
         /* need to free the request data on it's own */
-        free(req->request);
+        mm_free(req->request);
     } else {
         /* the request data is appended onto the header */
         /* so everything gets free()ed when we: */
     }
 
-    free(req);
+    mm_free(req);
 
     evdns_requests_pump_waiting_queue();
 }
@@ -1003,7 +1008,7 @@ request_parse(u8* packet, int length, struct evdns_server_port* port, struct soc
     if (flags & 0x8000) return -1; /* Must not be an answer. */
     flags &= 0x0110; /* Only RD and CD get preserved. */
     // NOTE:怎么没看到server_req的释放?会调用TO_SERVER_REQUEST将server_req->base偏移到头指针获得
-    server_req = malloc(sizeof(struct server_request));
+    server_req = mm_malloc(sizeof(struct server_request));
     if (server_req == NULL) return -1;
     memset(server_req, 0, sizeof(struct server_request));
 
@@ -1013,7 +1018,7 @@ request_parse(u8* packet, int length, struct evdns_server_port* port, struct soc
 
     server_req->base.flags = flags;
     server_req->base.nquestions = 0;
-    server_req->base.questions = malloc(sizeof(struct evdns_server_question*) * questions);
+    server_req->base.questions = mm_malloc(sizeof(struct evdns_server_question*) * questions);
     if (server_req->base.questions == NULL)
         goto err;
 
@@ -1026,7 +1031,7 @@ request_parse(u8* packet, int length, struct evdns_server_port* port, struct soc
         GET16(type);
         GET16(class);
         namelen = strlen(tmp_name);
-        q = malloc(sizeof(struct evdns_server_question) + namelen);
+        q = mm_malloc(sizeof(struct evdns_server_question) + namelen);
         if (!q)
             goto err;
         q->type = type;
@@ -1053,10 +1058,10 @@ err:
     if (server_req) {
         if (server_req->base.questions) {
             for (i = 0; i < server_req->base.nquestions; ++i)
-                free(server_req->base.questions[i]);
-            free(server_req->base.questions);
+                mm_free(server_req->base.questions[i]);
+            mm_free(server_req->base.questions);
         }
-        free(server_req);
+        mm_free(server_req);
     }
     return -1;
 
@@ -1352,7 +1357,7 @@ dnslabel_clear(struct dnslabel_table* table)
 {
     int i;
     for (i = 0; i < table->n_labels; ++i)
-        free(table->labels[i].v);
+        mm_free(table->labels[i].v);
     table->n_labels = 0;
 }
 
@@ -1377,7 +1382,7 @@ dnslabel_table_add(struct dnslabel_table* table, const char* label, off_t pos)
     int p;
     if (table->n_labels == MAX_LABELS)
         return (-1);
-    v = strdup(label);
+    v = mm_strdup(label);
     if (v == NULL)
         return (-1);
     p = table->n_labels++;
@@ -1514,7 +1519,7 @@ struct evdns_server_port*
 evdns_add_server_port(int socket, int is_tcp, evdns_request_callback_fn_type cb, void* user_data)
 {
     struct evdns_server_port* port;
-    if (!(port = malloc(sizeof(struct evdns_server_port))))
+    if (!(port = mm_malloc(sizeof(struct evdns_server_port))))
         return NULL;
     memset(port, 0, sizeof(struct evdns_server_port));
 
@@ -1573,12 +1578,12 @@ evdns_server_request_add_reply(struct evdns_server_request* _req, int section, c
     while (*itemp) {
         itemp = &((*itemp)->next);
     }
-    item = malloc(sizeof(struct server_reply_item));
+    item = mm_malloc(sizeof(struct server_reply_item));
     if (!item)
         return -1;
     item->next = NULL;
-    if (!(item->name = strdup(name))) {
-        free(item);
+    if (!(item->name = mm_strdup(name))) {
+        mm_free(item);
         return -1;
     }
     item->type = type;
@@ -1589,16 +1594,16 @@ evdns_server_request_add_reply(struct evdns_server_request* _req, int section, c
     item->data = NULL;
     if (data) {
         if (item->is_name) {
-            if (!(item->data = strdup(data))) {
-                free(item->name);
-                free(item);
+            if (!(item->data = mm_strdup(data))) {
+                mm_free(item->name);
+                mm_free(item);
                 return -1;
             }
             item->datalen = (u16) - 1;
         } else {
-            if (!(item->data = malloc(datalen))) {
-                free(item->name);
-                free(item);
+            if (!(item->data = mm_malloc(datalen))) {
+                mm_free(item->name);
+                mm_free(item);
                 return -1;
             }
             item->datalen = datalen;
@@ -1747,7 +1752,7 @@ overflow:
 
     req->response_len = j;
 
-    if (!(req->response = malloc(req->response_len))) {
+    if (!(req->response = mm_malloc(req->response_len))) {
         server_request_free_answers(req);
         dnslabel_clear(&table);
         return (-1);
@@ -1824,10 +1829,10 @@ server_request_free_answers(struct server_request* req)
         victim = *list;
         while (victim) {
             next = victim->next;
-            free(victim->name);
+            mm_free(victim->name);
             if (victim->data)
-                free(victim->data);
-            free(victim);
+                mm_free(victim->data);
+            mm_free(victim);
             victim = next;
         }
         *list = NULL;
@@ -1842,8 +1847,8 @@ server_request_free(struct server_request* req)
     int i, rc = 1;
     if (req->base.questions) {
         for (i = 0; i < req->base.nquestions; ++i)
-            free(req->base.questions[i]);
-        free(req->base.questions);
+            mm_free(req->base.questions[i]);
+        mm_free(req->base.questions);
     }
 
     if (req->port) {
@@ -1857,7 +1862,7 @@ server_request_free(struct server_request* req)
     }
 
     if (req->response) {
-        free(req->response);
+        mm_free(req->response);
     }
 
     server_request_free_answers(req);
@@ -1869,10 +1874,10 @@ server_request_free(struct server_request* req)
 
     if (rc == 0) {
         server_port_free(req->port);
-        free(req);
+        mm_free(req);
         return (1);
     }
-    free(req);
+    mm_free(req);
     return (0);
 }
 
@@ -2108,7 +2113,7 @@ evdns_clear_nameservers_and_suspend(void)
             (void) evtimer_del(&server->timeout_event);
         if (server->socket >= 0)
             CLOSE_SOCKET(server->socket);
-        free(server);
+        mm_free(server);
         if (next == started_at)
             break;
         server = next;
@@ -2168,7 +2173,7 @@ _evdns_nameserver_add_impl(unsigned long int address, int port)
         } while (server != started_at);
     }
 
-    ns = (struct nameserver*) malloc(sizeof(struct nameserver));
+    ns = (struct nameserver*) mm_malloc(sizeof(struct nameserver));
     if (!ns) return -1;
 
     memset(ns, 0, sizeof(struct nameserver));
@@ -2218,7 +2223,7 @@ _evdns_nameserver_add_impl(unsigned long int address, int port)
 out2:
     CLOSE_SOCKET(ns->socket);
 out1:
-    free(ns);
+    mm_free(ns);
     log(EVDNS_LOG_WARN, "Unable to add nameserver %s: error %d", debug_ntoa(address), err);
     return err;
 }
@@ -2302,7 +2307,7 @@ request_new(int type, const char* name, int flags,
     const u16 trans_id = issuing_now ? transaction_id_pick() : 0xffff;
     /* the request data is alloced in a single block with the header */
     struct request* const req =
-        (struct request*) malloc(sizeof(struct request) + request_max_len);
+        (struct request*) mm_malloc(sizeof(struct request) + request_max_len);
     int rlen;
     (void) flags;
 
@@ -2330,7 +2335,7 @@ request_new(int type, const char* name, int flags,
 
     return req;
 err1:
-    free(req);
+    mm_free(req);
     return NULL;
 }
 
@@ -2453,7 +2458,7 @@ struct search_state {
     struct search_domain* head;
 };
 
-static struct search_state* global_search_state = NULL;
+static EVENT_THREAD_LOCAL struct search_state* global_search_state = NULL;
 
 static void
 search_state_decref(struct search_state* const state)
@@ -2464,16 +2469,16 @@ search_state_decref(struct search_state* const state)
         struct search_domain* next, *dom;
         for (dom = state->head; dom; dom = next) {
             next = dom->next;
-            free(dom);
+            mm_free(dom);
         }
-        free(state);
+        mm_free(state);
     }
 }
 
 static struct search_state*
 search_state_new(void)
 {
-    struct search_state* state = (struct search_state*) malloc(sizeof(struct search_state));
+    struct search_state* state = (struct search_state*) mm_malloc(sizeof(struct search_state));
     if (!state) return NULL;
     memset(state, 0, sizeof(struct search_state));
     state->refcount = 1;
@@ -2510,7 +2515,7 @@ search_postfix_add(const char* domain)
     if (!global_search_state) return;
     global_search_state->num_domains++;
 
-    sdomain = (struct search_domain*) malloc(sizeof(struct search_domain) + domain_len/* 尾巴存储domail */);
+    sdomain = (struct search_domain*) mm_malloc(sizeof(struct search_domain) + domain_len/* 尾巴存储domail */);
     if (!sdomain) return;
     // 拷贝domain到尾巴
     memcpy( ((u8*) sdomain) + sizeof(struct search_domain), domain, domain_len);
@@ -2580,7 +2585,7 @@ search_make_new(const struct search_state* const state, int n, const char* const
             /* the actual postfix string is kept at the end of the structure */
             const u8* const postfix = ((u8*) dom) + sizeof(struct search_domain);
             const int postfix_len = dom->len;
-            char* const newname = (char*) malloc(base_len + need_to_append_dot + postfix_len + 1);
+            char* const newname = (char*) mm_malloc(base_len + need_to_append_dot + postfix_len + 1);
             if (!newname) return NULL;
             memcpy(newname, base_name, base_len);
             if (need_to_append_dot) newname[base_len] = '.';
@@ -2612,11 +2617,11 @@ search_request_new(int type, const char* const name, int flags, evdns_callback_t
             char* const new_name = search_make_new(global_search_state, 0, name);
             if (!new_name) return 1;
             req = request_new(type, new_name, flags, user_callback, user_arg);
-            free(new_name);
+            mm_free(new_name);
             if (!req) return 1;
             req->search_index = 0;
         }
-        req->search_origname = strdup(name);
+        req->search_origname = mm_strdup(name);
         req->search_state = global_search_state;
         req->search_flags = flags;
         global_search_state->refcount++;
@@ -2662,7 +2667,7 @@ search_try_next(struct request* const req)
         if (!new_name) return 1;
         log(EVDNS_LOG_DEBUG, "Search: now trying %s (%d)", new_name, req->search_index);
         newreq = request_new(req->request_type, new_name, req->search_flags, req->user_callback, req->user_pointer);
-        free(new_name);
+        mm_free(new_name);
         if (!newreq) return 1;
         newreq->search_origname = req->search_origname;
         req->search_origname = NULL;
@@ -2684,7 +2689,7 @@ search_request_finished(struct request* const req)
         req->search_state = NULL;
     }
     if (req->search_origname) {
-        free(req->search_origname);
+        mm_free(req->search_origname);
         req->search_origname = NULL;
     }
 }
@@ -2861,7 +2866,7 @@ evdns_resolv_conf_parse(int flags, const char* const filename)
         goto out1;
     }
 
-    resolv = (u8*) malloc((size_t)st.st_size + 1);
+    resolv = (u8*) mm_malloc((size_t)st.st_size + 1);
     if (!resolv) {
         err = 4;
         goto out1;
@@ -2904,7 +2909,7 @@ evdns_resolv_conf_parse(int flags, const char* const filename)
     }
 
 out2:
-    free(resolv);
+    mm_free(resolv);
 out1:
     close(fd);
     return err;
@@ -2924,12 +2929,12 @@ evdns_nameserver_ip_add_line(const char* ips)
         addr = ips;
         while (ISDIGIT(*ips) || *ips == '.' || *ips == ':')
             ++ips;
-        buf = malloc(ips - addr + 1);
+        buf = mm_malloc(ips - addr + 1);
         if (!buf) return 4;
         memcpy(buf, addr, ips - addr);
         buf[ips - addr] = '\0';
         r = evdns_nameserver_ip_add(buf);
-        free(buf);
+        mm_free(buf);
         if (r) return r;
     }
     return 0;
@@ -2963,7 +2968,7 @@ load_nameservers_with_getnetworkparams(void)
         goto done;
     }
 
-    buf = malloc(size);
+    buf = mm_malloc(size);
     if (!buf) {
         status = 4;
         goto done;
@@ -2975,8 +2980,8 @@ load_nameservers_with_getnetworkparams(void)
         goto done;
     }
     if (r != ERROR_SUCCESS) {
-        free(buf);
-        buf = malloc(size);
+        mm_free(buf);
+        buf = mm_malloc(size);
         if (!buf) {
             status = 4;
             goto done;
@@ -3015,7 +3020,7 @@ load_nameservers_with_getnetworkparams(void)
 
 done:
     if (buf)
-        free(buf);
+        mm_free(buf);
     if (handle)
         FreeLibrary(handle);
     return status;
@@ -3031,7 +3036,7 @@ config_nameserver_from_reg_key(HKEY key, const char* subkey)
     if (RegQueryValueExA(key, subkey, 0, &type, NULL, &bufsz)
         != ERROR_MORE_DATA)
         return -1;
-    if (!(buf = malloc(bufsz)))
+    if (!(buf = mm_malloc(bufsz)))
         return -1;
 
     if (RegQueryValueExA(key, subkey, 0, &type, (LPBYTE)buf, &bufsz)
@@ -3039,7 +3044,7 @@ config_nameserver_from_reg_key(HKEY key, const char* subkey)
         status = evdns_nameserver_ip_add_line(buf);
     }
 
-    free(buf);
+    mm_free(buf);
     return status;
 }
 
@@ -3179,7 +3184,7 @@ evdns_shutdown(int fail_requests)
         (void) event_del(&server->event);
         if (server->state == 0)
             (void) event_del(&server->timeout_event);
-        free(server);
+        mm_free(server);
         if (server_next == server_head)
             break;
     }
@@ -3189,9 +3194,9 @@ evdns_shutdown(int fail_requests)
     if (global_search_state) {
         for (dom = global_search_state->head; dom; dom = dom_next) {
             dom_next = dom->next;
-            free(dom);
+            mm_free(dom);
         }
-        free(global_search_state);
+        mm_free(global_search_state);
         global_search_state = NULL;
     }
     evdns_log_fn = NULL;
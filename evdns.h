@@ -217,6 +217,10 @@ typedef void (*evdns_callback_type) (int result, char type, int count, int ttl,
   calling evdns_resolv_conf_parse() on UNIX and
   evdns_config_windows_nameservers() on Windows.
 
+  The resolver state is per thread and uses the calling thread's
+  event_init() base, so each thread that resolves names must call
+  evdns_init() itself.
+
   @return 0 if successful, or -1 if an error occurred
   @see evdns_shutdown()
  */
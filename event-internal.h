@@ -46,6 +46,57 @@ struct eventop {
     int need_reinit;
 };
 
+/*
+ * Buffer storage shared by the connections of one event_base, cached
+ * in power-of-two size classes from EVBUFFER_POOL_MINSIZE up.  Reads
+ * into an empty evbuffer borrow a chunk from here and keep it only if
+ * data actually arrived, so idle connections do not pin any memory.
+ */
+#define EVBUFFER_POOL_MINSIZE   256
+#define EVBUFFER_POOL_CLASSES   9       /* 256 bytes to 64 KB */
+#define EVBUFFER_POOL_CHUNK     4096
+#define EVBUFFER_POOL_MAX       16      /* blocks cached per class */
+
+/*
+ * Connection buffers holding more storage than this when they run
+ * empty give it back; see evbuffer_set_shrink().
+ */
+#define EVBUFFER_SHRINK_THRESHOLD (64 * 1024)
+
+struct evbuffer_pool_class {
+    u_char* chunks[EVBUFFER_POOL_MAX];
+    int nchunks;
+    size_t inuse;           /* bytes handed out and not returned */
+};
+
+struct evbuffer_pool {
+    struct evbuffer_pool_class classes[EVBUFFER_POOL_CLASSES];
+};
+
+/* see evbuffer_set_spill() */
+struct evbuffer_spill {
+    size_t threshold;
+    int fd;                 /* the temporary file, or -1 */
+    int mapped;             /* set if the storage is a mapping of fd */
+};
+
+/*
+ * A callback that runs at the end of the current loop iteration.
+ * Scheduling it again before then has no effect, so any number of
+ * changes result in a single call.
+ */
+struct deferred_cb {
+    TAILQ_ENTRY(deferred_cb) next;
+    void (*cb)(struct deferred_cb*, void*);
+    void* arg;
+    struct event_base* base;    /* the base it is queued on, if any */
+};
+
+TAILQ_HEAD(deferred_cb_list, deferred_cb);
+
+/* lets other threads run calls on a base; defined in evthread.c */
+struct event_notify;
+
 struct event_base {
     // 与操作系统相关的io多路复用模型（比如epoll）, 每种I/O demultiplex机制的实现都必须提供这五个函数接口，来完成自身的初始化、销毁释放；对事件的注册、注销和分发。
     const struct eventop* evsel;
@@ -81,8 +132,44 @@ struct event_base {
     struct min_heap timeheap; //管理定时事件的小根堆, 最小二叉堆用于处理计时器
 
     struct timeval tv_cache;
+
+    struct evbuffer_pool rpool;
+
+    // 本轮循环结束时统一执行的回调
+    struct deferred_cb_list deferred_queue;
+
+    // 其他线程通过event_base_post()投递的回调
+    struct event_notify* notify;
+
+    // EVLOOP_BUSY_POLL时阻塞前的自旋时长
+    struct timeval busy_poll;
+    // 新socket的SO_BUSY_POLL微秒数，0表示不设置
+    int busy_poll_usec;
 };
 
+/*
+ * State that each thread has a copy of, such as current_base.  Without
+ * it a loop thread's current_base would replace the caller's, so a build
+ * with threads has to have it.
+ */
+#if defined(HAVE___THREAD) || defined(__GNUC__)
+#define EVENT_THREAD_LOCAL __thread
+#define EVENT_HAVE_THREAD_LOCAL 1
+#elif defined(_MSC_VER)
+#define EVENT_THREAD_LOCAL __declspec(thread)
+#define EVENT_HAVE_THREAD_LOCAL 1
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define EVENT_THREAD_LOCAL _Thread_local
+#define EVENT_HAVE_THREAD_LOCAL 1
+#elif defined(HAVE_PTHREAD)
+#error "threads need thread-local storage for current_base"
+#else
+#define EVENT_THREAD_LOCAL
+#endif
+
+/* the base of the calling thread's event_init(), see event_set() */
+extern EVENT_THREAD_LOCAL struct event_base* current_base;
+
 /* Internal use only: Functions that might be missing from <sys/queue.h> */
 #ifndef HAVE_TAILQFOREACH
 #define TAILQ_FIRST(head)       ((head)->tqh_first)
@@ -104,6 +191,26 @@ int _evsignal_set_handler(struct event_base* base, int evsignal,
                           void (*fn)(int));
 int _evsignal_restore_handler(struct event_base* base, int evsignal);
 
+void event_deferred_cb_init(struct deferred_cb* dcb,
+                            void (*cb)(struct deferred_cb*, void*), void* arg);
+void event_deferred_cb_schedule(struct event_base* base,
+                                struct deferred_cb* dcb);
+void event_deferred_cb_cancel(struct deferred_cb* dcb);
+void event_base_busy_poll_socket(struct event_base* base, int fd);
+
+/* defined in buffer.c */
+int evbuffer_read_pooled(struct evbuffer* buf, struct event_base* base,
+                         int fd, int howmuch);
+void evbuffer_release_pooled(struct evbuffer* buf);
+void evbuffer_pool_clear(struct evbuffer_pool* pool);
+void evbuffer_set_pool(struct evbuffer* buf, struct event_base* base);
+int evbuffer_write_atmost(struct evbuffer* buf, int fd, int howmuch);
+
+/* defined in evthread.c */
+int event_base_notify_init(struct event_base* base, int keepalive);
+void event_base_notify_free(struct event_base* base);
+int event_base_notify_waiting(struct event_base* base);
+
 /* defined in evutil.c */
 const char* evutil_getenv(const char* varname);
 
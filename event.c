@@ -55,6 +55,7 @@
 #include "event-internal.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 #ifdef HAVE_EVENT_PORTS
 extern const struct eventop evportops;
@@ -65,6 +66,9 @@ extern const struct eventop selectops;
 #ifdef HAVE_POLL
 extern const struct eventop pollops;
 #endif
+#ifdef HAVE_IO_URING
+extern const struct eventop uringops;
+#endif
 #ifdef HAVE_EPOLL
 extern const struct eventop epollops;
 // epoll epollops 对应是下面的数据结构
@@ -96,6 +100,9 @@ static const struct eventop* eventops[] = {
 #ifdef HAVE_WORKING_KQUEUE
     & kqops,
 #endif
+#ifdef HAVE_IO_URING
+    & uringops,
+#endif
 #ifdef HAVE_EPOLL
     & epollops,
 #endif
@@ -115,7 +122,7 @@ static const struct eventop* eventops[] = {
 };
 
 /* Global state */
-struct event_base* current_base = NULL;
+EVENT_THREAD_LOCAL struct event_base* current_base = NULL;
 extern struct event_base* evsignal_base;
 static int use_monotonic;
 
@@ -123,6 +130,32 @@ static int use_monotonic;
 int (*event_sigcb)(void);       /* Signal callback when gotsig is set */
 volatile sig_atomic_t event_gotsig; /* Set in signal handler */
 
+/*
+ * A signal may interrupt any thread, so event_gotsig stays process-wide.
+ * Only the loop of the first base from event_init() acts on it; the
+ * loops of other threads keep running.  event_init() may run on several
+ * threads at once, so the base is claimed and given back atomically;
+ * compilers without the builtins need the first event_init() to happen
+ * before other threads start.
+ */
+static struct event_base* volatile event_sigcb_base = NULL;
+#define EVENT_GOTSIG(base) \
+    (event_gotsig && (event_sigcb_base == NULL || event_sigcb_base == (base)))
+
+/* sets event_sigcb_base to new if it still is old */
+static int
+event_sigcb_swap(struct event_base* old, struct event_base* new)
+{
+#if defined(__GNUC__)
+    return (__sync_bool_compare_and_swap(&event_sigcb_base, old, new));
+#else
+    if (event_sigcb_base != old)
+        return (0);
+    event_sigcb_base = new;
+    return (1);
+#endif
+}
+
 /* Prototypes */
 static void event_queue_insert(struct event_base*, struct event*, int);
 static void event_queue_remove(struct event_base*, struct event*, int);
@@ -181,6 +214,11 @@ event_init(void)
     if (base != NULL)
         current_base = base;
 
+    if (base != NULL && event_sigcb_swap(NULL, base)) {
+        event_sigcb = NULL;
+        event_gotsig = 0;
+    }
+
     return (base);
 }
 
@@ -191,12 +229,9 @@ event_base_new(void)
     struct event_base* base;
 
     // 为event_base实例申请空间
-    if ((base = calloc(1, sizeof(struct event_base))) == NULL)
+    if ((base = mm_calloc(1, sizeof(struct event_base))) == NULL)
         event_err(1, "%s: calloc", __func__);
 
-    event_sigcb = NULL;
-    event_gotsig = 0;
-
     detect_monotonic();
     gettime(base, &base->event_tv);
 
@@ -204,6 +239,7 @@ event_base_new(void)
     min_heap_ctor(&base->timeheap);
 
     TAILQ_INIT(&base->eventqueue);
+    TAILQ_INIT(&base->deferred_queue);
     base->sig.ev_signal_pair[0] = -1;
     base->sig.ev_signal_pair[1] = -1;
 
@@ -238,9 +274,11 @@ event_base_free(struct event_base* base)
         base = current_base;
     if (base == current_base)
         current_base = NULL;
+    event_sigcb_swap(base, NULL);
 
     /* XXX(niels) - check for internal events first */
     assert(base);
+    event_base_notify_free(base);
     /* Delete all non-internal events. */
     for (ev = TAILQ_FIRST(&base->eventqueue); ev; ) {
         struct event* next = TAILQ_NEXT(ev, ev_next);
@@ -280,12 +318,18 @@ event_base_free(struct event_base* base)
     min_heap_dtor(&base->timeheap);
 
     for (i = 0; i < base->nactivequeues; ++i)
-        free(base->activequeues[i]);
-    free(base->activequeues);
+        mm_free(base->activequeues[i]);
+    mm_free(base->activequeues);
 
     assert(TAILQ_EMPTY(&base->eventqueue));
 
-    free(base);
+    evbuffer_pool_clear(&base->rpool);
+
+    /* their owners may still cancel them */
+    while (!TAILQ_EMPTY(&base->deferred_queue))
+        event_deferred_cb_cancel(TAILQ_FIRST(&base->deferred_queue));
+
+    mm_free(base);
 }
 
 /* reinitialized the event base after a fork */
@@ -354,22 +398,22 @@ event_base_priority_init(struct event_base* base, int npriorities)
     // 释放所有优先级队列
     if (base->nactivequeues) {
         for (i = 0; i < base->nactivequeues; ++i) {
-            free(base->activequeues[i]); // 单个队列
+            mm_free(base->activequeues[i]); // 单个队列
         }
         // 队列数组
-        free(base->activequeues);
+        mm_free(base->activequeues);
     }
 
     /* Allocate our priority queues */
     base->nactivequeues = npriorities;
     // 分配链表数组
     base->activequeues = (struct event_list**)
-                         calloc(base->nactivequeues, sizeof(struct event_list*));
+                         mm_calloc(base->nactivequeues, sizeof(struct event_list*));
     if (base->activequeues == NULL)
         event_err(1, "%s: calloc", __func__);
 
     for (i = 0; i < base->nactivequeues; ++i) {
-        base->activequeues[i] = malloc(sizeof(struct event_list));// 分配一个链表头
+        base->activequeues[i] = mm_malloc(sizeof(struct event_list));// 分配一个链表头
         if (base->activequeues[i] == NULL)
             event_err(1, "%s: malloc", __func__);
         TAILQ_INIT(base->activequeues[i]);
@@ -381,7 +425,9 @@ event_base_priority_init(struct event_base* base, int npriorities)
 int
 event_haveevents(struct event_base* base)
 {
-    return (base->event_count > 0);
+    /* work handed to other threads comes back through notify */
+    return (base->event_count > 0 ||
+            (base->notify != NULL && event_base_notify_waiting(base)));
 }
 
 /*
@@ -429,7 +475,7 @@ event_process_active(struct event_base* base)
             ev->ev_ncalls = ncalls;
             (*ev->ev_callback)((int)ev->ev_fd, ev->ev_res, ev->ev_arg);
             // 收到中断事件或者退出
-            if (event_gotsig || base->event_break) {
+            if (EVENT_GOTSIG(base) || base->event_break) {
                 ev->ev_pncalls = NULL;
                 return;
             }
@@ -438,6 +484,66 @@ event_process_active(struct event_base* base)
     }
 }
 
+void
+event_deferred_cb_init(struct deferred_cb* dcb,
+                       void (*cb)(struct deferred_cb*, void*), void* arg)
+{
+    memset(dcb, 0, sizeof(*dcb));
+    dcb->cb = cb;
+    dcb->arg = arg;
+}
+
+void
+event_deferred_cb_schedule(struct event_base* base, struct deferred_cb* dcb)
+{
+    if (dcb->base != NULL)
+        return;
+
+    dcb->base = base;
+    TAILQ_INSERT_TAIL(&base->deferred_queue, dcb, next);
+}
+
+void
+event_deferred_cb_cancel(struct deferred_cb* dcb)
+{
+    if (dcb->base == NULL)
+        return;
+
+    TAILQ_REMOVE(&dcb->base->deferred_queue, dcb, next);
+    dcb->base = NULL;
+}
+
+/*
+ * Runs the callbacks deferred during this iteration.  Callbacks that
+ * are scheduled while we are at it wait for the next iteration.
+ */
+static void
+event_process_deferred(struct event_base* base)
+{
+    struct deferred_cb_list queue;
+    struct deferred_cb* dcb;
+
+    TAILQ_INIT(&queue);
+    while ((dcb = TAILQ_FIRST(&base->deferred_queue)) != NULL) {
+        TAILQ_REMOVE(&base->deferred_queue, dcb, next);
+        TAILQ_INSERT_TAIL(&queue, dcb, next);
+    }
+
+    while ((dcb = TAILQ_FIRST(&queue)) != NULL) {
+        TAILQ_REMOVE(&queue, dcb, next);
+        dcb->base = NULL;
+        (*dcb->cb)(dcb, dcb->arg);
+        if (EVENT_GOTSIG(base) || base->event_break)
+            break;
+    }
+
+    /* whatever is left runs next time */
+    while ((dcb = TAILQ_LAST(&queue, deferred_cb_list)) != NULL) {
+        TAILQ_REMOVE(&queue, dcb, next);
+        TAILQ_INSERT_HEAD(&base->deferred_queue, dcb, next);
+    }
+}
+
 /*
  * Wait continously for events.  We exit only if no events are left.
  */
@@ -503,6 +609,35 @@ event_base_loopbreak(struct event_base* event_base)
 
 
 
+int
+event_base_set_busy_poll(struct event_base* base,
+                         const struct timeval* spin, int sock_usec)
+{
+    if (sock_usec < 0)
+        return (-1);
+    if (spin != NULL && (spin->tv_sec < 0 || spin->tv_usec < 0 ||
+                         spin->tv_usec >= 1000000))
+        return (-1);
+
+    if (spin != NULL)
+        base->busy_poll = *spin;
+    else
+        evutil_timerclear(&base->busy_poll);
+    base->busy_poll_usec = sock_usec;
+
+    return (0);
+}
+
+/* apply the base's SO_BUSY_POLL to a socket that is about to be used on it */
+void
+event_base_busy_poll_socket(struct event_base* base, int fd)
+{
+    if (base == NULL)
+        base = current_base;
+    if (base != NULL && base->busy_poll_usec > 0 && fd != -1)
+        evutil_make_socket_busy_poll(fd, base->busy_poll_usec);
+}
+
 /* not thread safe */
 
 int
@@ -518,7 +653,8 @@ event_base_loop(struct event_base* base, int flags)
     void* evbase = base->evbase;
     struct timeval tv;
     struct timeval* tv_p;
-    int res, done;
+    struct timeval spin_end;
+    int res, done, busy;
 
     /* clear time cache */
     base->tv_cache.tv_sec = 0;
@@ -527,6 +663,9 @@ event_base_loop(struct event_base* base, int flags)
         evsignal_base = base;
     done = 0;
 
+    busy = (flags & EVLOOP_BUSY_POLL) && evutil_timerisset(&base->busy_poll);
+    evutil_timerclear(&spin_end);
+
     while (!done) { // 事件主循环
         /* Terminate the loop if we have been asked to */
         // 查看是否需要跳出循环，程序可以调用event_loopexit_cb()设置event_gotterm标记
@@ -541,8 +680,8 @@ event_base_loop(struct event_base* base, int flags)
             break;
         }
 
-        /* You cannot use this interface for multi-threaded apps */
-        while (event_gotsig) {
+        /* With several threads, only the first event_init() base */
+        while (EVENT_GOTSIG(base)) {
             event_gotsig = 0;
             if (event_sigcb) {
                 res = (*event_sigcb)();
@@ -563,10 +702,28 @@ event_base_loop(struct event_base* base, int flags)
         // 阻塞调用evsel->dispatch，如果并发量比较大或者事件较多的情况下可以设置为非阻塞模式，
         // 否则可能会浪费cpu使用率
         //根据timer heap中事件的最小超时时间，计算系统I/O demultiplexer的最大等待时间
-        if (!base->event_count_active && !(flags & EVLOOP_NONBLOCK)) {
+        if (!base->event_count_active &&
+            TAILQ_EMPTY(&base->deferred_queue) &&
+            !(flags & EVLOOP_NONBLOCK)) {
             //获取到base->timeheap最小堆中最先超时的计时器
             //如果没有计时器tv_p被赋值NULL，注意参数是timeval**
             timeout_next(base, &tv_p);
+
+            /*
+             * in busy poll mode, keep polling without a timeout until
+             * the loop has been idle for base->busy_poll
+             */
+            if (busy && (tv_p == NULL || evutil_timerisset(tv_p))) {
+                struct timeval now;
+                gettime(base, &now);
+                if (!evutil_timerisset(&spin_end))
+                    evutil_timeradd(&now, &base->busy_poll, &spin_end);
+                if (evutil_timercmp(&now, &spin_end, <)) {
+                    evutil_timerclear(&tv);
+                    tv_p = &tv;
+                } else
+                    evutil_timerclear(&spin_end);
+            }
         } else {
             /*
              * if we have active events, we just poll new events
@@ -578,7 +735,8 @@ event_base_loop(struct event_base* base, int flags)
         }
 
         /* If we have no events, we just exit */
-        if (!event_haveevents(base)) {//事件循环中没有要监听的事件退出
+        if (!event_haveevents(base) &&
+            TAILQ_EMPTY(&base->deferred_queue)) {//事件循环中没有要监听的事件退出
             event_debug(("%s: no events registered.", __func__));
             return (1);
         }
@@ -606,6 +764,8 @@ event_base_loop(struct event_base* base, int flags)
 
         // 处理active队列中就绪的事件，进行回调
         if (base->event_count_active) {
+            /* something happened: spin for a full period again */
+            evutil_timerclear(&spin_end);
             // 调用event_process_active()处理激活链表中的就绪event，调用其回调函数执行事件处理
            // 该函数会寻找最高优先级（priority值越小优先级越高）的激活事件链表，
            // 然后处理链表中的所有就绪事件；
@@ -616,6 +776,10 @@ event_base_loop(struct event_base* base, int flags)
                 done = 1;
         } else if (flags & EVLOOP_NONBLOCK)
             done = 1;
+
+        /* callbacks deferred by the events we just processed */
+        if (!TAILQ_EMPTY(&base->deferred_queue))
+            event_process_deferred(base);
     } //end while
 
     /* clear time cache */
@@ -642,7 +806,7 @@ event_once_cb(int fd, short events, void* arg)
     struct event_once* eonce = arg;
 
     (*eonce->cb)(fd, events, eonce->arg);
-    free(eonce);
+    mm_free(eonce);
 }
 
 /* not threadsafe, event scheduled once. */
@@ -666,7 +830,7 @@ event_base_once(struct event_base* base, int fd, short events,
     if (events & EV_SIGNAL)
         return (-1);
 
-    if ((eonce = calloc(1, sizeof(struct event_once))) == NULL)
+    if ((eonce = mm_calloc(1, sizeof(struct event_once))) == NULL)
         return (-1);
 
     eonce->cb = callback;
@@ -685,7 +849,7 @@ event_base_once(struct event_base* base, int fd, short events,
         event_set(&eonce->ev, fd, events, event_once_cb, eonce);
     } else {
         /* Bad event combination */
-        free(eonce);
+        mm_free(eonce);
         return (-1);
     }
 
@@ -693,7 +857,7 @@ event_base_once(struct event_base* base, int fd, short events,
     if (res == 0)
         res = event_add(&eonce->ev, tv);
     if (res != 0) {
-        free(eonce);
+        mm_free(eonce);
         return (res);
     }
 
@@ -1135,6 +1299,83 @@ event_queue_insert(struct event_base* base, struct event* ev, int queue)
     }
 }
 
+static void* (*_mm_malloc_fn)(size_t sz) = NULL;
+static void* (*_mm_realloc_fn)(void* p, size_t sz) = NULL;
+static void (*_mm_free_fn)(void* p) = NULL;
+
+void
+event_set_mem_functions(void* (*malloc_fn)(size_t sz),
+                        void* (*realloc_fn)(void* ptr, size_t sz),
+                        void (*free_fn)(void* ptr))
+{
+    if (malloc_fn == NULL || realloc_fn == NULL || free_fn == NULL) {
+        malloc_fn = NULL;
+        realloc_fn = NULL;
+        free_fn = NULL;
+    }
+
+    _mm_malloc_fn = malloc_fn;
+    _mm_realloc_fn = realloc_fn;
+    _mm_free_fn = free_fn;
+}
+
+void*
+event_mm_malloc(size_t sz)
+{
+    if (_mm_malloc_fn)
+        return (_mm_malloc_fn(sz));
+    return (malloc(sz));
+}
+
+void*
+event_mm_calloc(size_t count, size_t size)
+{
+    void* p;
+
+    if (_mm_malloc_fn == NULL)
+        return (calloc(count, size));
+
+    if (size && count > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return (NULL);
+    }
+    if ((p = _mm_malloc_fn(count * size)) != NULL)
+        memset(p, 0, count * size);
+    return (p);
+}
+
+char*
+event_mm_strdup(const char* str)
+{
+    size_t len;
+    char* p;
+
+    if (_mm_malloc_fn == NULL)
+        return (strdup(str));
+
+    len = strlen(str) + 1;
+    if ((p = _mm_malloc_fn(len)) != NULL)
+        memcpy(p, str, len);
+    return (p);
+}
+
+void*
+event_mm_realloc(void* ptr, size_t sz)
+{
+    if (_mm_realloc_fn)
+        return (_mm_realloc_fn(ptr, sz));
+    return (realloc(ptr, sz));
+}
+
+void
+event_mm_free(void* ptr)
+{
+    if (_mm_free_fn)
+        _mm_free_fn(ptr);
+    else
+        free(ptr);
+}
+
 /* Functions for debugging */
 
 const char*
@@ -41,8 +41,8 @@
   servers. An application just needs to call event_dispatch() and then add or
   remove events dynamically without having to change the event loop.
 
-  Currently, libevent supports /dev/poll, kqueue(2), select(2), poll(2) and
-  epoll(4). It also has experimental support for real-time signals. The
+  Currently, libevent supports /dev/poll, kqueue(2), select(2), poll(2),
+  epoll(4) and io_uring(7). It also has experimental support for real-time signals. The
   internal event mechanism is completely independent of the exposed event API,
   and a simple update of libevent can provide new functionality without having
   to redesign the applications. As a result, Libevent allows for portable
@@ -312,6 +312,14 @@ struct event_base* event_base_new(void);
   used.  Sets the current_base global representing the default base for
   events that have no base associated with them.
 
+  current_base is kept per thread: a thread that calls event_init() gets
+  a default base of its own, which event_set(), event_once(),
+  evhttp_start() and the evdns resolver of that thread then use.  The
+  loops of an event_loop_group have their own base as current_base.
+  Handlers installed through the deprecated event_sigcb interface run
+  only in the loop of the first base event_init() created, so the thread
+  meant to handle them should call it before other threads start.
+
   @see event_base_set(), event_base_new()
  */
 struct event_base* event_init(void);
@@ -383,6 +391,32 @@ typedef void (*event_log_cb)(int severity, const char* msg);
   */
 void event_set_log_callback(event_log_cb cb);
 
+/**
+  Replace the functions libevent uses to allocate memory.
+
+  Every allocation made by the library, including the code generated by
+  event_rpcgen.py, goes through these functions.  Call this before any
+  other libevent function, since memory allocated with one set of
+  functions cannot be released with another.  Memory that libevent hands
+  to the caller, such as the lines returned by evbuffer_readline(), must
+  then be released with free_fn or event_mm_free().
+
+  @param malloc_fn a replacement for malloc()
+  @param realloc_fn a replacement for realloc()
+  @param free_fn a replacement for free()
+  If any of them is NULL, the C library functions are used again.
+ */
+void event_set_mem_functions(void* (*malloc_fn)(size_t sz),
+                             void* (*realloc_fn)(void* ptr, size_t sz),
+                             void (*free_fn)(void* ptr));
+
+/** Allocate memory the way libevent does; see event_set_mem_functions() */
+void* event_mm_malloc(size_t sz);
+void* event_mm_calloc(size_t count, size_t size);
+char* event_mm_strdup(const char* str);
+void* event_mm_realloc(void* ptr, size_t sz);
+void event_mm_free(void* ptr);
+
 /**
   Associate a different event base with an event.
 
@@ -399,6 +433,8 @@ int event_base_set(struct event_base*, struct event*);
 #define EVLOOP_ONCE 0x01    /**< Block at most once. */
 // 不阻塞，也就是不会计算距离计时器最小触发时间进行睡眠
 #define EVLOOP_NONBLOCK 0x02    /**< Do not block. */
+/** Spin before blocking, see event_base_set_busy_poll(). */
+#define EVLOOP_BUSY_POLL 0x04
 /*@}*/
 
 /**
@@ -406,7 +442,8 @@ int event_base_set(struct event_base*, struct event*);
 
   This is a more flexible version of event_dispatch().
 
-  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK
+  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK |
+    EVLOOP_BUSY_POLL
   @return 0 if successful, -1 if an error occurred, or 1 if no events were
     registered.
   @see event_loopexit(), event_base_loop()
@@ -419,13 +456,38 @@ int event_loop(int);
   This is a more flexible version of event_base_dispatch().
 
   @param eb the event_base structure returned by event_init()
-  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK
+  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK |
+    EVLOOP_BUSY_POLL
   @return 0 if successful, -1 if an error occurred, or 1 if no events were
     registered.
   @see event_loopexit(), event_base_loop()
   */
 int event_base_loop(struct event_base*, int);
 
+/**
+  Trade CPU time for wake-up latency on an event_base.
+
+  When the loop runs with EVLOOP_BUSY_POLL and has nothing to do, it
+  keeps polling with a zero timeout for up to spin before it blocks
+  in the kernel until the next event or timer.  Every event that fires
+  starts the spin over, so a busy loop never sleeps.
+
+  If sock_usec is positive, the sockets that evhttp creates or accepts
+  on this base and the sockets of bufferevents on it get SO_BUSY_POLL
+  set to sock_usec microseconds where the system supports it; this
+  makes the kernel poll the device queue instead of waiting for an
+  interrupt.  Raising it above net.core.busy_read may need privileges;
+  failures are ignored.
+
+  @param base the event_base to configure
+  @param spin how long to spin, or NULL to block right away
+  @param sock_usec SO_BUSY_POLL for new sockets, or 0 to leave them alone
+  @return 0 if successful, or -1 if an argument was invalid
+  @see event_base_loop(), evutil_make_socket_busy_poll()
+ */
+int event_base_set_busy_poll(struct event_base* base,
+                             const struct timeval* spin, int sock_usec);
+
 /**
   Exit the event loop after the specified time.
 
@@ -756,6 +818,219 @@ int event_base_priority_init(struct event_base*, int);
 int event_priority_set(struct event*, int);
 
 
+/**
+  Allow other threads to run calls on an event_base.
+
+  An event_base is not thread-safe; the only thing another thread may do
+  with it is hand it a call with event_base_post().  This sets up the
+  socket pair that wakes the base up for that.  It does not count as a
+  registered event, so event_base_dispatch() still returns when nothing
+  else is left.  The bases of an event_loop_group are always notifiable.
+
+  @param base the event_base to set up
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_post()
+ */
+int event_base_make_notifiable(struct event_base* base);
+
+/**
+  Run a function on the thread of an event_base.
+
+  This may be called from any thread.  The function runs from within the
+  loop of base, in the order the calls were posted.  Calls still pending
+  when the base is freed are dropped.
+
+  @param base a base made notifiable with event_base_make_notifiable()
+  @param cb the function to run
+  @param arg the argument passed to cb
+  @return 0 if successful, or -1 if base is not notifiable or an error
+    occurred
+ */
+int event_base_post(struct event_base* base, void (*cb)(void*), void* arg);
+
+struct event_loop_group;
+
+/** Pin every loop of an event_loop_group to its own CPU. */
+#define EVENT_LOOP_GROUP_PIN    0x01
+
+/** How event_loop_group_pick() chooses a loop */
+enum event_loop_policy {
+    /** Each loop in turn. */
+    EVENT_LOOP_ROUND_ROBIN,
+    /** The loop with the fewest connections that are not yet released. */
+    EVENT_LOOP_LEAST_CONNECTIONS
+};
+
+/**
+  Start a group of event loops, each running on a thread of its own.
+
+  Every loop gets its own event_base, created on its thread and kept
+  running until the group is stopped, even while it has no events.
+  With EVENT_LOOP_GROUP_PIN, where the system supports it, each thread
+  is pinned to one of the CPUs the process may use, spreading the loops
+  over the NUMA nodes first; the event_base is created after pinning, so
+  that its memory is local to the node.
+
+  Since the bases run on other threads, set them up with
+  event_loop_group_run_on_each() or event_base_post().  For example, a
+  server accepts on one socket in every loop by calling
+  evhttp_accept_socket() on it for each base.
+
+  @param nloops the number of loops, or 0 for one per available CPU
+  @param flags 0 or EVENT_LOOP_GROUP_PIN
+  @return the new group, or NULL if an error occurred
+  @see event_loop_group_free()
+ */
+struct event_loop_group* event_loop_group_new(int nloops, int flags);
+
+/** Return the number of loops in an event_loop_group. */
+int event_loop_group_size(struct event_loop_group* group);
+
+/**
+  Return the event_base of a loop in an event_loop_group.
+
+  @param group the event_loop_group
+  @param i the index of the loop, from 0 to event_loop_group_size() - 1
+  @return the event_base, or NULL if there is no such loop
+ */
+struct event_base* event_loop_group_get_base(struct event_loop_group* group,
+                                             int i);
+
+/**
+  Choose the loop a new connection should go to.
+
+  The loop's connection count goes up by one until the connection is
+  given back with event_loop_group_release().  This may be called from
+  any thread.
+
+  @param group the event_loop_group
+  @param policy EVENT_LOOP_ROUND_ROBIN or EVENT_LOOP_LEAST_CONNECTIONS
+  @return the event_base of the chosen loop
+ */
+struct event_base* event_loop_group_pick(struct event_loop_group* group,
+                                         enum event_loop_policy policy);
+
+/**
+  Tell an event_loop_group that a connection of one of its loops is gone.
+
+  @param group the event_loop_group
+  @param base the event_base returned for the connection by
+    event_loop_group_pick() or event_loop_group_assign()
+ */
+void event_loop_group_release(struct event_loop_group* group,
+                              struct event_base* base);
+
+/**
+  Return the number of connections a loop has not released yet.
+
+  @param group the event_loop_group
+  @param i the index of the loop
+  @return the count, or -1 if there is no such loop
+ */
+int event_loop_group_get_load(struct event_loop_group* group, int i);
+
+/**
+  Hand a new socket to a loop of an event_loop_group.
+
+  Chooses a loop as event_loop_group_pick() does and calls cb with its
+  event_base and fd on that loop's thread, where it can create the
+  bufferevent or evhttp connection for the socket.
+
+  @param group the event_loop_group
+  @param policy EVENT_LOOP_ROUND_ROBIN or EVENT_LOOP_LEAST_CONNECTIONS
+  @param fd the socket
+  @param cb the function that takes the socket over
+  @param arg the argument passed to cb
+  @return the event_base chosen, or NULL if an error occurred
+ */
+struct event_base* event_loop_group_assign(struct event_loop_group* group,
+    enum event_loop_policy policy, int fd,
+    void (*cb)(struct event_base*, int, void*), void* arg);
+
+/**
+  Run a function on every loop of an event_loop_group and wait for it.
+
+  Must not be called from one of the group's own loops.
+
+  @param group the event_loop_group
+  @param cb the function, called with the event_base of each loop
+  @param arg the argument passed to cb
+  @return 0 if successful, or -1 if it could not run on every loop
+ */
+int event_loop_group_run_on_each(struct event_loop_group* group,
+                                 void (*cb)(struct event_base*, void*),
+                                 void* arg);
+
+/**
+  Stop all loops of an event_loop_group and wait for their threads.
+
+  Each loop exits as event_base_loopexit() makes it, so a timeout gives
+  connections time to finish.  The bases stay valid, without running,
+  so that what was set up on them can be freed before
+  event_loop_group_free().
+
+  @param group the event_loop_group
+  @param tv how long the loops may keep running, or NULL to stop them
+    after their current iteration
+  @return 0 if successful, or -1 if an error occurred
+ */
+int event_loop_group_stop(struct event_loop_group* group,
+                          const struct timeval* tv);
+
+/**
+  Stop an event_loop_group if it still runs, and free it and its bases.
+
+  @param group the event_loop_group to be freed
+ */
+void event_loop_group_free(struct event_loop_group* group);
+
+struct event_work_pool;
+
+/**
+  Start a pool of threads for work that would block an event loop.
+
+  Each worker keeps its own queue of jobs.  A worker runs the job it
+  queued last first, and takes the oldest job of another worker when
+  its own queue is empty, so that jobs spread over the pool without a
+  queue everyone contends for.
+
+  @param nworkers the number of threads, or 0 for one per available CPU
+  @return the new pool, or NULL if an error occurred
+  @see event_work_submit(), event_work_pool_free()
+ */
+struct event_work_pool* event_work_pool_new(int nworkers);
+
+/**
+  Run a function on a worker of an event_work_pool.
+
+  work runs on one of the workers; done then runs on the thread of base,
+  from within its loop, where it can for example send the reply of the
+  request the work was done for.  The loop of base keeps running until
+  done has been called.  Called from a worker, the job goes to the queue
+  of that worker.
+
+  @param pool the event_work_pool
+  @param base a notifiable base for done, or NULL if done is NULL
+  @param work the function run on a worker
+  @param done the function run on base once work returned, or NULL
+  @param arg the argument passed to work and done
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_make_notifiable()
+ */
+int event_work_submit(struct event_work_pool* pool, struct event_base* base,
+                      void (*work)(void*), void (*done)(void*), void* arg);
+
+/**
+  Wait for the jobs of an event_work_pool and free it.
+
+  Jobs that are still queued are run first, and their done functions are
+  posted to their bases as usual.
+
+  @param pool the event_work_pool to be freed
+ */
+void event_work_pool_free(struct event_work_pool* pool);
+
+
 /* These functions deal with buffering input and output */
 
 struct evbuffer {
@@ -774,6 +1049,23 @@ struct evbuffer {
     void (*cb)(struct evbuffer*, size_t/*old原来内存大小*/, size_t/*new改变后新的内存大小*/, void*);
     // 给cb的自定义函数
     void* cbarg;
+
+    /* set if cb runs at the end of the loop iteration */
+    struct evbuffer_deferred* deferred;
+
+    // 上次查找行尾失败时已扫描过的字节数，避免重复扫描
+    size_t eol_scanned;     /* bytes known not to hold an end of line */
+    int eol_style;          /* the evbuffer_eol_style they were searched for */
+
+    // 缓冲区清空时若占用内存超过该值则释放，0表示不自动释放
+    size_t shrink_threshold; /* free storage above this when emptied */
+
+    // 新内存从哪个event_base的缓存中分配，以及当前内存来自哪个缓存
+    struct evbuffer_pool* pool;         /* where new storage comes from */
+    struct evbuffer_pool* storage_pool; /* where the storage came from */
+
+    // 超过阈值后数据存放在临时文件中，见evbuffer_set_spill()
+    struct evbuffer_spill* spill;       /* set if it may move to a file */
 };
 
 /* Just for error reporting - use other constants otherwise */
@@ -813,10 +1105,29 @@ struct bufferevent {
     everrorcb errorcb;
     void* cbarg;
 
-    int timeout_read;   /* in seconds */
-    int timeout_write;  /* in seconds */
+    int timeout_read;   /* in seconds, see also tv_read */
+    int timeout_write;  /* in seconds, see also tv_write */
 
     short enabled;  /* events that are currently enabled */
+
+    /* relay partner, see bufferevent_pair_splice() */
+    struct bufferevent* splice_peer;
+    // 从本端读出、尚未写到peer的数据所在的pipe，-1表示用evbuffer拷贝
+    int splice_pipe[2];
+    size_t splice_len;  /* bytes waiting in splice_pipe */
+    size_t splice_pipe_size;  /* what splice_pipe can hold */
+
+    /* token buckets, see bufferevent_set_rate_limit() */
+    struct bufferevent_rate_limit* rate_limit;
+
+    struct timeval tv_read;     /* read timeout, zero for none */
+    struct timeval tv_write;    /* write timeout, zero for none */
+
+    /* see bufferevent_set_deferred_callbacks() */
+    struct bufferevent_deferred* deferred;
+
+    int eager_write;    /* see bufferevent_set_eager_write() */
+    int corked;         /* nesting depth of bufferevent_cork() */
 };
 #endif
 
@@ -868,6 +1179,32 @@ struct bufferevent* bufferevent_new(int fd,
  */
 int bufferevent_base_set(struct event_base* base, struct bufferevent* bufev);
 
+/**
+  Move a bufferevent to another event_base.
+
+  Must be called from the thread of the bufferevent's current base, for
+  example from one of its callbacks.  The bufferevent leaves that base
+  right away, with what is in its input and output buffers; the events
+  that were pending, with what is left of their timeouts, are added
+  again on base.  If base is notifiable, as the bases of an
+  event_loop_group are, that happens on its thread, and cb runs there
+  once the bufferevent is ready to be used; until then the calling
+  thread must not touch it.  Otherwise base has to run on the calling
+  thread and everything happens before bufferevent_migrate() returns.
+
+  A bufferevent that relays with bufferevent_pair_splice() or belongs
+  to a rate limit group cannot be moved.
+
+  @param bufev the bufferevent to be moved
+  @param base the event_base it moves to
+  @param cb the function called on the thread of base, or NULL
+  @param arg the argument passed to cb
+  @return 0 if successful, or -1 if the bufferevent stays where it is
+  @see event_base_make_notifiable()
+ */
+int bufferevent_migrate(struct bufferevent* bufev, struct event_base* base,
+                        void (*cb)(struct bufferevent*, void*), void* arg);
+
 
 /**
   Assign a priority to a bufferevent.
@@ -985,6 +1322,18 @@ int bufferevent_disable(struct bufferevent* bufev, short event);
 void bufferevent_settimeout(struct bufferevent* bufev,
                             int timeout_read, int timeout_write);
 
+/**
+  Set the read and write timeout for a buffered event with sub-second
+  resolution.
+
+  @param bufev the bufferevent to be modified
+  @param tv_read the read timeout, or NULL for none
+  @param tv_write the write timeout, or NULL for none
+  @see bufferevent_settimeout()
+ */
+void bufferevent_set_timeouts(struct bufferevent* bufev,
+                              const struct timeval* tv_read, const struct timeval* tv_write);
+
 
 /**
   Sets the watermarks for read and write events.
@@ -1005,6 +1354,156 @@ void bufferevent_settimeout(struct bufferevent* bufev,
 void bufferevent_setwatermark(struct bufferevent* bufev, short events,
                               size_t lowmark, size_t highmark);
 
+/**
+  Relay data between two bufferevents without looking at it.
+
+  Everything read from the file descriptor of a is written to the file
+  descriptor of b and vice versa.  Where splice(2) is available the data
+  moves through a kernel pipe and never enters user space; otherwise it is
+  copied through the evbuffers.  Data already sitting in the input buffer
+  of either side is forwarded first.
+
+  The read callbacks are not invoked while relaying.  The high read
+  watermark of each side limits how much data read from it may be waiting
+  for the other side (64 KB if unset); reading stops until the other side
+  has written enough of it.  The write callback is invoked as usual once the
+  pending data drops to the low write watermark, and the error callback on
+  EOF, errors and timeouts.
+
+  Relaying ends when either bufferevent is freed or gets a new file
+  descriptor via bufferevent_setfd().
+
+  @param a the first bufferevent
+  @param b the second bufferevent
+  @return 0 if successful, or -1 if an error occurred
+ */
+int bufferevent_pair_splice(struct bufferevent* a, struct bufferevent* b);
+
+/**
+  Write data as soon as it is added to a bufferevent.
+
+  Normally bufferevent_write() only schedules a write for when the file
+  descriptor becomes writable.  In eager mode it writes right away and
+  waits for EV_WRITE only if the socket did not take all of the data,
+  which saves the backend calls and a loop iteration for small messages.
+  The write callback is still invoked from the event loop.
+
+  @param bufev the bufferevent to be modified
+  @param enable 1 to write eagerly, 0 to always wait for EV_WRITE
+ */
+void bufferevent_set_eager_write(struct bufferevent* bufev, int enable);
+
+/**
+  Hold back the writes of a bufferevent.
+
+  Data passed to bufferevent_write() collects in the output buffer until
+  the matching bufferevent_uncork() or the end of the current loop
+  iteration, whichever comes first, and then goes out in as few writes
+  as possible.  Calls may be nested.
+
+  @param bufev the bufferevent to be corked
+  @return 0 if successful, or -1 if an error occurred
+  @see bufferevent_uncork()
+ */
+int bufferevent_cork(struct bufferevent* bufev);
+
+/**
+  Release a bufferevent corked with bufferevent_cork().
+
+  @param bufev the bufferevent to be uncorked
+ */
+void bufferevent_uncork(struct bufferevent* bufev);
+
+/**
+  Defer the callbacks of a bufferevent to the end of the loop iteration.
+
+  The read, write and error callbacks are no longer invoked from within
+  the I/O handling but after all events of the current iteration have
+  been processed, each of them at most once no matter how often it was
+  triggered.  The callbacks of the input and output buffers are deferred
+  as well, see evbuffer_defer_callbacks().  It is safe to free the
+  bufferevent from a deferred callback.
+
+  @param bufev the bufferevent to be modified
+  @param enable 1 to defer the callbacks, 0 to invoke them immediately again
+  @return 0 if successful, or -1 if an error occurred
+ */
+int bufferevent_set_deferred_callbacks(struct bufferevent* bufev, int enable);
+
+/**
+  Limit the bandwidth of a bufferevent.
+
+  At most read_rate bytes are read and at most write_rate bytes are written
+  per tick.  When a bucket runs dry the corresponding event is suspended
+  until the next tick; unused bandwidth does not carry over.  A rate of 0
+  leaves that direction unlimited, and setting both rates to 0 removes the
+  limit.
+
+  @param bufev the bufferevent to be limited
+  @param read_rate the number of bytes that may be read per tick
+  @param write_rate the number of bytes that may be written per tick
+  @param tick the length of a tick; may be NULL if both rates are 0
+  @return 0 if successful, or -1 if an error occurred
+  @see bufferevent_add_to_rate_limit_group()
+ */
+int bufferevent_set_rate_limit(struct bufferevent* bufev,
+                               size_t read_rate, size_t write_rate, const struct timeval* tick);
+
+struct bufferevent_rate_limit_group;
+
+/**
+  Create a bandwidth limit shared by a group of bufferevents.
+
+  The members of the group together read at most read_rate and write at
+  most write_rate bytes per tick, in addition to any limit set on them
+  individually.  Each member gets a fair share of what is left in the
+  bucket.  A single timer on base refills the bucket for the whole group.
+
+  @param base the event_base the refill timer runs on
+  @param read_rate the number of bytes that may be read per tick, 0 for no limit
+  @param write_rate the number of bytes that may be written per tick, 0 for no limit
+  @param tick the length of a tick
+  @return a new group, or NULL if an error occurred
+  @see bufferevent_rate_limit_group_free()
+ */
+struct bufferevent_rate_limit_group* bufferevent_rate_limit_group_new(
+    struct event_base* base,
+    size_t read_rate, size_t write_rate, const struct timeval* tick);
+
+/**
+  Free a rate limit group.
+
+  All members are removed from the group first.  The refill timer keeps
+  the event loop busy, so a group has to be freed before event_dispatch()
+  can run out of events.
+
+  @param group the group to be freed
+ */
+void bufferevent_rate_limit_group_free(struct bufferevent_rate_limit_group* group);
+
+/**
+  Make a bufferevent a member of a rate limit group.
+
+  A bufferevent belongs to at most one group; it leaves its previous group.
+  While it is a member, its own bucket from bufferevent_set_rate_limit()
+  is refilled by the group timer as well, so it is checked at most once
+  per group tick.
+
+  @param bufev the bufferevent to be added
+  @param group the group to join
+  @return 0 if successful, or -1 if an error occurred
+ */
+int bufferevent_add_to_rate_limit_group(struct bufferevent* bufev,
+                                        struct bufferevent_rate_limit_group* group);
+
+/**
+  Remove a bufferevent from its rate limit group.
+
+  @param bufev the bufferevent to be removed
+  @return 0 if successful, or -1 if an error occurred
+ */
+int bufferevent_remove_from_rate_limit_group(struct bufferevent* bufev);
+
 #define EVBUFFER_LENGTH(x)  (x)->off
 #define EVBUFFER_DATA(x)    (x)->buffer
 #define EVBUFFER_INPUT(x)   (x)->input
@@ -1049,6 +1548,139 @@ int evbuffer_expand(struct evbuffer*, size_t);
  */
 int evbuffer_add(struct evbuffer*, const void*, size_t);
 
+/**
+  Describes a region of evbuffer memory, for evbuffer_reserve_space()
+  and evbuffer_peek().  Laid out like struct iovec so it can be handed
+  to readv(2) and friends.
+ */
+struct evbuffer_iovec {
+    void* iov_base;     /* start of the region */
+    size_t iov_len;     /* its length in bytes */
+};
+
+/**
+  Reserve space at the end of an evbuffer so that data can be written
+  into it directly.
+
+  The space is described by vec[0]; it is at least size bytes long and
+  stays valid until the buffer is next modified.  Nothing becomes part
+  of the buffer until evbuffer_commit_space() is called.
+
+  @param buf the evbuffer to write into
+  @param size the number of bytes that are needed
+  @param vec array that receives the description of the space
+  @param n_vecs number of elements in vec, at least 1
+  @return the number of elements of vec that were filled in, or -1 if
+    an error occurred
+  @see evbuffer_commit_space()
+ */
+int evbuffer_reserve_space(struct evbuffer* buf, size_t size,
+                           struct evbuffer_iovec* vec, int n_vecs);
+
+/**
+  Append data written into space from evbuffer_reserve_space().
+
+  The iov_base fields must be unchanged; set iov_len to the number of
+  bytes actually written.
+
+  @param buf the evbuffer that was written into
+  @param vec the regions returned by evbuffer_reserve_space()
+  @param n_vecs the number of regions that hold data
+  @return 0 if successful, or -1 if vec does not describe reserved space
+  @see evbuffer_reserve_space()
+ */
+int evbuffer_commit_space(struct evbuffer* buf,
+                          struct evbuffer_iovec* vec, int n_vecs);
+
+/**
+  Describe the memory holding part of an evbuffer without copying it.
+
+  Lets a parser look at data in place; the regions stay valid until the
+  buffer is next modified.  Fewer bytes than asked for are described if
+  the buffer does not hold that many past start.
+
+  @param buf the evbuffer to look into
+  @param len the number of bytes to describe, or -1 for all of them
+  @param start the offset of the first byte to describe
+  @param vec array that receives the regions
+  @param n_vecs number of elements in vec; may be 0 to only count them
+  @return the number of regions needed to describe the data, which may
+    be more than n_vecs
+ */
+int evbuffer_peek(struct evbuffer* buf, int len, size_t start,
+                  struct evbuffer_iovec* vec, int n_vecs);
+
+
+/**
+  Give unused storage of an evbuffer back to the system.
+
+  Keeps room for the buffered data plus size more bytes and releases
+  the rest.  Pointers into the buffer are no longer valid afterwards.
+
+  @param buf the evbuffer to shrink
+  @param size the number of free bytes to keep after the data
+  @return 0 if successful, or -1 if an error occurred
+ */
+int evbuffer_shrink(struct evbuffer* buf, size_t size);
+
+
+/**
+  Release the storage of an evbuffer automatically once it is empty.
+
+  Whenever draining leaves the buffer empty while it holds more than
+  threshold bytes of storage, that storage is freed, so a burst of
+  traffic does not keep the buffer large for the rest of its life.
+
+  @param buf the evbuffer to configure
+  @param threshold the largest amount of storage kept when empty, or 0
+    to never release it
+ */
+void evbuffer_set_shrink(struct evbuffer* buf, size_t threshold);
+
+
+/**
+  Keep the contents of an evbuffer in a temporary file once it grows large.
+
+  When the storage of the buffer would grow beyond threshold bytes, the
+  data moves to an unlinked file in $TMPDIR (or /tmp) that is mapped
+  into memory.  The contents stay contiguous, so EVBUFFER_DATA() and all
+  evbuffer functions work as before, but the kernel can write the data
+  out and reclaim the memory.  evbuffer_write() sends such data with
+  sendfile(2) where available.  The data moves back into memory when
+  the buffer shrinks below threshold again.
+
+  The blocks of the file are allocated before they are used.  If the
+  file system is full, the buffer stays in memory rather than failing.
+  Note that /tmp is often a tmpfs, which keeps its files in memory and
+  swap; point $TMPDIR at a disk-backed directory to actually save RAM.
+
+  @param buf the evbuffer to configure
+  @param threshold the largest amount of storage kept in memory, or 0 to
+    keep everything in memory
+  @return 0 if successful, or -1 if an error occurred or the platform
+    cannot map files
+ */
+int evbuffer_set_spill(struct evbuffer* buf, size_t threshold);
+
+
+/**
+  Report on the buffer storage cached by an event_base.
+
+  The input and output buffers of bufferevents and HTTP connections
+  take their storage from blocks cached per event_base in power-of-two
+  size classes.  Call this with size_class counting up from 0 until it
+  fails to walk all of them.
+
+  @param base the event_base to report on
+  @param size_class the index of the size class
+  @param size set to the block size of the class, if not NULL
+  @param inuse set to the bytes of the class held by buffers, if not NULL
+  @param cached set to the bytes of the class kept for reuse, if not NULL
+  @return 0 if successful, or -1 if there is no such size class
+ */
+int event_base_get_buffer_stats(struct event_base* base, int size_class,
+                                size_t* size, size_t* inuse, size_t* cached);
+
 
 
 /**
@@ -1189,6 +1821,25 @@ int evbuffer_read(struct evbuffer*, int, int);
  */
 u_char* evbuffer_find(struct evbuffer*, const u_char*, size_t);
 
+/**
+  Find a string within an evbuffer, starting at a given offset.
+
+  A caller that parses data as it arrives can resume the search after
+  more data was added instead of scanning the buffer from the start
+  again; a match can begin no earlier than the last len - 1 bytes that
+  were already searched.
+
+  @param buffer the evbuffer to be searched
+  @param what the string to be searched for
+  @param len the length of the search string
+  @param start the offset into the buffer at which the search begins
+  @return a pointer to the beginning of the first match at or after
+    start, or NULL if the search failed.
+  @see evbuffer_find()
+ */
+u_char* evbuffer_search(struct evbuffer* buffer, const u_char* what,
+                        size_t len, size_t start);
+
 /**
   Set a callback to invoke when the evbuffer is modified.
 
@@ -1198,6 +1849,21 @@ u_char* evbuffer_find(struct evbuffer*, const u_char*, size_t);
  */
 void evbuffer_setcb(struct evbuffer*, void (*)(struct evbuffer*, size_t, size_t, void*), void*);
 
+/**
+  Defer the callback of an evbuffer to the end of the loop iteration.
+
+  Instead of being invoked on every change, the callback runs once after
+  the events of the current iteration of base have been processed and
+  sees the length of the buffer from before the first of the changes.
+
+  @param buffer the evbuffer whose callback is to be deferred
+  @param base the event_base to run the callback on, or NULL to invoke it
+    immediately again
+  @return 0 if successful, or -1 if an error occurred
+  @see evbuffer_setcb()
+ */
+int evbuffer_defer_callbacks(struct evbuffer* buffer, struct event_base* base);
+
 /*
  * Marshaling tagged data - We assume that all tags are inserted in their
  * numeric order - so that unknown tags will always be higher than the
@@ -133,7 +133,7 @@ int evtag_unmarshal_%(name)s(struct evbuffer *, ev_uint32_t,
             '%(name)s_new(void)\n'
             '{\n'
             '  struct %(name)s *tmp;\n'
-            '  if ((tmp = malloc(sizeof(struct %(name)s))) == NULL) {\n'
+            '  if ((tmp = event_mm_malloc(sizeof(struct %(name)s))) == NULL) {\n'
             '    event_warn("%%s: malloc", __func__);\n'
             '    return (NULL);\n'
             '  }\n'
@@ -182,7 +182,7 @@ int evtag_unmarshal_%(name)s(struct evbuffer *, ev_uint32_t,
         for entry in self._entries:
             self.PrintIdented(file, '  ', entry.CodeFree('tmp'))
 
-        print >>file, ('  free(tmp);\n'
+        print >>file, ('  event_mm_free(tmp);\n'
                        '}\n')
 
         # Marshaling
@@ -572,8 +572,8 @@ class EntryString(Entry):
     const %(ctype)s value)
 {
   if (msg->%(name)s_data != NULL)
-    free(msg->%(name)s_data);
-  if ((msg->%(name)s_data = strdup(value)) == NULL)
+    event_mm_free(msg->%(name)s_data);
+  if ((msg->%(name)s_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->%(name)s_set = 1;
   return (0);
@@ -598,7 +598,7 @@ class EntryString(Entry):
 
     def CodeClear(self, structname):
         code = [ 'if (%s->%s_set == 1) {' % (structname, self.Name()),
-                 '  free (%s->%s_data);' % (structname, self.Name()),
+                 '  event_mm_free(%s->%s_data);' % (structname, self.Name()),
                  '  %s->%s_data = NULL;' % (structname, self.Name()),
                  '  %s->%s_set = 0;' % (structname, self.Name()),
                  '}'
@@ -612,7 +612,7 @@ class EntryString(Entry):
 
     def CodeFree(self, name):
         code  = ['if (%s->%s_data != NULL)' % (name, self._name),
-                 '    free (%s->%s_data); ' % (name, self._name)]
+                 '    event_mm_free(%s->%s_data); ' % (name, self._name)]
 
         return code
 
@@ -773,8 +773,8 @@ class EntryVarBytes(Entry):
             self._struct.Name(), self._ctype),
                  '{',
                  '  if (msg->%s_data != NULL)' % name,
-                 '    free (msg->%s_data);' % name,
-                 '  msg->%s_data = malloc(len);' % name,
+                 '    event_mm_free(msg->%s_data);' % name,
+                 '  msg->%s_data = event_mm_malloc(len);' % name,
                  '  if (msg->%s_data == NULL)' % name,
                  '    return (-1);',
                  '  msg->%s_set = 1;' % name,
@@ -807,7 +807,7 @@ class EntryVarBytes(Entry):
                 'if (%s->%s_length > EVBUFFER_LENGTH(%s))' % (
             var_name, self._name, buf),
                 '  return (-1);',
-                'if ((%s->%s_data = malloc(%s->%s_length)) == NULL)' % (
+                'if ((%s->%s_data = event_mm_malloc(%s->%s_length)) == NULL)' % (
             var_name, self._name, var_name, self._name),
                 '  return (-1);',
                 'if (evtag_unmarshal_fixed(%s, %s, %s->%s_data, '
@@ -827,7 +827,7 @@ class EntryVarBytes(Entry):
 
     def CodeClear(self, structname):
         code = [ 'if (%s->%s_set == 1) {' % (structname, self.Name()),
-                 '  free (%s->%s_data);' % (structname, self.Name()),
+                 '  event_mm_free(%s->%s_data);' % (structname, self.Name()),
                  '  %s->%s_data = NULL;' % (structname, self.Name()),
                  '  %s->%s_length = 0;' % (structname, self.Name()),
                  '  %s->%s_set = 0;' % (structname, self.Name()),
@@ -843,7 +843,7 @@ class EntryVarBytes(Entry):
 
     def CodeFree(self, name):
         code  = ['if (%s->%s_data != NULL)' % (name, self._name),
-                 '    free (%s->%s_data); ' % (name, self._name)]
+                 '    event_mm_free(%s->%s_data); ' % (name, self._name)]
 
         return code
 
@@ -932,7 +932,7 @@ error:
     int tobe_allocated = msg->%(name)s_num_allocated;
     %(ctype)s* new_data = NULL;
     tobe_allocated = !tobe_allocated ? 1 : tobe_allocated << 1;
-    new_data = (%(ctype)s*) realloc(msg->%(name)s_data,
+    new_data = (%(ctype)s*) event_mm_realloc(msg->%(name)s_data,
         tobe_allocated * sizeof(%(ctype)s));
     if (new_data == NULL)
       goto error;
@@ -1007,7 +1007,7 @@ if (evtag_unmarshal_%(refname)s(%(buf)s, %(tag_name)s,
                  '    %s_free(%s->%s_data[i]);' % (
             self._refname, structname, self.Name()),
                  '  }',
-                 '  free(%s->%s_data);' % (structname, self.Name()),
+                 '  event_mm_free(%s->%s_data);' % (structname, self.Name()),
                  '  %s->%s_data = NULL;' % (structname, self.Name()),
                  '  %s->%s_set = 0;' % (structname, self.Name()),
                  '  %s->%s_length = 0;' % (structname, self.Name()),
@@ -1032,7 +1032,7 @@ if (evtag_unmarshal_%(refname)s(%(buf)s, %(tag_name)s,
             self._refname, name, self._name),
                  '    %s->%s_data[i] = NULL;' % (name, self._name),
                  '  }',
-                 '  free(%s->%s_data);' % (name, self._name),
+                 '  event_mm_free(%s->%s_data);' % (name, self._name),
                  '  %s->%s_data = NULL;' % (name, self._name),
                  '  %s->%s_length = 0;' % (name, self._name),
                  '  %s->%s_num_allocated = 0;' % (name, self._name),
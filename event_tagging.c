@@ -64,6 +64,7 @@
 #include "event.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 int evtag_decode_int(ev_uint32_t* pnumber, struct evbuffer* evbuf);
 int evtag_encode_tag(struct evbuffer* evbuf, ev_uint32_t tag);
@@ -87,13 +88,18 @@ evtag_init(void)
  * integers.  This function is byte-order independent.
  */
 
-void
-encode_int(struct evbuffer* evbuf, ev_uint32_t number)
+static int
+encode_int_internal(ev_uint8_t* data, ev_uint32_t number)
 {
     int off = 1, nibbles = 0;
-    ev_uint8_t data[5];
+    ev_uint32_t rest;
+
+    /* only touch the bytes that are part of the encoding */
+    for (rest = number; rest; rest >>= 4)
+        off++;
+    memset(data, 0, (off + 1) / 2);
+    off = 1;
 
-    memset(data, 0, sizeof(ev_uint32_t) + 1);
     while (number) {
         if (off & 0x1)
             data[off / 2] = (data[off / 2] & 0xf0) | (number & 0x0f);
@@ -110,7 +116,19 @@ encode_int(struct evbuffer* evbuf, ev_uint32_t number)
     /* Off - 1 is the number of encoded nibbles */
     data[0] = (data[0] & 0x0f) | ((nibbles & 0x0f) << 4);
 
-    evbuffer_add(evbuf, data, (off + 1) / 2);
+    return ((off + 1) / 2);
+}
+
+void
+encode_int(struct evbuffer* evbuf, ev_uint32_t number)
+{
+    struct evbuffer_iovec vec;
+
+    if (evbuffer_reserve_space(evbuf, sizeof(ev_uint32_t) + 1,
+                               &vec, 1) < 0)
+        return;
+    vec.iov_len = encode_int_internal(vec.iov_base, number);
+    evbuffer_commit_space(evbuf, &vec, 1);
 }
 
 /*
@@ -118,13 +136,11 @@ encode_int(struct evbuffer* evbuf, ev_uint32_t number)
  * octet as a continuation signal.
  */
 
-int
-evtag_encode_tag(struct evbuffer* evbuf, ev_uint32_t tag)
+static int
+encode_tag_internal(ev_uint8_t* data, ev_uint32_t tag)
 {
     int bytes = 0;
-    ev_uint8_t data[5];
 
-    memset(data, 0, sizeof(data));
     do {
         ev_uint8_t lower = tag & 0x7f;
         tag >>= 7;
@@ -132,15 +148,30 @@ evtag_encode_tag(struct evbuffer* evbuf, ev_uint32_t tag)
         if (tag)
             lower |= 0x80;
 
-        data[bytes++] = lower;
+        if (data != NULL)
+            data[bytes] = lower;
+        bytes++;
     } while (tag);
 
-    if (evbuf != NULL)
-        evbuffer_add(evbuf, data, bytes);
-
     return (bytes);
 }
 
+int
+evtag_encode_tag(struct evbuffer* evbuf, ev_uint32_t tag)
+{
+    struct evbuffer_iovec vec;
+
+    if (evbuf == NULL)
+        return (encode_tag_internal(NULL, tag));
+
+    if (evbuffer_reserve_space(evbuf, 5, &vec, 1) < 0)
+        return (-1);
+    vec.iov_len = encode_tag_internal(vec.iov_base, tag);
+    evbuffer_commit_space(evbuf, &vec, 1);
+
+    return (vec.iov_len);
+}
+
 static int
 decode_tag_internal(ev_uint32_t* ptag, struct evbuffer* evbuf, int dodrain)
 {
@@ -193,16 +224,40 @@ evtag_marshal(struct evbuffer* evbuf, ev_uint32_t tag,
     evbuffer_add(evbuf, (void*)data, len);
 }
 
+/*
+ * Integers and timevals encode to at most ten bytes, so their length
+ * always fits in a single byte and the whole record can be built in
+ * place: the payload goes behind the one length byte, which is filled
+ * in afterwards.
+ */
+static void
+evtag_marshal_ints(struct evbuffer* evbuf, ev_uint32_t tag,
+                   const ev_uint32_t* numbers, int count)
+{
+    struct evbuffer_iovec vec;
+    ev_uint8_t* data;
+    int i, taglen, len = 0;
+
+    len = 5 + 1 + count * (sizeof(ev_uint32_t) + 1);
+    if (evbuffer_reserve_space(evbuf, len, &vec, 1) < 0)
+        return;
+    len = 0;
+    data = vec.iov_base;
+
+    taglen = encode_tag_internal(data, tag);
+    for (i = 0; i < count; ++i)
+        len += encode_int_internal(data + taglen + 1 + len, numbers[i]);
+    encode_int_internal(data + taglen, len);
+
+    vec.iov_len = taglen + 1 + len;
+    evbuffer_commit_space(evbuf, &vec, 1);
+}
+
 /* Marshaling for integers */
 void
 evtag_marshal_int(struct evbuffer* evbuf, ev_uint32_t tag, ev_uint32_t integer)
 {
-    evbuffer_drain(_buf, EVBUFFER_LENGTH(_buf));
-    encode_int(_buf, integer);
-
-    evtag_encode_tag(evbuf, tag);
-    encode_int(evbuf, EVBUFFER_LENGTH(_buf));
-    evbuffer_add_buffer(evbuf, _buf);
+    evtag_marshal_ints(evbuf, tag, &integer, 1);
 }
 
 void
@@ -214,13 +269,11 @@ evtag_marshal_string(struct evbuffer* buf, ev_uint32_t tag, const char* string)
 void
 evtag_marshal_timeval(struct evbuffer* evbuf, ev_uint32_t tag, struct timeval* tv)
 {
-    evbuffer_drain(_buf, EVBUFFER_LENGTH(_buf));
-
-    encode_int(_buf, tv->tv_sec);
-    encode_int(_buf, tv->tv_usec);
+    ev_uint32_t numbers[2];
 
-    evtag_marshal(evbuf, tag, EVBUFFER_DATA(_buf),
-                  EVBUFFER_LENGTH(_buf));
+    numbers[0] = tv->tv_sec;
+    numbers[1] = tv->tv_usec;
+    evtag_marshal_ints(evbuf, tag, numbers, 2);
 }
 
 static int
@@ -413,7 +466,7 @@ evtag_unmarshal_string(struct evbuffer* evbuf, ev_uint32_t need_tag,
     if (evtag_unmarshal(evbuf, &tag, _buf) == -1 || tag != need_tag)
         return (-1);
 
-    *pstring = calloc(EVBUFFER_LENGTH(_buf) + 1, 1);
+    *pstring = mm_calloc(EVBUFFER_LENGTH(_buf) + 1, 1);
     if (*pstring == NULL)
         event_err(1, "%s: calloc", __func__);
     evbuffer_remove(_buf, *pstring, EVBUFFER_LENGTH(_buf));
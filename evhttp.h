@@ -134,6 +134,25 @@ void evhttp_set_gencb(struct evhttp*,
  */
 void evhttp_set_timeout(struct evhttp*, int timeout_in_secs);
 
+/**
+ * Set the timeout for an HTTP request with sub-second resolution.
+ *
+ * @param http an evhttp object
+ * @param tv the timeout, or NULL to use the default timeouts
+ */
+void evhttp_set_timeout_tv(struct evhttp* http, const struct timeval* tv);
+
+/**
+ * Keep request bodies larger than threshold bytes in a temporary file.
+ *
+ * Applies to the connections accepted from now on; see
+ * evhttp_connection_set_body_spill().
+ *
+ * @param http an evhttp object
+ * @param threshold the largest body kept in memory, or 0 for no limit
+ */
+void evhttp_set_body_spill(struct evhttp* http, size_t threshold);
+
 /* Request/Response functionality */
 
 /**
@@ -266,6 +285,10 @@ struct evhttp_connection* evhttp_request_get_connection(struct evhttp_request* r
  * A connection object that can be used to for making HTTP requests.  The
  * connection object tries to establish the connection when it is given an
  * http request object.
+ *
+ * If evdns has been configured with nameservers, a hostname is resolved
+ * asynchronously through it; otherwise getaddrinfo(3) is used, which
+ * blocks the event loop for the duration of the lookup.
  */
 struct evhttp_connection* evhttp_connection_new(
     const char* address, unsigned short port);
@@ -285,10 +308,21 @@ void evhttp_connection_set_local_port(struct evhttp_connection* evcon,
 void evhttp_connection_set_timeout(struct evhttp_connection* evcon,
                                    int timeout_in_secs);
 
+/** Like evhttp_connection_set_timeout() but with sub-second resolution;
+    NULL restores the default timeouts */
+void evhttp_connection_set_timeout_tv(struct evhttp_connection* evcon,
+                                      const struct timeval* tv);
+
 /** Sets the retry limit for this connection - -1 repeats indefnitely */
 void evhttp_connection_set_retries(struct evhttp_connection* evcon,
                                    int retry_max);
 
+/** Keeps bodies read on this connection, and data waiting to be sent on
+    it, in a temporary file once they grow beyond threshold bytes; see
+    evbuffer_set_spill().  0 keeps everything in memory. */
+void evhttp_connection_set_body_spill(struct evhttp_connection* evcon,
+                                      size_t threshold);
+
 /** Set a callback for connection close. */
 void evhttp_connection_set_closecb(struct evhttp_connection* evcon,
                                    void (*)(struct evhttp_connection*, void*), void*);
@@ -299,6 +333,25 @@ void evhttp_connection_set_closecb(struct evhttp_connection* evcon,
  */
 void evhttp_connection_set_base(struct evhttp_connection* evcon,
                                 struct event_base* base);
+/**
+ * Moves an idle outgoing connection to another event base.
+ *
+ * Only a connection without requests that is either disconnected or
+ * connected and waiting for the next request can be moved; it keeps
+ * its socket.  Must be called from the thread of its current base.  As
+ * with bufferevent_migrate(), the move completes on the thread of a
+ * notifiable base, where cb is then called, and right away otherwise.
+ *
+ * @param evcon the connection to be moved
+ * @param base the event base it moves to
+ * @param cb the function called once it belongs to base, or NULL
+ * @param arg the argument passed to cb
+ * @return 0 if successful, or -1 if the connection stays where it is
+ */
+int evhttp_connection_migrate(struct evhttp_connection* evcon,
+                              struct event_base* base,
+                              void (*cb)(struct evhttp_connection*, void*), void* arg);
+
 
 /** Get the remote address and port associated with this connection. */
 void evhttp_connection_get_peer(struct evhttp_connection* evcon,
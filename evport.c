@@ -74,6 +74,7 @@
 #include "event-internal.h"
 #include "log.h"
 #include "evsignal.h"
+#include "mm-internal.h"
 
 
 /*
@@ -146,21 +147,21 @@ evport_init(struct event_base* base)
     if (evutil_getenv("EVENT_NOEVPORT"))
         return (NULL);
 
-    if (!(evpd = calloc(1, sizeof(struct evport_data))))
+    if (!(evpd = mm_calloc(1, sizeof(struct evport_data))))
         return (NULL);
 
     if ((evpd->ed_port = port_create()) == -1) {
-        free(evpd);
+        mm_free(evpd);
         return (NULL);
     }
 
     /*
      * Initialize file descriptor structure
      */
-    evpd->ed_fds = calloc(DEFAULT_NFDS, sizeof(struct fd_info));
+    evpd->ed_fds = mm_calloc(DEFAULT_NFDS, sizeof(struct fd_info));
     if (evpd->ed_fds == NULL) {
         close(evpd->ed_port);
-        free(evpd);
+        mm_free(evpd);
         return (NULL);
     }
     evpd->ed_nevents = DEFAULT_NFDS;
@@ -241,7 +242,7 @@ grow(struct evport_data* epdp, int factor)
 
     check_evportop(epdp);
 
-    tmp = realloc(epdp->ed_fds, sizeof(struct fd_info) * newsize);
+    tmp = mm_realloc(epdp->ed_fds, sizeof(struct fd_info) * newsize);
     if (NULL == tmp)
         return -1;
     epdp->ed_fds = tmp;
@@ -514,6 +515,6 @@ evport_dealloc(struct event_base* base, void* arg)
     close(evpd->ed_port);
 
     if (evpd->ed_fds)
-        free(evpd->ed_fds);
-    free(evpd);
+        mm_free(evpd->ed_fds);
+    mm_free(evpd);
 }
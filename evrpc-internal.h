@@ -78,7 +78,7 @@ struct evrpc_pool {
 
     struct evconq connections;
 
-    int timeout;
+    struct timeval timeout; /* tv_sec -1 if not set */
 
     TAILQ_HEAD(evrpc_requestq, evrpc_request_wrapper) requests;
 };
@@ -59,11 +59,12 @@
 #include "evhttp.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 struct evrpc_base*
 evrpc_init(struct evhttp* http_server)
 {
-    struct evrpc_base* base = calloc(1, sizeof(struct evrpc_base));
+    struct evrpc_base* base = mm_calloc(1, sizeof(struct evrpc_base));
     if (base == NULL)
         return (NULL);
 
@@ -93,7 +94,7 @@ evrpc_free(struct evrpc_base* base)
     while ((hook = TAILQ_FIRST(&base->output_hooks)) != NULL) {
         assert(evrpc_remove_hook(base, EVRPC_OUTPUT, hook));
     }
-    free(base);
+    mm_free(base);
 }
 
 void*
@@ -116,7 +117,7 @@ evrpc_add_hook(void* vbase,
         assert(hook_type == EVRPC_INPUT || hook_type == EVRPC_OUTPUT);
     }
 
-    hook = calloc(1, sizeof(struct evrpc_hook));
+    hook = mm_calloc(1, sizeof(struct evrpc_hook));
     assert(hook != NULL);
 
     hook->process = cb;
@@ -133,7 +134,7 @@ evrpc_remove_hook_internal(struct evrpc_hook_list* head, void* handle)
     TAILQ_FOREACH(hook, head, next) {
         if (hook == handle) {
             TAILQ_REMOVE(head, hook, next);
-            free(hook);
+            mm_free(hook);
             return (1);
         }
     }
@@ -194,7 +195,7 @@ evrpc_construct_uri(const char* uri)
     int constructed_uri_len;
 
     constructed_uri_len = strlen(EVRPC_URI_PREFIX) + strlen(uri) + 1;
-    if ((constructed_uri = malloc(constructed_uri_len)) == NULL)
+    if ((constructed_uri = mm_malloc(constructed_uri_len)) == NULL)
         event_err(1, "%s: failed to register rpc at %s",
                   __func__, uri);
     memcpy(constructed_uri, EVRPC_URI_PREFIX, strlen(EVRPC_URI_PREFIX));
@@ -221,7 +222,7 @@ evrpc_register_rpc(struct evrpc_base* base, struct evrpc* rpc,
                   evrpc_request_cb,
                   rpc);
 
-    free(constructed_uri);
+    mm_free(constructed_uri);
 
     return (0);
 }
@@ -243,15 +244,15 @@ evrpc_unregister_rpc(struct evrpc_base* base, const char* name)
     }
     TAILQ_REMOVE(&base->registered_rpcs, rpc, next);
 
-    free((char*)rpc->uri);
-    free(rpc);
+    mm_free((char*)rpc->uri);
+    mm_free(rpc);
 
     registered_uri = evrpc_construct_uri(name);
 
     /* remove the http server callback */
     assert(evhttp_del_cb(base->http_server, registered_uri) == 0);
 
-    free(registered_uri);
+    mm_free(registered_uri);
     return (0);
 }
 
@@ -275,7 +276,7 @@ evrpc_request_cb(struct evhttp_request* req, void* arg)
                             req, req->input_buffer) == -1)
         goto error;
 
-    rpc_state = calloc(1, sizeof(struct evrpc_req_generic));
+    rpc_state = mm_calloc(1, sizeof(struct evrpc_req_generic));
     if (rpc_state == NULL)
         goto error;
 
@@ -323,7 +324,7 @@ evrpc_reqstate_free(struct evrpc_req_generic* rpc_state)
             rpc->request_free(rpc_state->request);
         if (rpc_state->reply != NULL)
             rpc->reply_free(rpc_state->reply);
-        free(rpc_state);
+        mm_free(rpc_state);
     }
 }
 
@@ -382,7 +383,7 @@ static int evrpc_schedule_request(struct evhttp_connection* connection,
 struct evrpc_pool*
 evrpc_pool_new(struct event_base* base)
 {
-    struct evrpc_pool* pool = calloc(1, sizeof(struct evrpc_pool));
+    struct evrpc_pool* pool = mm_calloc(1, sizeof(struct evrpc_pool));
     if (pool == NULL)
         return (NULL);
 
@@ -393,7 +394,8 @@ evrpc_pool_new(struct event_base* base)
     TAILQ_INIT(&pool->output_hooks);
 
     pool->base = base;
-    pool->timeout = -1;
+    evutil_timerclear(&pool->timeout);
+    pool->timeout.tv_sec = -1;
 
     return (pool);
 }
@@ -401,8 +403,8 @@ evrpc_pool_new(struct event_base* base)
 static void
 evrpc_request_wrapper_free(struct evrpc_request_wrapper* request)
 {
-    free(request->name);
-    free(request);
+    mm_free(request->name);
+    mm_free(request);
 }
 
 void
@@ -431,7 +433,7 @@ evrpc_pool_free(struct evrpc_pool* pool)
         assert(evrpc_remove_hook(pool, EVRPC_OUTPUT, hook));
     }
 
-    free(pool);
+    mm_free(pool);
 }
 
 /*
@@ -456,7 +458,7 @@ evrpc_pool_add_connection(struct evrpc_pool* pool,
      * unless a timeout was specifically set for a connection,
      * the connection inherits the timeout from the pool.
      */
-    if (connection->timeout == -1)
+    if (connection->timeout.tv_sec == -1)
         connection->timeout = pool->timeout;
 
     /*
@@ -474,12 +476,32 @@ evrpc_pool_add_connection(struct evrpc_pool* pool,
 
 void
 evrpc_pool_set_timeout(struct evrpc_pool* pool, int timeout_in_secs)
+{
+    struct timeval tv;
+
+    evutil_timerclear(&tv);
+    tv.tv_sec = timeout_in_secs;
+    evrpc_pool_set_timeout_tv(pool, &tv);
+}
+
+void
+evrpc_pool_set_timeout_tv(struct evrpc_pool* pool, const struct timeval* tv)
 {
     struct evhttp_connection* evcon;
+    struct timeval timeout;
+
+    /* NULL restores the default, as for evhttp_connection_set_timeout_tv */
+    if (tv != NULL) {
+        timeout = *tv;
+    } else {
+        evutil_timerclear(&timeout);
+        timeout.tv_sec = -1;
+    }
+
     TAILQ_FOREACH(evcon, &pool->connections, next) {
-        evcon->timeout = timeout_in_secs;
+        evcon->timeout = timeout;
     }
-    pool->timeout = timeout_in_secs;
+    pool->timeout = timeout;
 }
 
 
@@ -533,19 +555,16 @@ evrpc_schedule_request(struct evhttp_connection* connection,
                             req, req->output_buffer) == -1)
         goto error;
 
-    if (pool->timeout > 0) {
+    if (pool->timeout.tv_sec >= 0 && evutil_timerisset(&pool->timeout)) {
         /*
          * a timeout after which the whole rpc is going to be aborted.
          */
-        struct timeval tv;
-        evutil_timerclear(&tv);
-        tv.tv_sec = pool->timeout;
-        evtimer_add(&ctx->ev_timeout, &tv);
+        evtimer_add(&ctx->ev_timeout, &pool->timeout);
     }
 
     /* start the request over the connection */
     res = evhttp_make_request(connection, req, EVHTTP_REQ_POST, uri);
-    free(uri);
+    mm_free(uri);
 
     if (res == -1)
         goto error;
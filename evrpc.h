@@ -185,14 +185,14 @@ int evrpc_send_request_##rpcname(struct evrpc_pool *pool, \
     struct evrpc_status status;                 \
     struct evrpc_request_wrapper *ctx;              \
     ctx = (struct evrpc_request_wrapper *) \
-        malloc(sizeof(struct evrpc_request_wrapper));       \
+        event_mm_malloc(sizeof(struct evrpc_request_wrapper));       \
     if (ctx == NULL)                        \
         goto error;                     \
     ctx->pool = pool;                       \
     ctx->evcon = NULL;                      \
-    ctx->name = strdup(#rpcname);                   \
+    ctx->name = event_mm_strdup(#rpcname);                   \
     if (ctx->name == NULL) {                    \
-        free(ctx);                      \
+        event_mm_free(ctx);                      \
         goto error;                     \
     }                               \
     ctx->cb = (void (*)(struct evrpc_status *, \
@@ -239,7 +239,7 @@ error:                                  \
 /* Takes a request object and fills it in with the right magic */
 #define EVRPC_REGISTER_OBJECT(rpc, name, request, reply) \
   do { \
-    (rpc)->uri = strdup(#name); \
+    (rpc)->uri = event_mm_strdup(#name); \
     if ((rpc)->uri == NULL) {            \
       fprintf(stderr, "failed to register object\n");   \
       exit(1);                      \
@@ -294,7 +294,7 @@ void evrpc_free(struct evrpc_base* base);
  */
 #define EVRPC_REGISTER(base, name, request, reply, callback, cbarg) \
   do { \
-    struct evrpc* rpc = (struct evrpc *)calloc(1, sizeof(struct evrpc)); \
+    struct evrpc* rpc = (struct evrpc *)event_mm_calloc(1, sizeof(struct evrpc)); \
     EVRPC_REGISTER_OBJECT(rpc, name, request, reply); \
     evrpc_register_rpc(base, rpc, \
     (void (*)(struct evrpc_req_generic*, void *))callback, cbarg);  \
@@ -430,6 +430,18 @@ void evrpc_pool_add_connection(struct evrpc_pool*,
  */
 void evrpc_pool_set_timeout(struct evrpc_pool* pool, int timeout_in_secs);
 
+/**
+ * Like evrpc_pool_set_timeout() but with sub-second resolution.
+ *
+ * @param pool a pointer to a struct evrpc_pool object
+ * @param tv the time after which a request should timeout; a zero
+ *   timeval means that requests never timeout, and NULL restores the
+ *   default.
+ * @see evrpc_pool_set_timeout()
+ */
+void evrpc_pool_set_timeout_tv(struct evrpc_pool* pool,
+                               const struct timeval* tv);
+
 /**
  * Hooks for changing the input and output of RPCs; this can be used to
  * implement compression, authentication, encryption, ...
@@ -0,0 +1,1061 @@
+/*
+ * Running event loops on several threads: waking a base up from another
+ * thread, groups of loops that each own a thread, optionally pinned to a
+ * CPU, and pools of workers for jobs too slow to run on a loop.  An
+ * event_base itself is still not thread-safe; everything that touches
+ * it has to run on its own thread, which is what event_base_post() is
+ * for.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#else
+#include <sys/_libevent_time.h>
+#endif
+#include <sys/queue.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event.h"
+#include "event-internal.h"
+#include "evutil.h"
+#include "log.h"
+#include "mm-internal.h"
+
+#ifdef HAVE_PTHREAD
+
+#ifdef HAVE_SETFD
+#define FD_CLOSEONEXEC(x) do { \
+        if (fcntl(x, F_SETFD, 1) == -1) \
+                event_warn("fcntl(%d, F_SETFD)", x); \
+} while (0)
+#else
+#define FD_CLOSEONEXEC(x)
+#endif
+
+struct event_post {
+    TAILQ_ENTRY(event_post) next;
+    void (*cb)(void*);
+    void* arg;
+};
+
+TAILQ_HEAD(event_post_list, event_post);
+
+struct event_notify {
+    struct event ev;
+    int fds[2];                 /* written by posters, read by the loop */
+    pthread_mutex_t lock;       /* protects posts and pending */
+    struct event_post_list posts;
+    int pending;                /* set while a wakeup byte is unread */
+    int nwaiting;               /* calls that keep the loop running */
+};
+
+static void
+event_notify_cb(int fd, short what, void* arg)
+{
+    struct event_base* base = arg;
+    struct event_notify* notify = base->notify;
+    struct event_post_list posts;
+    struct event_post* post;
+    char buf[64];
+
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+
+    /* run what was posted so far; later posts send another byte */
+    TAILQ_INIT(&posts);
+    pthread_mutex_lock(&notify->lock);
+    while ((post = TAILQ_FIRST(&notify->posts)) != NULL) {
+        TAILQ_REMOVE(&notify->posts, post, next);
+        TAILQ_INSERT_TAIL(&posts, post, next);
+    }
+    notify->pending = 0;
+    pthread_mutex_unlock(&notify->lock);
+
+    while ((post = TAILQ_FIRST(&posts)) != NULL) {
+        TAILQ_REMOVE(&posts, post, next);
+        (*post->cb)(post->arg);
+        mm_free(post);
+    }
+}
+
+int
+event_base_notify_init(struct event_base* base, int keepalive)
+{
+    struct event_notify* notify;
+
+    if (base->notify != NULL)
+        return (0);
+
+    if ((notify = mm_calloc(1, sizeof(struct event_notify))) == NULL) {
+        event_warn("%s: calloc", __func__);
+        return (-1);
+    }
+    if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, notify->fds) == -1) {
+        event_warn("%s: socketpair", __func__);
+        mm_free(notify);
+        return (-1);
+    }
+    FD_CLOSEONEXEC(notify->fds[0]);
+    FD_CLOSEONEXEC(notify->fds[1]);
+    evutil_make_socket_nonblocking(notify->fds[0]);
+    evutil_make_socket_nonblocking(notify->fds[1]);
+
+    pthread_mutex_init(&notify->lock, NULL);
+    TAILQ_INIT(&notify->posts);
+
+    event_set(&notify->ev, notify->fds[1], EV_READ | EV_PERSIST,
+              event_notify_cb, base);
+    event_base_set(base, &notify->ev);
+    /* unless it should keep the loop running, it does not count */
+    if (!keepalive)
+        notify->ev.ev_flags |= EVLIST_INTERNAL;
+    if (event_add(&notify->ev, NULL) == -1) {
+        pthread_mutex_destroy(&notify->lock);
+        EVUTIL_CLOSESOCKET(notify->fds[0]);
+        EVUTIL_CLOSESOCKET(notify->fds[1]);
+        mm_free(notify);
+        return (-1);
+    }
+
+    base->notify = notify;
+    return (0);
+}
+
+void
+event_base_notify_free(struct event_base* base)
+{
+    struct event_notify* notify = base->notify;
+    struct event_post* post;
+
+    if (notify == NULL)
+        return;
+
+    event_del(&notify->ev);
+    EVUTIL_CLOSESOCKET(notify->fds[0]);
+    EVUTIL_CLOSESOCKET(notify->fds[1]);
+
+    /* whatever was never run is dropped */
+    while ((post = TAILQ_FIRST(&notify->posts)) != NULL) {
+        TAILQ_REMOVE(&notify->posts, post, next);
+        mm_free(post);
+    }
+    pthread_mutex_destroy(&notify->lock);
+    mm_free(notify);
+    base->notify = NULL;
+}
+
+int
+event_base_make_notifiable(struct event_base* base)
+{
+    return (event_base_notify_init(base, 0));
+}
+
+int
+event_base_notify_waiting(struct event_base* base)
+{
+    struct event_notify* notify = base->notify;
+    int nwaiting;
+
+    pthread_mutex_lock(&notify->lock);
+    nwaiting = notify->nwaiting;
+    pthread_mutex_unlock(&notify->lock);
+
+    return (nwaiting);
+}
+
+static void
+event_base_notify_wait(struct event_base* base, int delta)
+{
+    struct event_notify* notify = base->notify;
+
+    pthread_mutex_lock(&notify->lock);
+    notify->nwaiting += delta;
+    pthread_mutex_unlock(&notify->lock);
+}
+
+int
+event_base_post(struct event_base* base, void (*cb)(void*), void* arg)
+{
+    struct event_notify* notify = base->notify;
+    struct event_post* post;
+    int wakeup = 0;
+
+    if (notify == NULL)
+        return (-1);
+
+    if ((post = mm_malloc(sizeof(struct event_post))) == NULL) {
+        event_warn("%s: malloc", __func__);
+        return (-1);
+    }
+    post->cb = cb;
+    post->arg = arg;
+
+    pthread_mutex_lock(&notify->lock);
+    TAILQ_INSERT_TAIL(&notify->posts, post, next);
+    if (!notify->pending) {
+        notify->pending = 1;
+        wakeup = 1;
+    }
+    pthread_mutex_unlock(&notify->lock);
+
+    /* a full socket already holds a byte the loop has yet to read */
+    if (wakeup)
+        send(notify->fds[0], "", 1, 0);
+
+    return (0);
+}
+
+/*
+ * Loop groups
+ */
+
+struct event_loop {
+    struct event_loop_group* group;
+    struct event_base* base;
+    pthread_t thread;
+    int cpu;                    /* -1 if the thread is not pinned */
+    int nconns;                 /* handed out by event_loop_group_pick() */
+};
+
+struct event_loop_group {
+    struct event_loop* loops;
+    int nloops;
+    int nstarted;               /* threads that are running */
+    int next;                   /* where the next pick starts looking */
+    int stopped;
+
+    pthread_mutex_t lock;       /* protects nconns, next and the above */
+    pthread_cond_t cond;
+    int nready;                 /* loops that have set up their base */
+
+    struct timeval stop_tv;
+    struct timeval* stop_tvp;
+};
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* Parses a sysfs cpu list such as "0-3,8-11" into set. */
+static void
+event_parse_cpulist(const char* path, cpu_set_t* set)
+{
+    FILE* fp;
+    int lo, hi, c;
+
+    CPU_ZERO(set);
+    if ((fp = fopen(path, "r")) == NULL)
+        return;
+    while (fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        if ((c = fgetc(fp)) == '-') {
+            if (fscanf(fp, "%d", &hi) != 1)
+                break;
+            c = fgetc(fp);
+        }
+        for (; lo <= hi && lo < CPU_SETSIZE; ++lo)
+            CPU_SET(lo, set);
+        if (c != ',')
+            break;
+    }
+    fclose(fp);
+}
+
+/*
+ * Orders the CPUs this process may run on so that consecutive loops
+ * land on different NUMA nodes: the first CPU of every node, then the
+ * second of every node, and so on.  Returns the number of CPUs.
+ */
+static int
+event_cpu_order(int* cpus, int ncpus)
+{
+    cpu_set_t allowed, online, nodes[64], used;
+    char path[64];
+    int nnodes = 0, n = 0, i, j, more;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        return (0);
+
+    event_parse_cpulist("/sys/devices/system/node/online", &online);
+    for (i = 0; i < CPU_SETSIZE && nnodes < 64; ++i) {
+        if (!CPU_ISSET(i, &online))
+            continue;
+        evutil_snprintf(path, sizeof(path),
+                        "/sys/devices/system/node/node%d/cpulist", i);
+        event_parse_cpulist(path, &nodes[nnodes]);
+        CPU_AND(&nodes[nnodes], &nodes[nnodes], &allowed);
+        if (CPU_COUNT(&nodes[nnodes]))
+            ++nnodes;
+    }
+
+    CPU_ZERO(&used);
+    do {
+        more = 0;
+        for (i = 0; i < nnodes; ++i) {
+            for (j = 0; j < CPU_SETSIZE; ++j) {
+                if (CPU_ISSET(j, &nodes[i]) && !CPU_ISSET(j, &used))
+                    break;
+            }
+            if (j == CPU_SETSIZE)
+                continue;
+            CPU_SET(j, &used);
+            if (n < ncpus)
+                cpus[n++] = j;
+            more = 1;
+        }
+    } while (more && n < ncpus);
+
+    /* without NUMA information, or CPUs no node claims */
+    for (j = 0; j < CPU_SETSIZE && n < ncpus; ++j) {
+        if (CPU_ISSET(j, &allowed) && !CPU_ISSET(j, &used))
+            cpus[n++] = j;
+    }
+
+    return (n);
+}
+#endif
+
+static int
+event_cpu_count(void)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        return (CPU_COUNT(&allowed));
+#endif
+#ifdef _SC_NPROCESSORS_ONLN
+    return ((int)sysconf(_SC_NPROCESSORS_ONLN));
+#else
+    return (1);
+#endif
+}
+
+static void*
+event_loop_thread(void* arg)
+{
+    struct event_loop* loop = arg;
+    struct event_loop_group* group = loop->group;
+    struct event_base* base;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if (loop->cpu != -1) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(loop->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            event_warnx("%s: cannot pin to cpu %d", __func__, loop->cpu);
+    }
+#endif
+
+    /* allocated here, after pinning, so that it is local to the node */
+    base = event_base_new();
+    if (event_base_notify_init(base, 1) == -1) {
+        event_base_free(base);
+        base = NULL;
+    }
+
+#ifdef EVENT_HAVE_THREAD_LOCAL
+    /* so that event_set() and friends work on this thread */
+    current_base = base;
+#endif
+
+    pthread_mutex_lock(&group->lock);
+    loop->base = base;
+    group->nready++;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+
+    if (base != NULL && event_base_dispatch(base) == -1)
+        event_warn("%s: event_base_dispatch", __func__);
+
+    return (NULL);
+}
+
+struct event_loop_group*
+event_loop_group_new(int nloops, int flags)
+{
+    struct event_loop_group* group;
+    int* cpus = NULL;
+    int ncpus = 0, i;
+
+    if (nloops <= 0 && (nloops = event_cpu_count()) <= 0)
+        nloops = 1;
+
+    if ((group = mm_calloc(1, sizeof(struct event_loop_group))) == NULL)
+        return (NULL);
+    if ((group->loops = mm_calloc(nloops, sizeof(struct event_loop))) == NULL) {
+        mm_free(group);
+        return (NULL);
+    }
+    group->nloops = nloops;
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->cond, NULL);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if ((flags & EVENT_LOOP_GROUP_PIN) &&
+        (cpus = mm_calloc(CPU_SETSIZE, sizeof(int))) != NULL)
+        ncpus = event_cpu_order(cpus, CPU_SETSIZE);
+#endif
+
+    /*
+     * One at a time: creating an event_base touches global state, and
+     * a group that cannot start all its loops is not handed out.
+     */
+    for (i = 0; i < nloops; ++i) {
+        struct event_loop* loop = &group->loops[i];
+
+        loop->group = group;
+        loop->cpu = ncpus ? cpus[i % ncpus] : -1;
+        if (pthread_create(&loop->thread, NULL,
+                           event_loop_thread, loop) != 0) {
+            event_warn("%s: pthread_create", __func__);
+            break;
+        }
+        group->nstarted++;
+
+        pthread_mutex_lock(&group->lock);
+        while (group->nready == i)
+            pthread_cond_wait(&group->cond, &group->lock);
+        pthread_mutex_unlock(&group->lock);
+
+        if (loop->base == NULL)
+            break;
+    }
+
+    if (cpus != NULL)
+        mm_free(cpus);
+
+    if (i < nloops) {
+        event_loop_group_free(group);
+        return (NULL);
+    }
+
+    return (group);
+}
+
+int
+event_loop_group_size(struct event_loop_group* group)
+{
+    return (group->nloops);
+}
+
+struct event_base*
+event_loop_group_get_base(struct event_loop_group* group, int i)
+{
+    if (i < 0 || i >= group->nloops)
+        return (NULL);
+    return (group->loops[i].base);
+}
+
+static struct event_loop*
+event_loop_group_find(struct event_loop_group* group, struct event_base* base)
+{
+    int i;
+
+    for (i = 0; i < group->nloops; ++i) {
+        if (group->loops[i].base == base)
+            return (&group->loops[i]);
+    }
+    return (NULL);
+}
+
+struct event_base*
+event_loop_group_pick(struct event_loop_group* group,
+                      enum event_loop_policy policy)
+{
+    struct event_loop* loop;
+    int i, best;
+
+    pthread_mutex_lock(&group->lock);
+    best = group->next;
+    if (policy == EVENT_LOOP_LEAST_CONNECTIONS) {
+        /* start after the last pick so that ties are spread out */
+        for (i = 1; i < group->nloops; ++i) {
+            int j = (group->next + i) % group->nloops;
+            if (group->loops[j].nconns < group->loops[best].nconns)
+                best = j;
+        }
+    }
+    group->next = (best + 1) % group->nloops;
+    loop = &group->loops[best];
+    loop->nconns++;
+    pthread_mutex_unlock(&group->lock);
+
+    return (loop->base);
+}
+
+void
+event_loop_group_release(struct event_loop_group* group,
+                         struct event_base* base)
+{
+    struct event_loop* loop;
+
+    pthread_mutex_lock(&group->lock);
+    if ((loop = event_loop_group_find(group, base)) != NULL &&
+        loop->nconns > 0)
+        loop->nconns--;
+    pthread_mutex_unlock(&group->lock);
+}
+
+int
+event_loop_group_get_load(struct event_loop_group* group, int i)
+{
+    int nconns;
+
+    if (i < 0 || i >= group->nloops)
+        return (-1);
+    pthread_mutex_lock(&group->lock);
+    nconns = group->loops[i].nconns;
+    pthread_mutex_unlock(&group->lock);
+    return (nconns);
+}
+
+struct event_loop_assign {
+    struct event_base* base;
+    int fd;
+    void (*cb)(struct event_base*, int, void*);
+    void* arg;
+};
+
+static void
+event_loop_assign_cb(void* arg)
+{
+    struct event_loop_assign* assign = arg;
+
+    (*assign->cb)(assign->base, assign->fd, assign->arg);
+    mm_free(assign);
+}
+
+struct event_base*
+event_loop_group_assign(struct event_loop_group* group,
+                        enum event_loop_policy policy, int fd,
+                        void (*cb)(struct event_base*, int, void*), void* arg)
+{
+    struct event_loop_assign* assign;
+    struct event_base* base;
+
+    if ((assign = mm_malloc(sizeof(struct event_loop_assign))) == NULL)
+        return (NULL);
+    base = event_loop_group_pick(group, policy);
+    assign->base = base;
+    assign->fd = fd;
+    assign->cb = cb;
+    assign->arg = arg;
+
+    /* once posted, the loop thread may run and free assign at any time */
+    if (event_base_post(base, event_loop_assign_cb, assign) == -1) {
+        event_loop_group_release(group, base);
+        mm_free(assign);
+        return (NULL);
+    }
+
+    return (base);
+}
+
+struct event_loop_run {
+    struct event_loop_group* group;
+    struct event_base* base;
+    void (*cb)(struct event_base*, void*);
+    void* arg;
+    int* ndone;
+};
+
+static void
+event_loop_run_cb(void* arg)
+{
+    struct event_loop_run* run = arg;
+    struct event_loop_group* group = run->group;
+
+    (*run->cb)(run->base, run->arg);
+
+    pthread_mutex_lock(&group->lock);
+    (*run->ndone)++;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+}
+
+int
+event_loop_group_run_on_each(struct event_loop_group* group,
+                             void (*cb)(struct event_base*, void*), void* arg)
+{
+    struct event_loop_run* runs;
+    int i, nposted = 0, ndone = 0, res = 0;
+
+    if (group->stopped)
+        return (-1);
+    if ((runs = mm_calloc(group->nloops, sizeof(*runs))) == NULL)
+        return (-1);
+
+    for (i = 0; i < group->nloops; ++i) {
+        runs[i].group = group;
+        runs[i].base = group->loops[i].base;
+        runs[i].cb = cb;
+        runs[i].arg = arg;
+        runs[i].ndone = &ndone;
+        if (event_base_post(runs[i].base, event_loop_run_cb, &runs[i]) == -1)
+            res = -1;
+        else
+            ++nposted;
+    }
+
+    pthread_mutex_lock(&group->lock);
+    while (ndone < nposted)
+        pthread_cond_wait(&group->cond, &group->lock);
+    pthread_mutex_unlock(&group->lock);
+
+    mm_free(runs);
+    return (res);
+}
+
+static void
+event_loop_stop_cb(void* arg)
+{
+    struct event_loop* loop = arg;
+
+    event_base_loopexit(loop->base, loop->group->stop_tvp);
+}
+
+int
+event_loop_group_stop(struct event_loop_group* group, const struct timeval* tv)
+{
+    int i;
+
+    if (group->stopped)
+        return (0);
+    group->stopped = 1;
+
+    if (tv != NULL) {
+        group->stop_tv = *tv;
+        group->stop_tvp = &group->stop_tv;
+    }
+
+    for (i = 0; i < group->nstarted; ++i) {
+        struct event_loop* loop = &group->loops[i];
+        if (loop->base != NULL)
+            event_base_post(loop->base, event_loop_stop_cb, loop);
+    }
+    for (i = 0; i < group->nstarted; ++i)
+        pthread_join(group->loops[i].thread, NULL);
+
+    return (0);
+}
+
+void
+event_loop_group_free(struct event_loop_group* group)
+{
+    int i;
+
+    event_loop_group_stop(group, NULL);
+
+    for (i = 0; i < group->nloops; ++i) {
+        if (group->loops[i].base != NULL)
+            event_base_free(group->loops[i].base);
+    }
+    pthread_cond_destroy(&group->cond);
+    pthread_mutex_destroy(&group->lock);
+    mm_free(group->loops);
+    mm_free(group);
+}
+
+/*
+ * Work pools.  Every worker has a queue of its own; it takes its newest
+ * job from the tail, and when it runs dry it steals the oldest job from
+ * the head of another queue.  Finished jobs go back to their base with
+ * event_base_post().
+ */
+
+struct event_work {
+    TAILQ_ENTRY(event_work) next;
+    struct event_base* base;
+    void (*work)(void*);
+    void (*done)(void*);
+    void* arg;
+};
+
+TAILQ_HEAD(event_work_list, event_work);
+
+struct event_worker {
+    struct event_work_pool* pool;
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects jobs */
+    struct event_work_list jobs;
+};
+
+struct event_work_pool {
+    struct event_worker* workers;
+    int nworkers;
+    int nstarted;               /* threads that are running */
+
+    /* counted with event_work_add(), without the lock */
+    int nqueued;                /* jobs in all queues together */
+    int nidle;                  /* workers that are going to sleep */
+    int next;                   /* queue of the next job from outside */
+
+    pthread_mutex_t lock;       /* for sleeping on cond, and stopping */
+    pthread_cond_t cond;        /* signaled when a job is queued */
+    int stopping;
+};
+
+/*
+ * Submitting and taking jobs only touch the counters, so workers and
+ * submitters meet on the pool lock only when a worker goes to sleep or
+ * has to be woken.  A submitter counts its job before it looks for idle
+ * workers, and a worker counts itself idle before it looks for jobs, so
+ * one of them always sees the other.
+ */
+#if defined(__GNUC__)
+#define event_work_add(p, n)    __atomic_add_fetch((p), (n), __ATOMIC_SEQ_CST)
+#define event_work_get(p)       __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#else
+static pthread_mutex_t event_work_count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+event_work_add(int* p, int n)
+{
+    int res;
+
+    pthread_mutex_lock(&event_work_count_lock);
+    res = *p = (int)((unsigned)*p + n);
+    pthread_mutex_unlock(&event_work_count_lock);
+    return (res);
+}
+#define event_work_get(p)       event_work_add((p), 0)
+#endif
+
+/* the worker the calling thread is, if any */
+static pthread_key_t event_worker_key;
+static pthread_once_t event_worker_once = PTHREAD_ONCE_INIT;
+
+static void
+event_worker_key_init(void)
+{
+    pthread_key_create(&event_worker_key, NULL);
+}
+
+static struct event_work*
+event_worker_take(struct event_worker* worker)
+{
+    struct event_work_pool* pool = worker->pool;
+    struct event_work* job;
+    int i;
+
+    pthread_mutex_lock(&worker->lock);
+    if ((job = TAILQ_LAST(&worker->jobs, event_work_list)) != NULL)
+        TAILQ_REMOVE(&worker->jobs, job, next);
+    pthread_mutex_unlock(&worker->lock);
+
+    /* start with the neighbour so that thieves spread out */
+    for (i = 1; job == NULL && i < pool->nworkers; ++i) {
+        struct event_worker* victim =
+            &pool->workers[(worker - pool->workers + i) % pool->nworkers];
+
+        pthread_mutex_lock(&victim->lock);
+        if ((job = TAILQ_FIRST(&victim->jobs)) != NULL)
+            TAILQ_REMOVE(&victim->jobs, job, next);
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (job != NULL)
+        event_work_add(&pool->nqueued, -1);
+
+    return (job);
+}
+
+static void
+event_work_done_cb(void* arg)
+{
+    struct event_work* job = arg;
+
+    event_base_notify_wait(job->base, -1);
+    (*job->done)(job->arg);
+    mm_free(job);
+}
+
+static void*
+event_worker_thread(void* arg)
+{
+    struct event_worker* worker = arg;
+    struct event_work_pool* pool = worker->pool;
+    struct event_work* job;
+
+    pthread_setspecific(event_worker_key, worker);
+
+    for (;;) {
+        if ((job = event_worker_take(worker)) != NULL) {
+            (*job->work)(job->arg);
+            if (job->done == NULL) {
+                mm_free(job);
+            } else if (event_base_post(job->base,
+                                       event_work_done_cb, job) == -1) {
+                /* do not let the loop wait for it forever */
+                event_base_notify_wait(job->base, -1);
+                mm_free(job);
+            }
+            continue;
+        }
+
+        /* a job taken before it was counted leaves nqueued below 0 */
+        pthread_mutex_lock(&pool->lock);
+        event_work_add(&pool->nidle, 1);
+        while (event_work_get(&pool->nqueued) <= 0 && !pool->stopping)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        event_work_add(&pool->nidle, -1);
+        if (event_work_get(&pool->nqueued) <= 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return (NULL);
+}
+
+struct event_work_pool*
+event_work_pool_new(int nworkers)
+{
+    struct event_work_pool* pool;
+    int i;
+
+    if (nworkers <= 0 && (nworkers = event_cpu_count()) <= 0)
+        nworkers = 1;
+
+    pthread_once(&event_worker_once, event_worker_key_init);
+
+    if ((pool = mm_calloc(1, sizeof(struct event_work_pool))) == NULL)
+        return (NULL);
+    if ((pool->workers = mm_calloc(nworkers,
+                                   sizeof(struct event_worker))) == NULL) {
+        mm_free(pool);
+        return (NULL);
+    }
+    pool->nworkers = nworkers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (i = 0; i < nworkers; ++i) {
+        struct event_worker* worker = &pool->workers[i];
+
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        TAILQ_INIT(&worker->jobs);
+    }
+
+    for (i = 0; i < nworkers; ++i) {
+        if (pthread_create(&pool->workers[i].thread, NULL,
+                           event_worker_thread, &pool->workers[i]) != 0) {
+            event_warn("%s: pthread_create", __func__);
+            event_work_pool_free(pool);
+            return (NULL);
+        }
+        pool->nstarted++;
+    }
+
+    return (pool);
+}
+
+int
+event_work_submit(struct event_work_pool* pool, struct event_base* base,
+                  void (*work)(void*), void (*done)(void*), void* arg)
+{
+    struct event_worker* worker;
+    struct event_work* job;
+
+    if (done != NULL && (base == NULL || base->notify == NULL))
+        return (-1);
+
+    if ((job = mm_malloc(sizeof(struct event_work))) == NULL) {
+        event_warn("%s: malloc", __func__);
+        return (-1);
+    }
+    job->base = base;
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+
+    if (done != NULL)
+        event_base_notify_wait(base, 1);
+
+    /* a worker keeps what it submits itself, while it is hot */
+    worker = pthread_getspecific(event_worker_key);
+    if (worker == NULL || worker->pool != pool) {
+        unsigned i = event_work_add(&pool->next, 1);
+        worker = &pool->workers[i % pool->nworkers];
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    TAILQ_INSERT_TAIL(&worker->jobs, job, next);
+    pthread_mutex_unlock(&worker->lock);
+
+    event_work_add(&pool->nqueued, 1);
+    if (event_work_get(&pool->nidle) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return (0);
+}
+
+void
+event_work_pool_free(struct event_work_pool* pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nstarted; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (i = 0; i < pool->nworkers; ++i)
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    mm_free(pool->workers);
+    mm_free(pool);
+}
+
+#else /* !HAVE_PTHREAD */
+
+int
+event_base_notify_init(struct event_base* base, int keepalive)
+{
+    return (-1);
+}
+
+void
+event_base_notify_free(struct event_base* base)
+{
+}
+
+int
+event_base_make_notifiable(struct event_base* base)
+{
+    return (-1);
+}
+
+int
+event_base_notify_waiting(struct event_base* base)
+{
+    return (0);
+}
+
+int
+event_base_post(struct event_base* base, void (*cb)(void*), void* arg)
+{
+    return (-1);
+}
+
+struct event_loop_group*
+event_loop_group_new(int nloops, int flags)
+{
+    event_warnx("%s: built without thread support", __func__);
+    return (NULL);
+}
+
+int
+event_loop_group_size(struct event_loop_group* group)
+{
+    return (0);
+}
+
+struct event_base*
+event_loop_group_get_base(struct event_loop_group* group, int i)
+{
+    return (NULL);
+}
+
+struct event_base*
+event_loop_group_pick(struct event_loop_group* group,
+                      enum event_loop_policy policy)
+{
+    return (NULL);
+}
+
+void
+event_loop_group_release(struct event_loop_group* group,
+                         struct event_base* base)
+{
+}
+
+int
+event_loop_group_get_load(struct event_loop_group* group, int i)
+{
+    return (-1);
+}
+
+struct event_base*
+event_loop_group_assign(struct event_loop_group* group,
+                        enum event_loop_policy policy, int fd,
+                        void (*cb)(struct event_base*, int, void*), void* arg)
+{
+    return (NULL);
+}
+
+int
+event_loop_group_run_on_each(struct event_loop_group* group,
+                             void (*cb)(struct event_base*, void*), void* arg)
+{
+    return (-1);
+}
+
+int
+event_loop_group_stop(struct event_loop_group* group, const struct timeval* tv)
+{
+    return (-1);
+}
+
+void
+event_loop_group_free(struct event_loop_group* group)
+{
+}
+
+struct event_work_pool*
+event_work_pool_new(int nworkers)
+{
+    event_warnx("%s: built without thread support", __func__);
+    return (NULL);
+}
+
+int
+event_work_submit(struct event_work_pool* pool, struct event_base* base,
+                  void (*work)(void*), void (*done)(void*), void* arg)
+{
+    return (-1);
+}
+
+void
+event_work_pool_free(struct event_work_pool* pool)
+{
+}
+
+#endif /* HAVE_PTHREAD */
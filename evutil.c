@@ -183,6 +183,22 @@ evutil_make_socket_nonblocking(int fd)
     return 0;
 }
 
+/* Let the kernel poll the device queue for up to usec on reads */
+int
+evutil_make_socket_busy_poll(int fd, int usec)
+{
+#ifdef SO_BUSY_POLL
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                   (void*)&usec, sizeof(usec)) == -1) {
+        event_debug(("%s: setsockopt(%d, SO_BUSY_POLL)", __func__, fd));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 ev_int64_t
 evutil_strtoll(const char* s, char** endptr, int base)
 {
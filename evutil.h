@@ -100,6 +100,7 @@ extern "C" {
 
 int evutil_socketpair(int d, int type, int protocol, int sv[2]);
 int evutil_make_socket_nonblocking(int sock);
+int evutil_make_socket_busy_poll(int sock, int usec);
 #ifdef WIN32
 #define EVUTIL_CLOSESOCKET(s) closesocket(s)
 #else
@@ -33,6 +33,7 @@ enum evhttp_connection_error {
 struct evbuffer;
 struct addrinfo;
 struct evhttp_request;
+struct evhttp_connect;
 
 /* A stupid connection object - maybe make this a bufferevent later */
 
@@ -74,14 +75,18 @@ struct evhttp_connection {
 #define EVHTTP_CON_INCOMING 0x0001  /* only one request on it ever */
 #define EVHTTP_CON_OUTGOING 0x0002  /* multiple requests possible */
 #define EVHTTP_CON_CLOSEDETECT  0x0004  /* detecting if persistent close */
+#define EVHTTP_CON_CORKED   0x0008  /* writes wait for the uncork */
+#define EVHTTP_CON_CORKWRITE    0x0010  /* a write waits for the uncork */
     // ʱӳԴԴ
 
     // timeoutĬΪ0ʱ
-    int timeout;            /* timeout in seconds for events */
+    struct timeval timeout; /* timeout for events, tv_sec -1 for default */
     // Ĭϲ
     int retry_cnt;          /* retry count */
     int retry_max;          /* maximum number of retries */
 
+    size_t body_spill;      /* bodies larger than this go to disk */
+
     // ǰconnection״̬
     enum evhttp_connection_state state;
 
@@ -97,6 +102,9 @@ struct evhttp_connection {
 
     void (*closecb)(struct evhttp_connection*, void*);
     void* closecb_arg;
+
+    struct deferred_cb* uncork; /* ends the cork with the loop iteration */
+    struct evhttp_connect* connect; /* state while connecting */
     // ӹĸevent loop
     struct event_base* base;
 };
@@ -126,7 +134,8 @@ struct evhttp {
     TAILQ_HEAD(httpcbq, evhttp_cb) callbacks;
     struct evconq connections;
     // Ĭϳʱֵ
-    int timeout;
+    struct timeval timeout;
+    size_t body_spill;      /* see evhttp_set_body_spill() */
     // ĬϵuriصҲreqĻصgencbᱻã404 Not Found֮
     void (*gencb)(struct evhttp_request* req, void*);
     void* gencbarg;
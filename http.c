@@ -54,6 +54,7 @@
 
 #ifndef WIN32
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #endif
 
@@ -86,8 +87,11 @@
 #include "event.h"
 #include "evhttp.h"
 #include "evutil.h"
+#include "evdns.h"
 #include "log.h"
+#include "event-internal.h"
 #include "http-internal.h"
+#include "mm-internal.h"
 
 #ifdef WIN32
 #define strcasecmp _stricmp
@@ -172,7 +176,7 @@ fake_getaddrinfo(const char* hostname, struct addrinfo* ai)
     ai->ai_socktype = SOCK_STREAM;
     ai->ai_protocol = 0;
     ai->ai_addrlen = sizeof(struct sockaddr_in);
-    if (NULL == (ai->ai_addr = malloc(ai->ai_addrlen)))
+    if (NULL == (ai->ai_addr = mm_malloc(ai->ai_addrlen)))
         return (-1);
     sa = (struct sockaddr_in*)ai->ai_addr;
     memset(sa, 0, ai->ai_addrlen);
@@ -189,7 +193,7 @@ fake_getaddrinfo(const char* hostname, struct addrinfo* ai)
 static void
 fake_freeaddrinfo(struct addrinfo* ai)
 {
-    free(ai->ai_addr);
+    mm_free(ai->ai_addr);
 }
 #endif
 
@@ -204,9 +208,10 @@ fake_freeaddrinfo(struct addrinfo* ai)
 
 extern int debug;
 
-static int socket_connect(int fd, const char* address, unsigned short port);
-static int bind_socket_ai(struct addrinfo*, int reuse);
+static int socket_connect_sa(int fd, struct sockaddr* sa, socklen_t salen);
+static int bind_socket_ai(struct addrinfo*, int family, int reuse);
 static int bind_socket(const char*, u_short, int reuse);
+static struct addrinfo* make_addrinfo(const char* address, u_short port);
 static void name_from_addr(struct sockaddr*, socklen_t, char**, char**);
 static int evhttp_associate_new_request_with_connection(
     struct evhttp_connection* evcon);
@@ -215,6 +220,7 @@ static void evhttp_connection_start_detectclose(
 static void evhttp_connection_stop_detectclose(
     struct evhttp_connection* evcon);
 static void evhttp_request_dispatch(struct evhttp_connection* evcon);
+static void evhttp_connection_cancel_connect(struct evhttp_connection* evcon);
 static void evhttp_read_firstline(struct evhttp_connection* evcon,
                                   struct evhttp_request* req);
 static void evhttp_read_header(struct evhttp_connection* evcon,
@@ -290,9 +296,9 @@ evhttp_htmlescape(const char* html)
     for (i = 0; i < old_size; ++i)
         new_size += strlen(html_replace(html[i], scratch_space));
 
-    p = escaped_html = malloc(new_size + 1);
+    p = escaped_html = mm_malloc(new_size + 1);
     if (escaped_html == NULL)
-        event_err(1, "%s: malloc(%d)", __func__, new_size + 1);
+        event_err(1, "%s: mm_malloc(%d)", __func__, new_size + 1);
     for (i = 0; i < old_size; ++i) {
         const char* replaced = html_replace(html[i], scratch_space);
         /* this is length checked */
@@ -330,14 +336,17 @@ evhttp_method(enum evhttp_cmd_type type)
 
 // 将event加入event loop，timeout表示计时器
 static void
-evhttp_add_event(struct event* ev, int timeout, int default_timeout)
+evhttp_add_event(struct event* ev, const struct timeval* timeout,
+                 int default_timeout)
 {
-    if (timeout != 0) {
+    if (timeout->tv_sec == -1) {
         struct timeval tv;
 
         evutil_timerclear(&tv);
-        tv.tv_sec = timeout != -1 ? timeout : default_timeout;
+        tv.tv_sec = default_timeout;
         event_add(ev, &tv);
+    } else if (evutil_timerisset(timeout)) {
+        event_add(ev, timeout);
     } else {
         event_add(ev, NULL);
     }
@@ -354,6 +363,11 @@ evhttp_write_buffer(struct evhttp_connection* evcon,
     evcon->cb = cb;
     evcon->cb_arg = arg;
 
+    if (evcon->flags & EVHTTP_CON_CORKED) {
+        evcon->flags |= EVHTTP_CON_CORKWRITE;
+        return;
+    }
+
     /* check if the event is already pending */
     // 如果已经在event loop中，删除重新添加
     if (event_pending(&evcon->ev, EV_WRITE | EV_TIMEOUT, NULL))
@@ -361,7 +375,57 @@ evhttp_write_buffer(struct evhttp_connection* evcon,
 
     event_set(&evcon->ev, evcon->fd, EV_WRITE, evhttp_write, evcon);
     EVHTTP_BASE_SET(evcon, &evcon->ev);
-    evhttp_add_event(&evcon->ev, evcon->timeout, HTTP_WRITE_TIMEOUT);
+    evhttp_add_event(&evcon->ev, &evcon->timeout, HTTP_WRITE_TIMEOUT);
+}
+
+/*
+ * A corked connection holds back its writes until the end of the loop
+ * iteration, so that a reply header and the chunks sent after it leave
+ * in as few writes as possible.
+ */
+static void
+evhttp_connection_uncork(struct evhttp_connection* evcon)
+{
+    int held = evcon->flags & EVHTTP_CON_CORKWRITE;
+
+    if (!(evcon->flags & EVHTTP_CON_CORKED))
+        return;
+
+    evcon->flags &= ~(EVHTTP_CON_CORKED | EVHTTP_CON_CORKWRITE);
+    event_deferred_cb_cancel(evcon->uncork);
+
+    if (!held)
+        return;
+
+    /* a write that was pending before may have taken everything */
+    if (EVBUFFER_LENGTH(evcon->output_buffer) != 0)
+        evhttp_write_buffer(evcon, evcon->cb, evcon->cb_arg);
+    else if (evcon->cb != NULL)
+        (*evcon->cb)(evcon, evcon->cb_arg);
+}
+
+static void
+evhttp_connection_uncork_cb(struct deferred_cb* dcb, void* arg)
+{
+    evhttp_connection_uncork(arg);
+}
+
+static void
+evhttp_connection_cork(struct evhttp_connection* evcon)
+{
+    if ((evcon->flags & EVHTTP_CON_CORKED) || evcon->ev.ev_base == NULL)
+        return;
+
+    if (evcon->uncork == NULL) {
+        if ((evcon->uncork = mm_malloc(sizeof(struct deferred_cb))) == NULL)
+            return;
+        event_deferred_cb_init(evcon->uncork,
+                               evhttp_connection_uncork_cb, evcon);
+    }
+
+    /* a write that is already scheduled goes ahead */
+    evcon->flags |= EVHTTP_CON_CORKED;
+    event_deferred_cb_schedule(evcon->ev.ev_base, evcon->uncork);
 }
 
 static int
@@ -642,7 +706,7 @@ evhttp_connection_incoming_fail(struct evhttp_request* req,
     default:    /* xxx: probably should just error on default */
         /* the callback looks at the uri to determine errors */
         if (req->uri) {
-            free(req->uri);
+            mm_free(req->uri);
             req->uri = NULL;
         }
 
@@ -729,7 +793,7 @@ evhttp_write(int fd, short what, void* arg)
     // 还有数据要写
     if (EVBUFFER_LENGTH(evcon->output_buffer) != 0) {
         evhttp_add_event(&evcon->ev,
-                         evcon->timeout, HTTP_WRITE_TIMEOUT);
+                         &evcon->timeout, HTTP_WRITE_TIMEOUT);
         return;
     }
     // 写完之后调用evhttp_write_connectioncb
@@ -832,14 +896,14 @@ evhttp_handle_chunked_read(struct evhttp_request* req, struct evbuffer* buf)
                 break;
             /* the last chunk is on a new line? */
             if (strlen(p) == 0) {
-                free(p);
+                mm_free(p);
                 continue;
             }
             ntoread = evutil_strtoll(p, &endp, 16);
             error = (*p == '\0' ||
                      (*endp != '\0' && *endp != ' ') ||
                      ntoread < 0);
-            free(p);
+            mm_free(p);
             if (error) {
                 /* could not get chunk size */
                 return (DATA_CORRUPTED);
@@ -853,8 +917,15 @@ evhttp_handle_chunked_read(struct evhttp_request* req, struct evbuffer* buf)
         }
 
         /* don't have enough to complete a chunk; wait for more */
-        if (len < req->ntoread)
+        if (len < req->ntoread) {
+            /* nobody looks at single chunks, so pass on what we have */
+            if (req->chunk_cb == NULL) {
+                evbuffer_add(req->input_buffer, EVBUFFER_DATA(buf), len);
+                evbuffer_drain(buf, len);
+                req->ntoread -= len;
+            }
             return (MORE_DATA_EXPECTED);
+        }
 
         /* Completed chunk */
         evbuffer_add(req->input_buffer,
@@ -886,7 +957,7 @@ evhttp_read_trailer(struct evhttp_connection* evcon, struct evhttp_request* req)
         break;
     case MORE_DATA_EXPECTED:
     default:
-        evhttp_add_event(&evcon->ev, evcon->timeout,
+        evhttp_add_event(&evcon->ev, &evcon->timeout,
                          HTTP_READ_TIMEOUT);
         break;
     }
@@ -920,19 +991,24 @@ evhttp_read_body(struct evhttp_connection* evcon, struct evhttp_request* req)
     } else if (req->ntoread < 0) {
         /* Read until connection close. */
         evbuffer_add_buffer(req->input_buffer, buf);
-    } else if (EVBUFFER_LENGTH(buf) >= req->ntoread) {
-        /* Completed content length */
-        evbuffer_add(req->input_buffer, EVBUFFER_DATA(buf),
-                     (size_t)req->ntoread);
-        evbuffer_drain(buf, (size_t)req->ntoread);
-        req->ntoread = 0;
-        evhttp_connection_done(evcon);
-        return;
+    } else {
+        /* move the body over as it arrives, so it can go to disk */
+        size_t n = EVBUFFER_LENGTH(buf);
+        if ((ev_int64_t)n > req->ntoread)
+            n = (size_t)req->ntoread;
+        evbuffer_add(req->input_buffer, EVBUFFER_DATA(buf), n);
+        evbuffer_drain(buf, n);
+        req->ntoread -= n;
+        if (req->ntoread == 0) {
+            /* Completed content length */
+            evhttp_connection_done(evcon);
+            return;
+        }
     }
     /* Read more! */
     event_set(&evcon->ev, evcon->fd, EV_READ, evhttp_read, evcon);
     EVHTTP_BASE_SET(evcon, &evcon->ev);
-    evhttp_add_event(&evcon->ev, evcon->timeout, HTTP_READ_TIMEOUT);
+    evhttp_add_event(&evcon->ev, &evcon->timeout, HTTP_READ_TIMEOUT);
 }
 
 /*
@@ -955,7 +1031,7 @@ evhttp_read(int fd, short what, void* arg)
         return;
     }
     // 从socket读
-    n = evbuffer_read(buf, fd, -1);
+    n = evbuffer_read_pooled(buf, evcon->ev.ev_base, fd, -1);
     len = EVBUFFER_LENGTH(buf);
     event_debug(("%s: got %d on %d\n", __func__, n, fd));
 
@@ -965,7 +1041,7 @@ evhttp_read(int fd, short what, void* arg)
             evhttp_connection_fail(evcon, EVCON_HTTP_EOF);
         } else {
             // read的时候产生中断，继续读
-            evhttp_add_event(&evcon->ev, evcon->timeout,
+            evhttp_add_event(&evcon->ev, &evcon->timeout,
                              HTTP_READ_TIMEOUT);
         }
         return;
@@ -1051,14 +1127,21 @@ evhttp_connection_free(struct evhttp_connection* evcon)
     if (event_initialized(&evcon->ev))
         event_del(&evcon->ev);
 
+    if (evcon->uncork != NULL) {
+        event_deferred_cb_cancel(evcon->uncork);
+        mm_free(evcon->uncork);
+    }
+
+    evhttp_connection_cancel_connect(evcon);
+
     if (evcon->fd != -1)
         EVUTIL_CLOSESOCKET(evcon->fd);
 
     if (evcon->bind_address != NULL)
-        free(evcon->bind_address);
+        mm_free(evcon->bind_address);
 
     if (evcon->address != NULL)
-        free(evcon->address);
+        mm_free(evcon->address);
 
     if (evcon->input_buffer != NULL)
         evbuffer_free(evcon->input_buffer);
@@ -1066,7 +1149,7 @@ evhttp_connection_free(struct evhttp_connection* evcon)
     if (evcon->output_buffer != NULL)
         evbuffer_free(evcon->output_buffer);
 
-    free(evcon);
+    mm_free(evcon);
 }
 
 void
@@ -1075,8 +1158,8 @@ evhttp_connection_set_local_address(struct evhttp_connection* evcon,
 {
     assert(evcon->state == EVCON_DISCONNECTED);
     if (evcon->bind_address)
-        free(evcon->bind_address);
-    if ((evcon->bind_address = strdup(address)) == NULL)
+        mm_free(evcon->bind_address);
+    if ((evcon->bind_address = mm_strdup(address)) == NULL)
         event_err(1, "%s: strdup", __func__);
 }
 
@@ -1129,12 +1212,17 @@ evhttp_connection_reset(struct evhttp_connection* evcon)
         EVUTIL_CLOSESOCKET(evcon->fd);
         evcon->fd = -1;
     }
+    evhttp_connection_cancel_connect(evcon);
     evcon->state = EVCON_DISCONNECTED;
+    if (evcon->flags & EVHTTP_CON_CORKED)
+        event_deferred_cb_cancel(evcon->uncork);
+    evcon->flags &= ~(EVHTTP_CON_CORKED | EVHTTP_CON_CORKWRITE);
     // 清零缓冲区
     evbuffer_drain(evcon->input_buffer,
                    EVBUFFER_LENGTH(evcon->input_buffer));
     evbuffer_drain(evcon->output_buffer,
                    EVBUFFER_LENGTH(evcon->output_buffer));
+    evbuffer_release_pooled(evcon->input_buffer);
 }
 
 static void
@@ -1155,6 +1243,9 @@ evhttp_connection_start_detectclose(struct evhttp_connection* evcon)
               evhttp_detect_close_cb, evcon);
     EVHTTP_BASE_SET(evcon, &evcon->close_ev);
     event_add(&evcon->close_ev, NULL);
+
+    /* the connection is idle; do not hold on to receive storage */
+    evbuffer_release_pooled(evcon->input_buffer);
 }
 
 static void
@@ -1174,59 +1265,25 @@ evhttp_connection_retry(int fd, short what, void* arg)
 }
 
 /*
- * Call back for asynchronous connection attempt.
+ * A connection attempt failed or timed out: schedule a retry, or give up
+ * and fail all requests that were waiting for the connection.
  */
-// 连接之后，发送一个EV_WRITE事件之后的回调，此时connection状态变为EVCON_IDLE
-// 然后调用evhttp_request_dispatch发送一个req
 static void
-evhttp_connectioncb(int fd, short what, void* arg)
+evhttp_connection_connect_failed(struct evhttp_connection* evcon)
 {
-    struct evhttp_connection* evcon = arg;
-    int error;
-    socklen_t errsz = sizeof(error);
-
-    if (what == EV_TIMEOUT) {
-        event_debug(("%s: connection timeout for \"%s:%d\" on %d",
-                     __func__, evcon->address, evcon->port, evcon->fd));
-        goto cleanup;
-    }
+    evhttp_connection_cancel_connect(evcon);
+    event_del(&evcon->ev);
 
-    /* Check if the connection completed */
-    if (getsockopt(evcon->fd, SOL_SOCKET, SO_ERROR, (void*)&error,
-                   &errsz) == -1) {
-        event_debug(("%s: getsockopt for \"%s:%d\" on %d",
-                     __func__, evcon->address, evcon->port, evcon->fd));
-        goto cleanup;
-    }
-
-    if (error) {
-        event_debug(("%s: connect failed for \"%s:%d\" on %d: %s",
-                     __func__, evcon->address, evcon->port, evcon->fd,
-                     strerror(error)));
-        goto cleanup;
-    }
-
-    /* We are connected to the server now */
-    event_debug(("%s: connected to \"%s:%d\" on %d\n",
-                 __func__, evcon->address, evcon->port, evcon->fd));
-
-    /* Reset the retry count as we were successful in connecting */
-    evcon->retry_cnt = 0;
-    evcon->state = EVCON_IDLE;
-
-    /* try to start requests that have queued up on this connection */
-    evhttp_request_dispatch(evcon);
-    return;
-
-cleanup:
-    // 连接远端失败
     if (evcon->retry_max < 0 || evcon->retry_cnt < evcon->retry_max) {
+        struct timeval tv;
+
         evtimer_set(&evcon->ev, evhttp_connection_retry, evcon);
         EVHTTP_BASE_SET(evcon, &evcon->ev);
         // 这里的超时值是计时器，计时器触发的时候回调evhttp_connection_retry重新连接远端
         // 尝试次数越多，尝试连接的间隔就约大，为2的次幂递增
-        evhttp_add_event(&evcon->ev, MIN(3600, 2 << evcon->retry_cnt),
-                         HTTP_CONNECT_TIMEOUT);
+        evutil_timerclear(&tv);
+        tv.tv_sec = MIN(3600, 2 << evcon->retry_cnt);
+        evhttp_add_event(&evcon->ev, &tv, HTTP_CONNECT_TIMEOUT);
         evcon->retry_cnt++;
         return;
     }
@@ -1293,7 +1350,7 @@ evhttp_parse_response_line(struct evhttp_request* req, char* line)
         return (-1);
     }
 
-    if ((req->response_code_line = strdup(readable)) == NULL)
+    if ((req->response_code_line = mm_strdup(readable)) == NULL)
         event_err(1, "%s: strdup", __func__);
 
     return (0);
@@ -1344,7 +1401,7 @@ evhttp_parse_request_line(struct evhttp_request* req, char* line)
         return (-1);
     }
 
-    if ((req->uri = strdup(uri)) == NULL) {
+    if ((req->uri = mm_strdup(uri)) == NULL) {
         event_debug(("%s: strdup", __func__));
         return (-1);
     }
@@ -1380,9 +1437,9 @@ evhttp_clear_headers(struct evkeyvalq* headers)
          header != NULL;
          header = TAILQ_FIRST(headers)) {
         TAILQ_REMOVE(headers, header, next);
-        free(header->key);
-        free(header->value);
-        free(header);
+        mm_free(header->key);
+        mm_free(header->value);
+        mm_free(header);
     }
 }
 
@@ -1406,9 +1463,9 @@ evhttp_remove_header(struct evkeyvalq* headers, const char* key)
 
     /* Free and remove the header that we found */
     TAILQ_REMOVE(headers, header, next);
-    free(header->key);
-    free(header->value);
-    free(header);
+    mm_free(header->key);
+    mm_free(header->value);
+    mm_free(header);
 
     return (0);
 }
@@ -1452,19 +1509,19 @@ static int
 evhttp_add_header_internal(struct evkeyvalq* headers,
                            const char* key, const char* value)
 {
-    struct evkeyval* header = calloc(1, sizeof(struct evkeyval));
+    struct evkeyval* header = mm_calloc(1, sizeof(struct evkeyval));
     if (header == NULL) {
         event_warn("%s: calloc", __func__);
         return (-1);
     }
-    if ((header->key = strdup(key)) == NULL) {
-        free(header);
+    if ((header->key = mm_strdup(key)) == NULL) {
+        mm_free(header);
         event_warn("%s: strdup", __func__);
         return (-1);
     }
-    if ((header->value = strdup(value)) == NULL) {
-        free(header->key);
-        free(header);
+    if ((header->value = mm_strdup(value)) == NULL) {
+        mm_free(header->key);
+        mm_free(header);
         event_warn("%s: strdup", __func__);
         return (-1);
     }
@@ -1507,7 +1564,7 @@ evhttp_parse_firstline(struct evhttp_request* req, struct evbuffer* buffer)
         status = DATA_CORRUPTED;
     }
 
-    free(line);
+    mm_free(line);
     return (status);
 }
 
@@ -1524,7 +1581,7 @@ evhttp_append_to_last_header(struct evkeyvalq* headers, const char* line)
     old_len = strlen(header->value);
     line_len = strlen(line);
 
-    newval = realloc(header->value, old_len + line_len + 1);
+    newval = mm_realloc(header->value, old_len + line_len + 1);
     if (newval == NULL)
         return (-1);
 
@@ -1548,7 +1605,7 @@ evhttp_parse_headers(struct evhttp_request* req, struct evbuffer* buffer)
 
         if (*line == '\0') { /* Last header - Done */
             status = ALL_DATA_READ;
-            free(line);
+            mm_free(line);
             break;
         }
 
@@ -1556,7 +1613,7 @@ evhttp_parse_headers(struct evhttp_request* req, struct evbuffer* buffer)
         if (*line == ' ' || *line == '\t') {
             if (evhttp_append_to_last_header(headers, line) == -1)
                 goto error;
-            free(line);
+            mm_free(line);
             continue;
         }
 
@@ -1571,13 +1628,13 @@ evhttp_parse_headers(struct evhttp_request* req, struct evbuffer* buffer)
         if (evhttp_add_header(headers, skey, svalue) == -1)
             goto error;
 
-        free(line);
+        mm_free(line);
     }
 
     return (status);
 
 error:
-    free(line);
+    mm_free(line);
     return (DATA_CORRUPTED);
 }
 
@@ -1631,6 +1688,8 @@ evhttp_get_body(struct evhttp_connection* evcon, struct evhttp_request* req)
         return;
     }
     evcon->state = EVCON_READING_BODY;
+    if (evcon->body_spill != 0)
+        evbuffer_set_spill(req->input_buffer, evcon->body_spill);
     xfer_enc = evhttp_find_header(req->input_headers, "Transfer-Encoding");
     if (xfer_enc != NULL && strcasecmp(xfer_enc, "chunked") == 0) {
         req->chunked = 1;
@@ -1661,7 +1720,7 @@ evhttp_read_firstline(struct evhttp_connection* evcon,
     } else if (res == MORE_DATA_EXPECTED) {
         /* Need more header lines */
         evhttp_add_event(&evcon->ev,
-                         evcon->timeout, HTTP_READ_TIMEOUT);
+                         &evcon->timeout, HTTP_READ_TIMEOUT);
         return;
     }
 
@@ -1684,7 +1743,7 @@ evhttp_read_header(struct evhttp_connection* evcon, struct evhttp_request* req)
     } else if (res == MORE_DATA_EXPECTED) {
         /* Need more header lines */
         evhttp_add_event(&evcon->ev,
-                         evcon->timeout, HTTP_READ_TIMEOUT);
+                         &evcon->timeout, HTTP_READ_TIMEOUT);
         return;
     }
 
@@ -1734,7 +1793,7 @@ evhttp_connection_new(const char* address, unsigned short port)
 
     event_debug(("Attempting connection to %s:%d\n", address, port));
 
-    if ((evcon = calloc(1, sizeof(struct evhttp_connection))) == NULL) {
+    if ((evcon = mm_calloc(1, sizeof(struct evhttp_connection))) == NULL) {
         event_warn("%s: calloc failed", __func__);
         goto error;
     }
@@ -1742,10 +1801,11 @@ evhttp_connection_new(const char* address, unsigned short port)
     evcon->fd = -1;
     evcon->port = port;
 
-    evcon->timeout = -1;
+    evutil_timerclear(&evcon->timeout);
+    evcon->timeout.tv_sec = -1;
     evcon->retry_cnt = evcon->retry_max = 0;
 
-    if ((evcon->address = strdup(address)) == NULL) {
+    if ((evcon->address = mm_strdup(address)) == NULL) {
         event_warn("%s: strdup failed", __func__);
         goto error;
     }
@@ -1760,6 +1820,10 @@ evhttp_connection_new(const char* address, unsigned short port)
         goto error;
     }
 
+    /* one large body must not pin memory for the life of the connection */
+    evbuffer_set_shrink(evcon->input_buffer, EVBUFFER_SHRINK_THRESHOLD);
+    evbuffer_set_shrink(evcon->output_buffer, EVBUFFER_SHRINK_THRESHOLD);
+
     evcon->state = EVCON_DISCONNECTED;
     TAILQ_INIT(&evcon->requests);
 
@@ -1777,13 +1841,110 @@ void evhttp_connection_set_base(struct evhttp_connection* evcon,
     assert(evcon->base == NULL);
     assert(evcon->state == EVCON_DISCONNECTED);
     evcon->base = base;
+    evbuffer_set_pool(evcon->input_buffer, base);
+    evbuffer_set_pool(evcon->output_buffer, base);
+}
+
+struct evhttp_migration {
+    struct evhttp_connection* evcon;
+    struct event_base* base;
+    int detectclose;    /* close detection has to be started again */
+    void (*cb)(struct evhttp_connection*, void*);
+    void* arg;
+};
+
+static void
+evhttp_connection_migrate_attach(void* arg)
+{
+    struct evhttp_migration* mig = arg;
+    struct evhttp_connection* evcon = mig->evcon;
+
+    evcon->base = mig->base;
+    evbuffer_set_pool(evcon->input_buffer, mig->base);
+    evbuffer_set_pool(evcon->output_buffer, mig->base);
+    event_base_busy_poll_socket(mig->base, evcon->fd);
+
+    if (mig->detectclose)
+        evhttp_connection_start_detectclose(evcon);
+
+    if (mig->cb != NULL)
+        (*mig->cb)(evcon, mig->arg);
+    mm_free(mig);
+}
+
+int
+evhttp_connection_migrate(struct evhttp_connection* evcon,
+                          struct event_base* base,
+                          void (*cb)(struct evhttp_connection*, void*), void* arg)
+{
+    struct evhttp_migration* mig;
+    struct event_base* old = evcon->base;
+
+    /* only a connection that is waiting for its next request */
+    if (evcon->http_server != NULL || !TAILQ_EMPTY(&evcon->requests) ||
+        (evcon->state != EVCON_IDLE && evcon->state != EVCON_DISCONNECTED) ||
+        evcon->connect != NULL || (evcon->flags & EVHTTP_CON_CORKED) ||
+        (event_initialized(&evcon->ev) &&
+         event_pending(&evcon->ev, EV_READ | EV_WRITE | EV_TIMEOUT, NULL)))
+        return (-1);
+
+    if ((mig = mm_calloc(1, sizeof(struct evhttp_migration))) == NULL)
+        return (-1);
+    mig->evcon = evcon;
+    mig->base = base;
+    mig->cb = cb;
+    mig->arg = arg;
+
+    if (evcon->flags & EVHTTP_CON_CLOSEDETECT) {
+        evhttp_connection_stop_detectclose(evcon);
+        mig->detectclose = 1;
+    }
+    evbuffer_set_pool(evcon->input_buffer, NULL);
+    evbuffer_set_pool(evcon->output_buffer, NULL);
+
+    /* a base nobody can post to runs on this thread */
+    if (base->notify == NULL) {
+        evhttp_connection_migrate_attach(mig);
+        return (0);
+    }
+
+    if (event_base_post(base, evhttp_connection_migrate_attach, mig) == -1) {
+        mig->base = old;
+        mig->cb = NULL;
+        evhttp_connection_migrate_attach(mig);
+        return (-1);
+    }
+
+    return (0);
+}
+
+void
+evhttp_connection_set_body_spill(struct evhttp_connection* evcon,
+                                 size_t threshold)
+{
+    evcon->body_spill = threshold;
+    /* large replies and uploads are written out from the file */
+    evbuffer_set_spill(evcon->output_buffer, threshold);
 }
 
 void
 evhttp_connection_set_timeout(struct evhttp_connection* evcon,
                               int timeout_in_secs)
 {
-    evcon->timeout = timeout_in_secs;
+    evutil_timerclear(&evcon->timeout);
+    evcon->timeout.tv_sec = timeout_in_secs;
+}
+
+void
+evhttp_connection_set_timeout_tv(struct evhttp_connection* evcon,
+                                 const struct timeval* tv)
+{
+    if (tv != NULL) {
+        evcon->timeout = *tv;
+    } else {
+        evutil_timerclear(&evcon->timeout);
+        evcon->timeout.tv_sec = -1;
+    }
 }
 
 void
@@ -1809,11 +1970,440 @@ evhttp_connection_get_peer(struct evhttp_connection* evcon,
     *port = evcon->port;
 }
 
+/* true for IPv4 and IPv6 literals, which need no lookup */
+static int
+evhttp_address_is_numeric(const char* address)
+{
+#ifdef HAVE_GETADDRINFO
+    struct addrinfo hints, *ai = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(address, NULL, &hints, &ai) != 0)
+        return (0);
+    freeaddrinfo(ai);
+    return (1);
+#else
+    return (inet_addr(address) != INADDR_NONE ||
+            strcmp(address, "255.255.255.255") == 0);
+#endif
+}
+
+/*
+ * Outgoing connections race their resolved addresses in the style of
+ * RFC 8305: the candidates alternate between IPv6 and IPv4, a new
+ * attempt starts whenever the previous one failed or has not completed
+ * within HTTP_CONNECT_ATTEMPT_DELAY, and the first attempt to complete
+ * becomes the connection.  The whole race runs under the connect
+ * timeout held in evcon->ev.
+ */
+#define HTTP_CONNECT_ATTEMPT_DELAY  250000  /* usec */
+#define HTTP_CONNECT_MAX_ADDRS      16
+
+union evhttp_sockaddr {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+#ifdef HAVE_STRUCT_IN6_ADDR
+    struct sockaddr_in6 sin6;
+#endif
+};
+
+struct evhttp_attempt {
+    struct evhttp_connect* conn;
+    int fd;                         /* -1 if the slot is unused */
+    struct event ev;
+};
+
+struct evhttp_connect {
+    struct evhttp_connection* evcon;
+    struct evhttp_resolve* resolve; /* outstanding evdns lookups */
+
+    // 候选地址，[next, naddrs)是尚未尝试的部分
+    union evhttp_sockaddr addrs[HTTP_CONNECT_MAX_ADDRS];
+    int naddrs;
+    int next;
+    int last_family;                /* family of the last attempt */
+
+    struct evhttp_attempt attempts[HTTP_CONNECT_MAX_ADDRS];
+    int inflight;
+
+    struct event delay_ev;          /* staggers the next attempt */
+};
+
+/*
+ * evdns cannot cancel a request, so the lookup state lives apart from
+ * the connection attempt and is merely detached from it when the
+ * attempt is abandoned before all answers arrived.
+ */
+struct evhttp_resolve {
+    struct evhttp_connect* conn;    /* NULL once abandoned */
+    int pending;                    /* lookups still to answer */
+};
+
+static void evhttp_connect_next(struct evhttp_connect* conn);
+
+static socklen_t
+evhttp_sockaddr_len(const union evhttp_sockaddr* addr)
+{
+#ifdef HAVE_STRUCT_IN6_ADDR
+    if (addr->sa.sa_family == AF_INET6)
+        return (sizeof(struct sockaddr_in6));
+#endif
+    return (sizeof(struct sockaddr_in));
+}
+
+/*
+ * Adds a candidate address and keeps the untried ones interleaved by
+ * family, starting with the family that was not tried last.
+ */
+static void
+evhttp_connect_add(struct evhttp_connect* conn, const struct sockaddr* sa)
+{
+    union evhttp_sockaddr v4[HTTP_CONNECT_MAX_ADDRS];
+    union evhttp_sockaddr v6[HTTP_CONNECT_MAX_ADDRS];
+    int n4 = 0, n6 = 0, i4 = 0, i6 = 0, i, want6;
+
+    if (conn->naddrs == HTTP_CONNECT_MAX_ADDRS)
+        return;
+#ifdef HAVE_STRUCT_IN6_ADDR
+    if (sa->sa_family == AF_INET6) {
+        /* a local address or port only applies to IPv4 sockets */
+        struct evhttp_connection* evcon = conn->evcon;
+        if (evcon->bind_address != NULL || evcon->bind_port != 0)
+            return;
+        memcpy(&conn->addrs[conn->naddrs++], sa,
+               sizeof(struct sockaddr_in6));
+    } else
+#endif
+    if (sa->sa_family == AF_INET)
+        memcpy(&conn->addrs[conn->naddrs++], sa,
+               sizeof(struct sockaddr_in));
+    else
+        return;
+
+    for (i = conn->next; i < conn->naddrs; ++i) {
+        if (conn->addrs[i].sa.sa_family == AF_INET)
+            v4[n4++] = conn->addrs[i];
+        else
+            v6[n6++] = conn->addrs[i];
+    }
+
+    want6 = conn->last_family != AF_INET6;
+    for (i = conn->next; i < conn->naddrs; ++i) {
+        if ((want6 && i6 < n6) || i4 == n4)
+            conn->addrs[i] = v6[i6++];
+        else
+            conn->addrs[i] = v4[i4++];
+        want6 = !want6;
+    }
+}
+
+static void
+evhttp_connect_free(struct evhttp_connect* conn)
+{
+    int i;
+
+    if (conn->resolve != NULL)
+        conn->resolve->conn = NULL;
+
+    for (i = 0; i < HTTP_CONNECT_MAX_ADDRS; ++i) {
+        struct evhttp_attempt* attempt = &conn->attempts[i];
+        if (attempt->fd == -1)
+            continue;
+        event_del(&attempt->ev);
+        EVUTIL_CLOSESOCKET(attempt->fd);
+    }
+    event_del(&conn->delay_ev);
+
+    mm_free(conn);
+}
+
+static void
+evhttp_connection_cancel_connect(struct evhttp_connection* evcon)
+{
+    if (evcon->connect != NULL) {
+        evhttp_connect_free(evcon->connect);
+        evcon->connect = NULL;
+    }
+}
+
+/* Gives up once no attempt is running and nothing is left to try */
+static void
+evhttp_connect_check_done(struct evhttp_connect* conn)
+{
+    if (conn->inflight > 0 || conn->next < conn->naddrs ||
+        conn->resolve != NULL)
+        return;
+
+    event_debug(("%s: no address of \"%s:%d\" could be reached",
+                 __func__, conn->evcon->address, conn->evcon->port));
+    evhttp_connection_connect_failed(conn->evcon);
+}
+
+/*
+ * Call back for asynchronous connection attempt.
+ */
+// 连接之后，发送一个EV_WRITE事件之后的回调，此时connection状态变为EVCON_IDLE
+// 然后调用evhttp_request_dispatch发送一个req
+static void
+evhttp_connectioncb(int fd, short what, void* arg)
+{
+    struct evhttp_attempt* attempt = arg;
+    struct evhttp_connect* conn = attempt->conn;
+    struct evhttp_connection* evcon = conn->evcon;
+    int error;
+    socklen_t errsz = sizeof(error);
+
+    /* Check if the connection completed */
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*)&error,
+                   &errsz) == -1) {
+        event_debug(("%s: getsockopt for \"%s:%d\" on %d",
+                     __func__, evcon->address, evcon->port, fd));
+        goto cleanup;
+    }
+
+    if (error) {
+        event_debug(("%s: connect failed for \"%s:%d\" on %d: %s",
+                     __func__, evcon->address, evcon->port, fd,
+                     strerror(error)));
+        goto cleanup;
+    }
+
+    /* We are connected to the server now */
+    event_debug(("%s: connected to \"%s:%d\" on %d\n",
+                 __func__, evcon->address, evcon->port, fd));
+
+    /* the winner takes over; the other attempts are dropped */
+    attempt->fd = -1;
+    evhttp_connection_cancel_connect(evcon);
+    event_del(&evcon->ev);
+    evcon->fd = fd;
+
+    /* Reset the retry count as we were successful in connecting */
+    evcon->retry_cnt = 0;
+    evcon->state = EVCON_IDLE;
+
+    /* try to start requests that have queued up on this connection */
+    evhttp_request_dispatch(evcon);
+    return;
+
+cleanup:
+    /* a failed attempt makes way for the next one right away */
+    EVUTIL_CLOSESOCKET(fd);
+    attempt->fd = -1;
+    conn->inflight--;
+    event_del(&conn->delay_ev);
+    evhttp_connect_next(conn);
+    evhttp_connect_check_done(conn);
+}
+
+static void
+evhttp_connect_delaycb(int fd, short what, void* arg)
+{
+    struct evhttp_connect* conn = arg;
+
+    evhttp_connect_next(conn);
+}
+
+/* Starts a connect to the next candidate address, if there is one */
+static void
+evhttp_connect_next(struct evhttp_connect* conn)
+{
+    struct evhttp_connection* evcon = conn->evcon;
+
+    while (conn->next < conn->naddrs) {
+        union evhttp_sockaddr* addr = &conn->addrs[conn->next++];
+        struct evhttp_attempt* attempt = NULL;
+        struct timeval tv;
+        int i, fd;
+
+        for (i = 0; i < HTTP_CONNECT_MAX_ADDRS; ++i) {
+            if (conn->attempts[i].fd == -1) {
+                attempt = &conn->attempts[i];
+                break;
+            }
+        }
+        assert(attempt != NULL);
+
+        if (addr->sa.sa_family == AF_INET)
+            fd = bind_socket(
+                     evcon->bind_address, evcon->bind_port, 0 /*reuse*/);
+        else
+            fd = bind_socket_ai(NULL, addr->sa.sa_family, 0);
+        if (fd == -1) {
+            event_debug(("%s: failed to bind to \"%s\"",
+                         __func__, evcon->bind_address));
+            continue;
+        }
+        event_base_busy_poll_socket(evcon->base, fd);
+        if (socket_connect_sa(fd, &addr->sa,
+                              evhttp_sockaddr_len(addr)) == -1) {
+            EVUTIL_CLOSESOCKET(fd);
+            continue;
+        }
+        conn->last_family = addr->sa.sa_family;
+
+        attempt->conn = conn;
+        attempt->fd = fd;
+        event_set(&attempt->ev, fd, EV_WRITE, evhttp_connectioncb, attempt);
+        EVHTTP_BASE_SET(evcon, &attempt->ev);
+        event_add(&attempt->ev, NULL);
+        conn->inflight++;
+
+        /* give the next address a go if this one takes too long */
+        evutil_timerclear(&tv);
+        tv.tv_usec = HTTP_CONNECT_ATTEMPT_DELAY;
+        event_add(&conn->delay_ev, &tv);
+        return;
+    }
+}
+
+static void
+evhttp_resolvecb(int result, char type, int count, int ttl,
+                 void* addresses, void* arg)
+{
+    struct evhttp_resolve* resolve = arg;
+    struct evhttp_connect* conn = resolve->conn;
+    int i;
+
+    if (--resolve->pending == 0) {
+        mm_free(resolve);
+        if (conn != NULL)
+            conn->resolve = NULL;
+    }
+    if (conn == NULL)
+        return;
+
+    if (result != DNS_ERR_NONE) {
+        event_debug(("%s: failed to resolve \"%s\": %s",
+                     __func__, conn->evcon->address,
+                     evdns_err_to_string(result)));
+    }
+
+    for (i = 0; result == DNS_ERR_NONE && i < count; ++i) {
+        union evhttp_sockaddr addr;
+
+        memset(&addr, 0, sizeof(addr));
+        if (type == DNS_IPv4_A) {
+            addr.sin.sin_family = AF_INET;
+            addr.sin.sin_port = htons(conn->evcon->port);
+            memcpy(&addr.sin.sin_addr,
+                   (struct in_addr*)addresses + i, sizeof(struct in_addr));
+#ifdef HAVE_STRUCT_IN6_ADDR
+        } else if (type == DNS_IPv6_AAAA) {
+            addr.sin6.sin6_family = AF_INET6;
+            addr.sin6.sin6_port = htons(conn->evcon->port);
+            memcpy(&addr.sin6.sin6_addr,
+                   (struct in6_addr*)addresses + i, sizeof(struct in6_addr));
+#endif
+        } else {
+            break;
+        }
+        evhttp_connect_add(conn, &addr.sa);
+    }
+
+    /* start right away unless an attempt is younger than the delay */
+    if (!evtimer_pending(&conn->delay_ev, NULL))
+        evhttp_connect_next(conn);
+    evhttp_connect_check_done(conn);
+}
+
+static int
+evhttp_connect_resolve(struct evhttp_connect* conn)
+{
+    struct evhttp_resolve* resolve;
+    const char* address = conn->evcon->address;
+
+    if ((resolve = mm_calloc(1, sizeof(struct evhttp_resolve))) == NULL) {
+        event_warn("%s: calloc", __func__);
+        return (-1);
+    }
+    resolve->conn = conn;
+    conn->resolve = resolve;
+
+    /* the count keeps an early answer from freeing the record */
+    resolve->pending = 1;
+#ifdef HAVE_STRUCT_IN6_ADDR
+    resolve->pending++;
+    if (evdns_resolve_ipv6(address, 0, evhttp_resolvecb, resolve) != 0) {
+        event_debug(("%s: evdns_resolve_ipv6: \"%s\"", __func__, address));
+        resolve->pending--;
+    }
+#endif
+    resolve->pending++;
+    if (evdns_resolve_ipv4(address, 0, evhttp_resolvecb, resolve) != 0) {
+        event_debug(("%s: evdns_resolve_ipv4: \"%s\"", __func__, address));
+        resolve->pending--;
+    }
+
+    if (--resolve->pending == 0) {
+        mm_free(resolve);
+        conn->resolve = NULL;
+        return (-1);
+    }
+
+    return (0);
+}
+
+/* Collects the candidate addresses with a blocking lookup */
+static int
+evhttp_connect_getaddrinfo(struct evhttp_connect* conn)
+{
+    struct evhttp_connection* evcon = conn->evcon;
+#ifdef HAVE_GETADDRINFO
+    struct addrinfo hints, *aitop, *ai;
+    char strport[NI_MAXSERV];
+    int ai_result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    evutil_snprintf(strport, sizeof(strport), "%d", evcon->port);
+    if ((ai_result = getaddrinfo(evcon->address, strport,
+                                 &hints, &aitop)) != 0) {
+        if (ai_result == EAI_SYSTEM)
+            event_warn("getaddrinfo");
+        else
+            event_warnx("getaddrinfo: %s", gai_strerror(ai_result));
+        return (-1);
+    }
+    for (ai = aitop; ai != NULL; ai = ai->ai_next)
+        evhttp_connect_add(conn, ai->ai_addr);
+    freeaddrinfo(aitop);
+#else
+    struct addrinfo* ai = make_addrinfo(evcon->address, evcon->port);
+
+    if (ai == NULL) {
+        event_debug(("%s: make_addrinfo: \"%s:%d\"",
+                     __func__, evcon->address, evcon->port));
+        return (-1);
+    }
+    evhttp_connect_add(conn, ai->ai_addr);
+    fake_freeaddrinfo(ai);
+#endif
+
+    return (conn->naddrs > 0 ? 0 : -1);
+}
+
+static void
+evhttp_connect_timeoutcb(int fd, short what, void* arg)
+{
+    struct evhttp_connection* evcon = arg;
+
+    event_debug(("%s: connection timeout for \"%s:%d\"",
+                 __func__, evcon->address, evcon->port));
+    evhttp_connection_connect_failed(evcon);
+}
+
 // 连接远程socket，并将evcon的event添加到event loop当中，此时的connection状态
 // 为EVCON_CONNECTING
 int
 evhttp_connection_connect(struct evhttp_connection* evcon)
 {
+    struct evhttp_connect* conn;
+    int i, res;
+
     if (evcon->state == EVCON_CONNECTING)
         return (0);
 
@@ -1821,30 +2411,45 @@ evhttp_connection_connect(struct evhttp_connection* evcon)
 
     assert(!(evcon->flags & EVHTTP_CON_INCOMING));
     evcon->flags |= EVHTTP_CON_OUTGOING;
-    // 绑定创建socket
-    evcon->fd = bind_socket(
-                    evcon->bind_address, evcon->bind_port, 0 /*reuse*/);
-    if (evcon->fd == -1) {
-        event_debug(("%s: failed to bind to \"%s\"",
-                     __func__, evcon->bind_address));
+
+    if ((conn = mm_calloc(1, sizeof(struct evhttp_connect))) == NULL) {
+        event_warn("%s: calloc", __func__);
         return (-1);
     }
-    // 连接对端
-    if (socket_connect(evcon->fd, evcon->address, evcon->port) == -1) {
-        EVUTIL_CLOSESOCKET(evcon->fd);
-        evcon->fd = -1;
+    conn->evcon = evcon;
+    for (i = 0; i < HTTP_CONNECT_MAX_ADDRS; ++i)
+        conn->attempts[i].fd = -1;
+    evtimer_set(&conn->delay_ev, evhttp_connect_delaycb, conn);
+    EVHTTP_BASE_SET(evcon, &conn->delay_ev);
+    evcon->connect = conn;
+    evcon->state = EVCON_CONNECTING;
+
+    /*
+     * Hostnames go through evdns when it has nameservers so that a slow
+     * resolver does not stall the loop; the attempts then start from
+     * evhttp_resolvecb.  Without nameservers we fall back to the
+     * blocking getaddrinfo(3) lookup.
+     */
+    if (evdns_count_nameservers() > 0 &&
+        !evhttp_address_is_numeric(evcon->address)) {
+        res = evhttp_connect_resolve(conn);
+    } else {
+        res = evhttp_connect_getaddrinfo(conn);
+        if (res == 0) {
+            evhttp_connect_next(conn);
+            if (conn->inflight == 0)
+                res = -1;
+        }
+    }
+    if (res == -1) {
+        evhttp_connection_reset(evcon);
         return (-1);
     }
 
-    /* Set up a callback for successful connection setup */
-    // EV_WRITE请求，发起连接就发送get或者post
-    event_set(&evcon->ev, evcon->fd, EV_WRITE, evhttp_connectioncb, evcon);
-    // 将connection的event与其event loop关联起来
+    // 加入event loop，超时HTTP_CONNECT_TIMEOUT没响应回调evhttp_connect_timeoutcb通知
+    evtimer_set(&evcon->ev, evhttp_connect_timeoutcb, evcon);
     EVHTTP_BASE_SET(evcon, &evcon->ev);
-    // 加入event loop，超时HTTP_CONNECT_TIMEOUT没响应回调evhttp_connectioncb通知
-    evhttp_add_event(&evcon->ev, evcon->timeout, HTTP_CONNECT_TIMEOUT);
-
-    evcon->state = EVCON_CONNECTING;
+    evhttp_add_event(&evcon->ev, &evcon->timeout, HTTP_CONNECT_TIMEOUT);
 
     return (0);
 }
@@ -1866,8 +2471,8 @@ evhttp_make_request(struct evhttp_connection* evcon,
     req->kind = EVHTTP_REQUEST;
     req->type = type;
     if (req->uri != NULL)
-        free(req->uri);
-    if ((req->uri = strdup(uri)) == NULL)
+        mm_free(req->uri);
+    if ((req->uri = mm_strdup(uri)) == NULL)
         event_err(1, "%s: strdup", __func__);
 
     /* Set the protocol version if it is not supplied */
@@ -1917,8 +2522,13 @@ evhttp_start_read(struct evhttp_connection* evcon)
     event_set(&evcon->ev, evcon->fd, EV_READ, evhttp_read, evcon);
     EVHTTP_BASE_SET(evcon, &evcon->ev);
 
-    evhttp_add_event(&evcon->ev, evcon->timeout, HTTP_READ_TIMEOUT);
+    evhttp_add_event(&evcon->ev, &evcon->timeout, HTTP_READ_TIMEOUT);
     evcon->state = EVCON_READING_FIRSTLINE;
+
+    /* nothing is buffered between requests on a persistent connection */
+    evbuffer_release_pooled(evcon->input_buffer);
+    /* unless the next request was pipelined behind a large one */
+    evbuffer_shrink(evcon->input_buffer, EVBUFFER_SHRINK_THRESHOLD);
 }
 
 // 发送一个req后的回调
@@ -2030,6 +2640,7 @@ evhttp_send_reply_start(struct evhttp_request* req, int code,
                           "chunked");
         req->chunked = 1;
     }
+    evhttp_connection_cork(req->evcon);
     evhttp_make_header(req->evcon, req);
     evhttp_write_buffer(req->evcon, NULL, NULL);
 }
@@ -2042,6 +2653,9 @@ evhttp_send_reply_chunk(struct evhttp_request* req, struct evbuffer* databuf)
     if (evcon == NULL)
         return;
 
+    /* chunks sent in one go are written together */
+    evhttp_connection_cork(evcon);
+
     if (req->chunked) {
         evbuffer_add_printf(evcon->output_buffer, "%x\r\n",
                             (unsigned)EVBUFFER_LENGTH(databuf));
@@ -2070,7 +2684,8 @@ evhttp_send_reply_end(struct evhttp_request* req)
         evbuffer_add(req->evcon->output_buffer, "0\r\n\r\n", 5);
         evhttp_write_buffer(req->evcon, evhttp_send_done, NULL);
         req->chunked = 0;
-    } else if (!event_pending(&evcon->ev, EV_WRITE | EV_TIMEOUT, NULL)) {
+    } else if (!(evcon->flags & EVHTTP_CON_CORKWRITE) &&
+               !event_pending(&evcon->ev, EV_WRITE | EV_TIMEOUT, NULL)) {
         /* let the connection know that we are done with the request */
         evhttp_send_done(evcon, NULL);
     } else {
@@ -2087,8 +2702,8 @@ evhttp_response_code(struct evhttp_request* req, int code, const char* reason)
     req->kind = EVHTTP_RESPONSE;
     req->response_code = code;
     if (req->response_code_line != NULL)
-        free(req->response_code_line);
-    req->response_code_line = strdup(reason);
+        mm_free(req->response_code_line);
+    req->response_code_line = mm_strdup(reason);
 }
 
 void
@@ -2149,7 +2764,7 @@ evhttp_encode_uri(const char* uri)
         }
     }
     evbuffer_add(buf, "", 1);
-    p = strdup((char*)EVBUFFER_DATA(buf));
+    p = mm_strdup((char*)EVBUFFER_DATA(buf));
     evbuffer_free(buf);
 
     return (p);
@@ -2190,8 +2805,8 @@ evhttp_decode_uri(const char* uri)
 {
     char* ret;
 
-    if ((ret = malloc(strlen(uri) + 1)) == NULL)
-        event_err(1, "%s: malloc(%lu)", __func__,
+    if ((ret = mm_malloc(strlen(uri) + 1)) == NULL)
+        event_err(1, "%s: mm_malloc(%lu)", __func__,
                   (unsigned long)(strlen(uri) + 1));
 
     evhttp_decode_uri_internal(uri, strlen(uri),
@@ -2218,7 +2833,7 @@ evhttp_parse_query(const char* uri, struct evkeyvalq* headers)
     if (strchr(uri, '?') == NULL)
         return;
 
-    if ((line = strdup(uri)) == NULL)
+    if ((line = mm_strdup(uri)) == NULL)
         event_err(1, "%s: strdup", __func__);
 
 
@@ -2237,18 +2852,18 @@ evhttp_parse_query(const char* uri, struct evkeyvalq* headers)
         if (value == NULL)
             goto error;
 
-        if ((decoded_value = malloc(strlen(value) + 1)) == NULL)
+        if ((decoded_value = mm_malloc(strlen(value) + 1)) == NULL)
             event_err(1, "%s: malloc", __func__);
 
         evhttp_decode_uri_internal(value, strlen(value),
                                    decoded_value, 1 /*always_decode_plus*/);
         event_debug(("Query Param: %s -> %s\n", key, decoded_value));
         evhttp_add_header_internal(headers, key, decoded_value);
-        free(decoded_value);
+        mm_free(decoded_value);
     }
 
 error:
-    free(line);
+    mm_free(line);
 }
 
 // 根据req的uri得到与之关联的处理对调函数
@@ -2326,7 +2941,7 @@ evhttp_handle_request(struct evhttp_request* req, void* arg)
 
         evbuffer_add_printf(buf, ERR_FORMAT, escaped_html);
 
-        free(escaped_html);
+        mm_free(escaped_html);
 
         evhttp_send_page(req, buf);
 
@@ -2386,7 +3001,7 @@ evhttp_accept_socket(struct evhttp* http, int fd)
     struct event* ev;
     int res;
 
-    bound = malloc(sizeof(struct evhttp_bound_socket));
+    bound = mm_malloc(sizeof(struct evhttp_bound_socket));
     if (bound == NULL)
         return (-1);
 
@@ -2399,7 +3014,7 @@ evhttp_accept_socket(struct evhttp* http, int fd)
     res = event_add(ev, NULL);
 
     if (res == -1) {
-        free(bound);
+        mm_free(bound);
         return (-1);
     }
 
@@ -2413,12 +3028,13 @@ evhttp_new_object(void)
 {
     struct evhttp* http = NULL;
 
-    if ((http = calloc(1, sizeof(struct evhttp))) == NULL) {
+    if ((http = mm_calloc(1, sizeof(struct evhttp))) == NULL) {
         event_warn("%s: calloc", __func__);
         return (NULL);
     }
 
-    http->timeout = -1;
+    evutil_timerclear(&http->timeout);
+    http->timeout.tv_sec = -1;
 
     TAILQ_INIT(&http->sockets);
     TAILQ_INIT(&http->callbacks);
@@ -2448,7 +3064,7 @@ evhttp_start(const char* address, u_short port)
     struct evhttp* http = evhttp_new_object();
 
     if (evhttp_bind_socket(http, address, port) == -1) {
-        free(http);
+        mm_free(http);
         return (NULL);
     }
 
@@ -2471,7 +3087,7 @@ evhttp_free(struct evhttp* http)
         event_del(&bound->bind_ev);
         EVUTIL_CLOSESOCKET(fd);
 
-        free(bound);
+        mm_free(bound);
     }
 
     while ((evcon = TAILQ_FIRST(&http->connections)) != NULL) {
@@ -2481,17 +3097,35 @@ evhttp_free(struct evhttp* http)
 
     while ((http_cb = TAILQ_FIRST(&http->callbacks)) != NULL) {
         TAILQ_REMOVE(&http->callbacks, http_cb, next);
-        free(http_cb->what);
-        free(http_cb);
+        mm_free(http_cb->what);
+        mm_free(http_cb);
     }
 
-    free(http);
+    mm_free(http);
 }
 
 void
 evhttp_set_timeout(struct evhttp* http, int timeout_in_secs)
 {
-    http->timeout = timeout_in_secs;
+    evutil_timerclear(&http->timeout);
+    http->timeout.tv_sec = timeout_in_secs;
+}
+
+void
+evhttp_set_timeout_tv(struct evhttp* http, const struct timeval* tv)
+{
+    if (tv != NULL) {
+        http->timeout = *tv;
+    } else {
+        evutil_timerclear(&http->timeout);
+        http->timeout.tv_sec = -1;
+    }
+}
+
+void
+evhttp_set_body_spill(struct evhttp* http, size_t threshold)
+{
+    http->body_spill = threshold;
 }
 
 void
@@ -2500,10 +3134,10 @@ evhttp_set_cb(struct evhttp* http, const char* uri,
 {
     struct evhttp_cb* http_cb;
 
-    if ((http_cb = calloc(1, sizeof(struct evhttp_cb))) == NULL)
+    if ((http_cb = mm_calloc(1, sizeof(struct evhttp_cb))) == NULL)
         event_err(1, "%s: calloc", __func__);
 
-    http_cb->what = strdup(uri);
+    http_cb->what = mm_strdup(uri);
     http_cb->cb = cb;
     http_cb->cbarg = cbarg;
 
@@ -2523,8 +3157,8 @@ evhttp_del_cb(struct evhttp* http, const char* uri)
         return (-1);
 
     TAILQ_REMOVE(&http->callbacks, http_cb, next);
-    free(http_cb->what);
-    free(http_cb);
+    mm_free(http_cb->what);
+    mm_free(http_cb);
 
     return (0);
 }
@@ -2550,20 +3184,20 @@ evhttp_request_new(void (*cb)(struct evhttp_request*, void*), void* arg)
     struct evhttp_request* req = NULL;
 
     /* Allocate request structure */
-    if ((req = calloc(1, sizeof(struct evhttp_request))) == NULL) {
+    if ((req = mm_calloc(1, sizeof(struct evhttp_request))) == NULL) {
         event_warn("%s: calloc", __func__);
         goto error;
     }
 
     req->kind = EVHTTP_RESPONSE;
-    req->input_headers = calloc(1, sizeof(struct evkeyvalq));
+    req->input_headers = mm_calloc(1, sizeof(struct evkeyvalq));
     if (req->input_headers == NULL) {
         event_warn("%s: calloc", __func__);
         goto error;
     }
     TAILQ_INIT(req->input_headers);
 
-    req->output_headers = calloc(1, sizeof(struct evkeyvalq));
+    req->output_headers = mm_calloc(1, sizeof(struct evkeyvalq));
     if (req->output_headers == NULL) {
         event_warn("%s: calloc", __func__);
         goto error;
@@ -2596,17 +3230,17 @@ void
 evhttp_request_free(struct evhttp_request* req)
 {
     if (req->remote_host != NULL)
-        free(req->remote_host);
+        mm_free(req->remote_host);
     if (req->uri != NULL)
-        free(req->uri);
+        mm_free(req->uri);
     if (req->response_code_line != NULL)
-        free(req->response_code_line);
+        mm_free(req->response_code_line);
 
     evhttp_clear_headers(req->input_headers);
-    free(req->input_headers);
+    mm_free(req->input_headers);
 
     evhttp_clear_headers(req->output_headers);
-    free(req->output_headers);
+    mm_free(req->output_headers);
 
     if (req->input_buffer != NULL)
         evbuffer_free(req->input_buffer);
@@ -2614,7 +3248,7 @@ evhttp_request_free(struct evhttp_request* req)
     if (req->output_buffer != NULL)
         evbuffer_free(req->output_buffer);
 
-    free(req);
+    mm_free(req);
 }
 
 struct evhttp_connection*
@@ -2658,8 +3292,8 @@ evhttp_get_request_connection(
 
     name_from_addr(sa, salen, &hostname, &portname);
     if (hostname == NULL || portname == NULL) {
-        if (hostname) free(hostname);
-        if (portname) free(portname);
+        if (hostname) mm_free(hostname);
+        if (portname) mm_free(portname);
         return (NULL);
     }
 
@@ -2668,8 +3302,8 @@ evhttp_get_request_connection(
 
     /* we need a connection object to put the http request on */
     evcon = evhttp_connection_new(hostname, atoi(portname));
-    free(hostname);
-    free(portname);
+    mm_free(hostname);
+    mm_free(portname);
     if (evcon == NULL)
         return (NULL);
 
@@ -2680,6 +3314,7 @@ evhttp_get_request_connection(
     evcon->state = EVCON_READING_FIRSTLINE;
 
     evcon->fd = fd;
+    event_base_busy_poll_socket(evcon->base, fd);
 
     return (evcon);
 }
@@ -2701,7 +3336,7 @@ evhttp_associate_new_request_with_connection(struct evhttp_connection* evcon)
 
     req->kind = EVHTTP_REQUEST;
 
-    if ((req->remote_host = strdup(evcon->address)) == NULL)
+    if ((req->remote_host = mm_strdup(evcon->address)) == NULL)
         event_err(1, "%s: strdup", __func__);
     req->remote_port = evcon->port;
 
@@ -2721,8 +3356,11 @@ evhttp_get_request(struct evhttp* http, int fd,
         return;
 
     /* the timeout can be used by the server to close idle connections */
-    if (http->timeout != -1)
-        evhttp_connection_set_timeout(evcon, http->timeout);
+    if (http->timeout.tv_sec != -1)
+        evhttp_connection_set_timeout_tv(evcon, &http->timeout);
+
+    if (http->body_spill != 0)
+        evhttp_connection_set_body_spill(evcon, http->body_spill);
 
     /*
      * if we want to accept more than one request on a connection,
@@ -2794,20 +3432,20 @@ name_from_addr(struct sockaddr* sa, socklen_t salen,
     if (ni_result != 0)
         return;
 #endif
-    *phost = strdup(ntop);
-    *pport = strdup(strport);
+    *phost = mm_strdup(ntop);
+    *pport = mm_strdup(strport);
 }
 
 /* Create a non-blocking socket and bind it */
 /* todo: rename this function */
 static int
-bind_socket_ai(struct addrinfo* ai, int reuse)
+bind_socket_ai(struct addrinfo* ai, int family, int reuse)
 {
     int fd, on = 1, r;
     int serrno;
 
     /* Create listen socket */
-    fd = socket(AF_INET, SOCK_STREAM, 0);
+    fd = socket(ai != NULL ? ai->ai_family : family, SOCK_STREAM, 0);
     if (fd == -1) {
         event_warn("socket");
         return (-1);
@@ -2892,14 +3530,14 @@ bind_socket(const char* address, u_short port, int reuse)
 
     /* just create an unbound socket */
     if (address == NULL && port == 0)
-        return bind_socket_ai(NULL, 0);
+        return bind_socket_ai(NULL, AF_INET, 0);
 
     aitop = make_addrinfo(address, port);
 
     if (aitop == NULL)
         return (-1);
 
-    fd = bind_socket_ai(aitop, reuse);
+    fd = bind_socket_ai(aitop, AF_INET, reuse);
 
 #ifdef HAVE_GETADDRINFO
     freeaddrinfo(aitop);
@@ -2911,40 +3549,21 @@ bind_socket(const char* address, u_short port, int reuse)
 }
 
 static int
-socket_connect(int fd, const char* address, unsigned short port)
+socket_connect_sa(int fd, struct sockaddr* sa, socklen_t salen)
 {
-    struct addrinfo* ai = make_addrinfo(address, port);
-    int res = -1;
-
-    if (ai == NULL) {
-        event_debug(("%s: make_addrinfo: \"%s:%d\"",
-                     __func__, address, port));
-        return (-1);
-    }
-
-    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+    if (connect(fd, sa, salen) == -1) {
 #ifdef WIN32
         int tmp_error = WSAGetLastError();
         if (tmp_error != WSAEWOULDBLOCK && tmp_error != WSAEINVAL &&
             tmp_error != WSAEINPROGRESS) {
-            goto out;
+            return (-1);
         }
 #else
         if (errno != EINPROGRESS) {
-            goto out;
+            return (-1);
         }
 #endif
     }
 
-    /* everything is fine */
-    res = 0;
-
-out:
-#ifdef HAVE_GETADDRINFO
-    freeaddrinfo(ai);
-#else
-    fake_freeaddrinfo(ai);
-#endif
-
-    return (res);
+    return (0);
 }
@@ -0,0 +1,592 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#else
+#include <sys/_libevent_time.h>
+#endif
+#include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <endian.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#include "event.h"
+#include "event-internal.h"
+#include "evsignal.h"
+#include "log.h"
+#include "mm-internal.h"
+
+/*
+ * io_uring backend.
+ *
+ * Every fd with read or write interest has exactly one one-shot
+ * IORING_OP_POLL_ADD outstanding.  Registering and unregistering
+ * events only writes SQEs into the shared submission ring; nothing is
+ * handed to the kernel until uring_dispatch(), which submits all queued
+ * changes and waits for completions with a single io_uring_enter(2).
+ * This replaces the epoll_ctl() per event_add()/event_del() plus the
+ * epoll_wait() per iteration of the epoll backend.
+ *
+ * Completions are matched to the fd through user_data, which carries
+ * the fd in the low 32 bits and a per-fd generation in the high 32
+ * bits.  The generation is bumped whenever a poll is cancelled, so
+ * the -ECANCELED completion of a stale poll is simply ignored.
+ */
+
+struct evuring {
+    struct event* evread;
+    struct event* evwrite;
+    // 当前提交给内核的poll掩码，0表示没有未完成的poll
+    short armed;
+    // 已经触发，等待下一次dispatch重新提交
+    short fired;
+    unsigned int gen;
+};
+
+struct uringop {
+    int ringfd;
+
+    /* submission ring */
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned int to_submit;
+
+    /* completion ring */
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_sz;
+    void* cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+
+    // 通过fds[fd]得到与fd关联的evuring
+    struct evuring* fds;
+    int nfds;
+
+    // 已经触发过的fd，需要在下次dispatch之前重新提交poll
+    int* fired;
+    int nfired;
+};
+
+static void* uring_init    (struct event_base*);
+static int uring_add    (void*, struct event*);
+static int uring_del    (void*, struct event*);
+static int uring_dispatch    (struct event_base*, void*, struct timeval*);
+static void uring_dealloc    (struct event_base*, void*);
+
+const struct eventop uringops = {
+    "io_uring",
+    uring_init,
+    uring_add,
+    uring_del,
+    uring_dispatch,
+    uring_dealloc,
+    1 /* need reinit */
+};
+
+#ifdef HAVE_SETFD
+#define FD_CLOSEONEXEC(x) do { \
+        if (fcntl(x, F_SETFD, 1) == -1) \
+                event_warn("fcntl(%d, F_SETFD)", x); \
+} while (0)
+#else
+#define FD_CLOSEONEXEC(x)
+#endif
+
+#define INITIAL_NFILES 32
+#define URING_ENTRIES 256
+
+/* user_data of SQEs whose completion we do not care about */
+#define URING_IGNORE ((uint64_t)-1)
+
+#define URING_DATA(fd, gen) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define URING_DATA_FD(data) ((uint32_t)(data))
+#define URING_DATA_GEN(data) ((uint32_t)((data) >> 32))
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int
+uring_setup(unsigned int entries, struct io_uring_params* p)
+{
+    return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+            unsigned int flags, void* arg, size_t argsz)
+{
+    return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                    flags, arg, argsz));
+}
+
+static void
+uring_unmap(struct uringop* uringop)
+{
+    if (uringop->sqes != NULL && uringop->sqes != MAP_FAILED)
+        munmap(uringop->sqes, uringop->sqes_sz);
+    if (uringop->cq_ring != NULL && uringop->cq_ring != MAP_FAILED &&
+        uringop->cq_ring != uringop->sq_ring)
+        munmap(uringop->cq_ring, uringop->cq_ring_sz);
+    if (uringop->sq_ring != NULL && uringop->sq_ring != MAP_FAILED)
+        munmap(uringop->sq_ring, uringop->sq_ring_sz);
+}
+
+static void*
+uring_init(struct event_base* base)
+{
+    struct io_uring_params p;
+    struct uringop* uringop;
+    int ringfd;
+    char* sq;
+    char* cq;
+
+    /* Disable io_uring when this environment variable is set */
+    if (evutil_getenv("EVENT_NOIOURING"))
+        return (NULL);
+
+    memset(&p, 0, sizeof(p));
+#ifdef IORING_SETUP_CQSIZE
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_ENTRIES * 4;
+#endif
+    if ((ringfd = uring_setup(URING_ENTRIES, &p)) == -1) {
+        if (errno != ENOSYS && errno != EPERM)
+            event_warn("io_uring_setup");
+        return (NULL);
+    }
+
+    /*
+     * We pass the dispatch timeout to io_uring_enter() directly, which
+     * needs IORING_FEAT_EXT_ARG (Linux 5.11).  Older kernels use epoll.
+     */
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        close(ringfd);
+        return (NULL);
+    }
+
+    FD_CLOSEONEXEC(ringfd);
+
+    if (!(uringop = mm_calloc(1, sizeof(struct uringop)))) {
+        close(ringfd);
+        return (NULL);
+    }
+    uringop->ringfd = ringfd;
+
+    uringop->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    uringop->cq_ring_sz = p.cq_off.cqes +
+                          p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uringop->cq_ring_sz > uringop->sq_ring_sz)
+            uringop->sq_ring_sz = uringop->cq_ring_sz;
+        uringop->cq_ring_sz = uringop->sq_ring_sz;
+    }
+
+    uringop->sq_ring = mmap(NULL, uringop->sq_ring_sz,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ringfd, IORING_OFF_SQ_RING);
+    if (uringop->sq_ring == MAP_FAILED)
+        goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        uringop->cq_ring = uringop->sq_ring;
+    } else {
+        uringop->cq_ring = mmap(NULL, uringop->cq_ring_sz,
+                                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ringfd, IORING_OFF_CQ_RING);
+        if (uringop->cq_ring == MAP_FAILED)
+            goto err;
+    }
+    uringop->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    uringop->sqes = mmap(NULL, uringop->sqes_sz,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ringfd, IORING_OFF_SQES);
+    if (uringop->sqes == MAP_FAILED)
+        goto err;
+
+    sq = uringop->sq_ring;
+    uringop->sq_head = (unsigned int*)(sq + p.sq_off.head);
+    uringop->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+    uringop->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+    uringop->sq_array = (unsigned int*)(sq + p.sq_off.array);
+    uringop->sq_entries = p.sq_entries;
+
+    cq = uringop->cq_ring;
+    uringop->cq_head = (unsigned int*)(cq + p.cq_off.head);
+    uringop->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+    uringop->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+    uringop->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    uringop->fds = mm_calloc(INITIAL_NFILES, sizeof(struct evuring));
+    uringop->fired = mm_calloc(INITIAL_NFILES, sizeof(int));
+    if (uringop->fds == NULL || uringop->fired == NULL)
+        goto err;
+    uringop->nfds = INITIAL_NFILES;
+
+    evsignal_init(base);
+
+    return (uringop);
+
+err:
+    if (uringop->fds)
+        mm_free(uringop->fds);
+    if (uringop->fired)
+        mm_free(uringop->fired);
+    uring_unmap(uringop);
+    close(ringfd);
+    mm_free(uringop);
+    return (NULL);
+}
+
+static int
+uring_recalc(struct event_base* base, void* arg, int max)
+{
+    struct uringop* uringop = arg;
+
+    if (max >= uringop->nfds) {
+        struct evuring* fds;
+        int* fired;
+        int nfds;
+
+        nfds = uringop->nfds;
+        while (nfds <= max)
+            nfds <<= 1;
+
+        fds = mm_realloc(uringop->fds, nfds * sizeof(struct evuring));
+        if (fds == NULL) {
+            event_warn("realloc");
+            return (-1);
+        }
+        uringop->fds = fds;
+        memset(fds + uringop->nfds, 0,
+               (nfds - uringop->nfds) * sizeof(struct evuring));
+
+        /* an fd appears on the fired list at most once */
+        fired = mm_realloc(uringop->fired, nfds * sizeof(int));
+        if (fired == NULL) {
+            event_warn("realloc");
+            return (-1);
+        }
+        uringop->fired = fired;
+        uringop->nfds = nfds;
+    }
+
+    return (0);
+}
+
+/* hands the queued entries to the kernel without waiting for anything */
+static int
+uring_submit(struct uringop* uringop)
+{
+    int res;
+
+    if (!uringop->to_submit)
+        return (0);
+
+    res = uring_enter(uringop->ringfd, uringop->to_submit, 0, 0, NULL, 0);
+    if (res == -1) {
+        event_warn("io_uring_enter");
+        return (-1);
+    }
+    uringop->to_submit -= res;
+
+    return (0);
+}
+
+/*
+ * Returns a free SQE.  If the submission ring is full, the queued
+ * entries are submitted first.
+ */
+static struct io_uring_sqe*
+uring_get_sqe(struct uringop* uringop)
+{
+    struct io_uring_sqe* sqe;
+    unsigned int tail = *uringop->sq_tail;
+    unsigned int idx;
+
+    if (tail - load_acquire(uringop->sq_head) >= uringop->sq_entries) {
+        if (uring_submit(uringop) == -1)
+            return (NULL);
+        if (tail - load_acquire(uringop->sq_head) >= uringop->sq_entries)
+            return (NULL);
+    }
+
+    idx = tail & *uringop->sq_mask;
+    sqe = &uringop->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    uringop->sq_array[idx] = idx;
+    store_release(uringop->sq_tail, tail + 1);
+    uringop->to_submit++;
+
+    return (sqe);
+}
+
+static int
+uring_poll_mask(struct evuring* evu)
+{
+    int events = 0;
+
+    if (evu->evread != NULL)
+        events |= POLLIN;
+    if (evu->evwrite != NULL)
+        events |= POLLOUT;
+
+    return (events);
+}
+
+/*
+ * Brings the poll outstanding in the kernel in line with the events
+ * registered on fd: cancels a poll with the wrong mask and queues a
+ * new one if there is still interest.
+ */
+static int
+uring_update(struct uringop* uringop, int fd)
+{
+    struct evuring* evu = &uringop->fds[fd];
+    struct io_uring_sqe* sqe;
+    int events = uring_poll_mask(evu);
+    uint32_t mask;
+
+    if (evu->armed == events)
+        return (0);
+
+    if (evu->armed) {
+        if ((sqe = uring_get_sqe(uringop)) == NULL)
+            return (-1);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = URING_DATA(fd, evu->gen);
+        sqe->user_data = URING_IGNORE;
+        evu->armed = 0;
+        evu->gen++;
+    }
+
+    if (!events)
+        return (0);
+
+    if ((sqe = uring_get_sqe(uringop)) == NULL)
+        return (-1);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    mask = events;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    sqe->poll32_events = mask;
+    sqe->user_data = URING_DATA(fd, evu->gen);
+    evu->armed = events;
+
+    return (0);
+}
+
+static int
+uring_dispatch(struct event_base* base, void* arg, struct timeval* tv)
+{
+    struct uringop* uringop = arg;
+    struct io_uring_getevents_arg earg;
+    struct __kernel_timespec ts;
+    unsigned int head, tail;
+    int i, res;
+
+    /* resubmit polls for persistent events that fired last time */
+    for (i = 0; i < uringop->nfired; i++) {
+        int fd = uringop->fired[i];
+        uringop->fds[fd].fired = 0;
+        if (uring_update(uringop, fd) == -1)
+            return (-1);
+    }
+    uringop->nfired = 0;
+
+    memset(&earg, 0, sizeof(earg));
+    if (tv != NULL) {
+        ts.tv_sec = tv->tv_sec;
+        ts.tv_nsec = tv->tv_usec * 1000;
+        earg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    res = uring_enter(uringop->ringfd, uringop->to_submit, 1,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &earg, sizeof(earg));
+    if (res == -1) {
+        if (errno == EINTR) {
+            evsignal_process(base);
+            return (0);
+        }
+        if (errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+            event_warn("io_uring_enter");
+            return (-1);
+        }
+    } else {
+        uringop->to_submit -= res;
+    }
+
+    if (base->sig.evsignal_caught)
+        evsignal_process(base);
+
+    head = *uringop->cq_head;
+    tail = load_acquire(uringop->cq_tail);
+
+    event_debug(("%s: io_uring_enter reports %u", __func__, tail - head));
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &uringop->cqes[head & *uringop->cq_mask];
+        uint64_t data = cqe->user_data;
+        int what = cqe->res;
+        struct event* evread = NULL, *evwrite = NULL;
+        struct evuring* evu;
+        unsigned int fd;
+
+        if (data == URING_IGNORE)
+            continue;
+        fd = URING_DATA_FD(data);
+        if (fd >= (unsigned int)uringop->nfds)
+            continue;
+        evu = &uringop->fds[fd];
+        /* completion of a poll that has since been cancelled */
+        if (URING_DATA_GEN(data) != evu->gen || !evu->armed)
+            continue;
+
+        evu->armed = 0;
+        evu->gen++;
+        if (!evu->fired) {
+            evu->fired = 1;
+            uringop->fired[uringop->nfired++] = fd;
+        }
+
+        /* report a failed poll as an error on the fd */
+        if (what < 0 || (what & (POLLHUP | POLLERR | POLLNVAL))) {
+            evread = evu->evread;
+            evwrite = evu->evwrite;
+        } else {
+            if (what & POLLIN)
+                evread = evu->evread;
+            if (what & POLLOUT)
+                evwrite = evu->evwrite;
+        }
+
+        if (evread != NULL)
+            event_active(evread, EV_READ, 1);
+        if (evwrite != NULL)
+            event_active(evwrite, EV_WRITE, 1);
+    }
+    store_release(uringop->cq_head, head);
+
+    return (0);
+}
+
+
+static int
+uring_add(void* arg, struct event* ev)
+{
+    struct uringop* uringop = arg;
+    struct evuring* evu;
+    struct event* oldread, *oldwrite;
+    int fd;
+
+    if (ev->ev_events & EV_SIGNAL)
+        return (evsignal_add(ev));
+
+    fd = ev->ev_fd;
+    if (fd < 0)
+        return (-1);
+    if (fd >= uringop->nfds) {
+        /* Extent the file descriptor array as necessary */
+        if (uring_recalc(ev->ev_base, uringop, fd) == -1)
+            return (-1);
+    }
+    evu = &uringop->fds[fd];
+    oldread = evu->evread;
+    oldwrite = evu->evwrite;
+
+    if (ev->ev_events & EV_READ)
+        evu->evread = ev;
+    if (ev->ev_events & EV_WRITE)
+        evu->evwrite = ev;
+
+    if (uring_update(uringop, fd) == -1) {
+        evu->evread = oldread;
+        evu->evwrite = oldwrite;
+        return (-1);
+    }
+
+    return (0);
+}
+
+static int
+uring_del(void* arg, struct event* ev)
+{
+    struct uringop* uringop = arg;
+    struct evuring* evu;
+    int fd;
+
+    if (ev->ev_events & EV_SIGNAL)
+        return (evsignal_del(ev));
+
+    fd = ev->ev_fd;
+    if (fd < 0 || fd >= uringop->nfds)
+        return (0);
+    evu = &uringop->fds[fd];
+
+    if (ev->ev_events & EV_READ)
+        evu->evread = NULL;
+    if (ev->ev_events & EV_WRITE)
+        evu->evwrite = NULL;
+
+    /*
+     * Cancelling right away rather than at the next dispatch matters:
+     * the caller may close the fd and get the same number back for a
+     * new file before we get to run again.
+     */
+    if (uring_update(uringop, fd) == -1)
+        return (-1);
+
+    /*
+     * An outstanding poll holds a reference to the file, so a socket
+     * closed after this would stay open (and a listener stay bound)
+     * until the next dispatch.  Submit the cancellation now.
+     */
+    if (!evu->armed)
+        return (uring_submit(uringop));
+
+    return (0);
+}
+
+static void
+uring_dealloc(struct event_base* base, void* arg)
+{
+    struct uringop* uringop = arg;
+
+    evsignal_dealloc(base);
+    if (uringop->fds)
+        mm_free(uringop->fds);
+    if (uringop->fired)
+        mm_free(uringop->fired);
+    uring_unmap(uringop);
+    if (uringop->ringfd >= 0)
+        close(uringop->ringfd);
+
+    memset(uringop, 0, sizeof(struct uringop));
+    mm_free(uringop);
+}
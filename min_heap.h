@@ -29,6 +29,7 @@
 
 #include "event.h"
 #include "evutil.h"
+#include "mm-internal.h"
 
 typedef struct min_heap {
     struct event** p;
@@ -62,7 +63,7 @@ void min_heap_ctor(min_heap_t* s)
 }
 void min_heap_dtor(min_heap_t* s)
 {
-    if (s->p) free(s->p);
+    if (s->p) mm_free(s->p);
 }
 void min_heap_elem_init(struct event* e)
 {
@@ -127,7 +128,7 @@ int min_heap_reserve(min_heap_t* s, unsigned n)
         unsigned a = s->a ? s->a * 2 : 8;
         if (a < n)
             a = n;
-        if (!(p = (struct event**)realloc(s->p, a * sizeof * p)))
+        if (!(p = (struct event**)mm_realloc(s->p, a * sizeof * p)))
             return -1;
         s->p = p;
         s->a = a;
@@ -0,0 +1,15 @@
+#ifndef _EVENT_MM_INTERNAL_H_
+#define _EVENT_MM_INTERNAL_H_
+
+/*
+ * All memory the library allocates goes through these, so that the
+ * functions set with event_set_mem_functions() see every allocation.
+ * They are declared in event.h.
+ */
+#define mm_malloc(sz)           event_mm_malloc(sz)
+#define mm_calloc(count, sz)    event_mm_calloc((count), (sz))
+#define mm_strdup(s)            event_mm_strdup(s)
+#define mm_realloc(p, sz)       event_mm_realloc((p), (sz))
+#define mm_free(p)              event_mm_free(p)
+
+#endif /* _EVENT_MM_INTERNAL_H_ */
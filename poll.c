@@ -52,14 +52,24 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
+
+/* the events waiting on one pollfd */
+struct pollback {
+    struct event* r;
+    struct event* w;
+};
 
 struct pollop {
     int event_count;        /* Highest number alloc */
     int nfds;                       /* Size of event_* */
     int fd_count;                   /* Size of idxplus1_by_fd */
+    /*
+     * event_set and event_back live in a single allocation that is
+     * grown in one place; event_set is handed to poll(2) as it is.
+     */
     struct pollfd* event_set;
-    struct event** event_r_back;
-    struct event** event_w_back;
+    struct pollback* event_back;
     int* idxplus1_by_fd; /* Index into event_set by fd; we add 1 so
                   * that 0 (which is easy to memset) can mean
                   * "no entry." */
@@ -90,7 +100,7 @@ poll_init(struct event_base* base)
     if (evutil_getenv("EVENT_NOPOLL"))
         return (NULL);
 
-    if (!(pollop = calloc(1, sizeof(struct pollop))))
+    if (!(pollop = mm_calloc(1, sizeof(struct pollop))))
         return (NULL);
 
     evsignal_init(base);
@@ -111,13 +121,13 @@ poll_check_ok(struct pollop* pop)
             continue;
         assert(pop->event_set[idx].fd == i);
         if (pop->event_set[idx].events & POLLIN) {
-            ev = pop->event_r_back[idx];
+            ev = pop->event_back[idx].r;
             assert(ev);
             assert(ev->ev_events & EV_READ);
             assert(ev->ev_fd == i);
         }
         if (pop->event_set[idx].events & POLLOUT) {
-            ev = pop->event_w_back[idx];
+            ev = pop->event_back[idx].w;
             assert(ev);
             assert(ev->ev_events & EV_WRITE);
             assert(ev->ev_fd == i);
@@ -163,109 +173,86 @@ poll_dispatch(struct event_base* base, void* arg, struct timeval* tv)
     if (res == 0 || nfds == 0)
         return (0);
 
+    /* res is the number of pollfds with revents set; stop at the last */
     i = random() % nfds;
-    for (j = 0; j < nfds; j++) {
+    for (j = 0; j < nfds && res > 0; j++) {
         struct event* r_ev = NULL, *w_ev = NULL;
-        int what;
+        int what, which = 0;
         if (++i == nfds)
             i = 0;
         what = pop->event_set[i].revents;
 
         if (!what)
             continue;
-
-        res = 0;
+        res--;
 
         /* If the file gets closed notify */
         if (what & (POLLHUP | POLLERR))
             what |= POLLIN | POLLOUT;
         if (what & POLLIN) {
-            res |= EV_READ;
-            r_ev = pop->event_r_back[i];
+            which |= EV_READ;
+            r_ev = pop->event_back[i].r;
         }
         if (what & POLLOUT) {
-            res |= EV_WRITE;
-            w_ev = pop->event_w_back[i];
+            which |= EV_WRITE;
+            w_ev = pop->event_back[i].w;
         }
-        if (res == 0)
+        if (which == 0)
             continue;
 
-        if (r_ev && (res & r_ev->ev_events)) {
-            event_active(r_ev, res & r_ev->ev_events, 1);
+        if (r_ev && (which & r_ev->ev_events)) {
+            event_active(r_ev, which & r_ev->ev_events, 1);
         }
-        if (w_ev && w_ev != r_ev && (res & w_ev->ev_events)) {
-            event_active(w_ev, res & w_ev->ev_events, 1);
+        if (w_ev && w_ev != r_ev && (which & w_ev->ev_events)) {
+            event_active(w_ev, which & w_ev->ev_events, 1);
         }
     }
 
     return (0);
 }
 
+/*
+ * Makes room for one more pollfd and for fd in idxplus1_by_fd.  This is
+ * the only place where memory is allocated.
+ */
 static int
-poll_add(void* arg, struct event* ev)
+poll_grow(struct pollop* pop, int fd)
 {
-    struct pollop* pop = arg;
-    struct pollfd* pfd = NULL;
-    int i;
-
-    if (ev->ev_events & EV_SIGNAL)
-        return (evsignal_add(ev));
-    if (!(ev->ev_events & (EV_READ | EV_WRITE)))
-        return (0);
-
-    poll_check_ok(pop);
     if (pop->nfds + 1 >= pop->event_count) {
-        struct pollfd* tmp_event_set;
-        struct event** tmp_event_r_back;
-        struct event** tmp_event_w_back;
-        int tmp_event_count;
-
-        if (pop->event_count < 32)
-            tmp_event_count = 32;
-        else
-            tmp_event_count = pop->event_count * 2;
+        int count = pop->event_count < 32 ? 32 : pop->event_count * 2;
+        struct pollfd* set;
+        struct pollback* back;
 
-        /* We need more file descriptors */
-        tmp_event_set = realloc(pop->event_set,
-                                tmp_event_count * sizeof(struct pollfd));
-        if (tmp_event_set == NULL) {
-            event_warn("realloc");
+        set = mm_malloc(count * (sizeof(struct pollfd) + sizeof(struct pollback)));
+        if (set == NULL) {
+            event_warn("malloc");
             return (-1);
         }
-        pop->event_set = tmp_event_set;
+        back = (struct pollback*)(set + count);
 
-        tmp_event_r_back = realloc(pop->event_r_back,
-                                   tmp_event_count * sizeof(struct event*));
-        if (tmp_event_r_back == NULL) {
-            /* event_set overallocated; that's okay. */
-            event_warn("realloc");
-            return (-1);
+        if (pop->nfds) {
+            memcpy(set, pop->event_set, pop->nfds * sizeof(struct pollfd));
+            memcpy(back, pop->event_back,
+                   pop->nfds * sizeof(struct pollback));
         }
-        pop->event_r_back = tmp_event_r_back;
+        mm_free(pop->event_set);
 
-        tmp_event_w_back = realloc(pop->event_w_back,
-                                   tmp_event_count * sizeof(struct event*));
-        if (tmp_event_w_back == NULL) {
-            /* event_set and event_r_back overallocated; that's
-             * okay. */
-            event_warn("realloc");
-            return (-1);
-        }
-        pop->event_w_back = tmp_event_w_back;
-
-        pop->event_count = tmp_event_count;
+        pop->event_set = set;
+        pop->event_back = back;
+        pop->event_count = count;
     }
-    if (ev->ev_fd >= pop->fd_count) {
+
+    if (fd >= pop->fd_count) {
         int* tmp_idxplus1_by_fd;
         int new_count;
         if (pop->fd_count < 32)
             new_count = 32;
         else
             new_count = pop->fd_count * 2;
-        while (new_count <= ev->ev_fd)
+        while (new_count <= fd)
             new_count *= 2;
         tmp_idxplus1_by_fd =
-            realloc(pop->idxplus1_by_fd, new_count * sizeof(int));
+            mm_realloc(pop->idxplus1_by_fd, new_count * sizeof(int));
         if (tmp_idxplus1_by_fd == NULL) {
             event_warn("realloc");
             return (-1);
@@ -276,6 +263,25 @@ poll_add(void* arg, struct event* ev)
         pop->fd_count = new_count;
     }
 
+    return (0);
+}
+
+static int
+poll_add(void* arg, struct event* ev)
+{
+    struct pollop* pop = arg;
+    struct pollfd* pfd = NULL;
+    int i;
+
+    if (ev->ev_events & EV_SIGNAL)
+        return (evsignal_add(ev));
+    if (!(ev->ev_events & (EV_READ | EV_WRITE)))
+        return (0);
+
+    poll_check_ok(pop);
+    if (poll_grow(pop, ev->ev_fd) == -1)
+        return (-1);
+
     i = pop->idxplus1_by_fd[ev->ev_fd] - 1;
     if (i >= 0) {
         pfd = &pop->event_set[i];
@@ -284,18 +290,18 @@ poll_add(void* arg, struct event* ev)
         pfd = &pop->event_set[i];
         pfd->events = 0;
         pfd->fd = ev->ev_fd;
-        pop->event_w_back[i] = pop->event_r_back[i] = NULL;
+        pop->event_back[i].w = pop->event_back[i].r = NULL;
         pop->idxplus1_by_fd[ev->ev_fd] = i + 1;
     }
 
     pfd->revents = 0;
     if (ev->ev_events & EV_WRITE) {
         pfd->events |= POLLOUT;
-        pop->event_w_back[i] = ev;
+        pop->event_back[i].w = ev;
     }
     if (ev->ev_events & EV_READ) {
         pfd->events |= POLLIN;
-        pop->event_r_back[i] = ev;
+        pop->event_back[i].r = ev;
     }
     poll_check_ok(pop);
 
@@ -320,6 +326,8 @@ poll_del(void* arg, struct event* ev)
         return (0);
 
     poll_check_ok(pop);
+    if (ev->ev_fd >= pop->fd_count)
+        return (-1);
     i = pop->idxplus1_by_fd[ev->ev_fd] - 1;
     if (i < 0)
         return (-1);
@@ -328,11 +336,11 @@ poll_del(void* arg, struct event* ev)
     pfd = &pop->event_set[i];
     if (ev->ev_events & EV_READ) {
         pfd->events &= ~POLLIN;
-        pop->event_r_back[i] = NULL;
+        pop->event_back[i].r = NULL;
     }
     if (ev->ev_events & EV_WRITE) {
         pfd->events &= ~POLLOUT;
-        pop->event_w_back[i] = NULL;
+        pop->event_back[i].w = NULL;
     }
     poll_check_ok(pop);
     if (pfd->events)
@@ -348,10 +356,8 @@ poll_del(void* arg, struct event* ev)
          * Shift the last pollfd down into the now-unoccupied
          * position.
          */
-        memcpy(&pop->event_set[i], &pop->event_set[pop->nfds],
-               sizeof(struct pollfd));
-        pop->event_r_back[i] = pop->event_r_back[pop->nfds];
-        pop->event_w_back[i] = pop->event_w_back[pop->nfds];
+        pop->event_set[i] = pop->event_set[pop->nfds];
+        pop->event_back[i] = pop->event_back[pop->nfds];
         pop->idxplus1_by_fd[pop->event_set[i].fd] = i + 1;
     }
 
@@ -365,15 +371,12 @@ poll_dealloc(struct event_base* base, void* arg)
     struct pollop* pop = arg;
 
     evsignal_dealloc(base);
+    /* event_back shares the allocation */
     if (pop->event_set)
-        free(pop->event_set);
-    if (pop->event_r_back)
-        free(pop->event_r_back);
-    if (pop->event_w_back)
-        free(pop->event_w_back);
+        mm_free(pop->event_set);
     if (pop->idxplus1_by_fd)
-        free(pop->idxplus1_by_fd);
+        mm_free(pop->idxplus1_by_fd);
 
     memset(pop, 0, sizeof(struct pollop));
-    free(pop);
+    mm_free(pop);
 }
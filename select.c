@@ -55,6 +55,7 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 #ifndef howmany
 #define        howmany(x, y)   (((x)+((y)-1))/(y))
@@ -69,8 +70,12 @@ typedef unsigned long fd_mask;
 #endif
 
 struct selectop {
-    //select函数中最大的socket值
+    //select函数中最大的socket值，没有任何fd时为-1
     int event_fds;      /* Highest fd in fd set */
+    // 最低的非空字(fd_mask)下标，与event_fds一起界定需要拷贝和扫描的范围
+    int event_loword;
+    // 上一次dispatch拷贝到输出集合的最低字下标，低于它的输出字都为0
+    int event_out_loword;
 
     // 集合中的字节数，1个字节表示8位能存储8个socket，下面四个结合大小都一样
     int event_fdsz;
@@ -85,6 +90,17 @@ struct selectop {
     struct event** event_w_by_fd;
 };
 
+/*
+ * The sets are handled a word at a time rather than through FD_SET and
+ * friends, so that they can grow beyond FD_SETSIZE and so that only the
+ * words between event_loword and the word holding event_fds need to be
+ * copied and scanned on each dispatch.
+ */
+#define SELECT_WORDS(set)   ((fd_mask*)(set))
+#define SELECT_WORD(fd)     ((fd) / NFDBITS)
+/* fd_mask may be a signed long; shift unsigned, as glibc's __FD_MASK does */
+#define SELECT_BIT(fd)      ((fd_mask)(1UL << ((fd) % NFDBITS)))
+
 static void* select_init    (struct event_base*);
 static int select_add       (void*, struct event*);
 static int select_del       (void*, struct event*);
@@ -103,6 +119,38 @@ const struct eventop selectops = {
 
 static int select_resize(struct selectop* sop, int fdsz);
 
+/* index of the lowest set bit, w must not be 0 */
+static inline int
+select_ctz(unsigned long w)
+{
+#if defined(__GNUC__)
+    return (__builtin_ctzl(w));
+#else
+    int n = 0;
+    while (!(w & 1)) {
+        w >>= 1;
+        ++n;
+    }
+    return (n);
+#endif
+}
+
+/* index of the highest set bit, w must not be 0 */
+static inline int
+select_fls(unsigned long w)
+{
+#if defined(__GNUC__)
+    return ((int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(w));
+#else
+    int n = -1;
+    while (w) {
+        w >>= 1;
+        ++n;
+    }
+    return (n);
+#endif
+}
+
 static void*
 select_init(struct event_base* base)
 {
@@ -112,9 +160,10 @@ select_init(struct event_base* base)
     if (evutil_getenv("EVENT_NOSELECT"))
         return (NULL);
 
-    if (!(sop = calloc(1, sizeof(struct selectop))))
+    if (!(sop = mm_calloc(1, sizeof(struct selectop))))
         return (NULL);
 
+    sop->event_fds = -1;
     select_resize(sop, howmany(32 + 1, NFDBITS)*sizeof(fd_mask));
 
     evsignal_init(base);
@@ -126,16 +175,25 @@ select_init(struct event_base* base)
 static void
 check_selectop(struct selectop* sop)
 {
+    fd_mask* rin = SELECT_WORDS(sop->event_readset_in);
+    fd_mask* win = SELECT_WORDS(sop->event_writeset_in);
     int i;
+    if (sop->event_fds >= 0) {
+        i = sop->event_fds;
+        assert((rin[SELECT_WORD(i)] | win[SELECT_WORD(i)]) & SELECT_BIT(i));
+        assert(rin[sop->event_loword] | win[sop->event_loword]);
+        for (i = 0; i < sop->event_loword; ++i)
+            assert(!(rin[i] | win[i]));
+    }
     for (i = 0; i <= sop->event_fds; ++i) {
-        if (FD_ISSET(i, sop->event_readset_in)) {
+        if (rin[SELECT_WORD(i)] & SELECT_BIT(i)) {
             assert(sop->event_r_by_fd[i]);
             assert(sop->event_r_by_fd[i]->ev_events & EV_READ);
             assert(sop->event_r_by_fd[i]->ev_fd == i);
         } else {
             assert(! sop->event_r_by_fd[i]);
         }
-        if (FD_ISSET(i, sop->event_writeset_in)) {
+        if (win[SELECT_WORD(i)] & SELECT_BIT(i)) {
             assert(sop->event_w_by_fd[i]);
             assert(sop->event_w_by_fd[i]->ev_events & EV_WRITE);
             assert(sop->event_w_by_fd[i]->ev_fd == i);
@@ -152,15 +210,38 @@ check_selectop(struct selectop* sop)
 static int
 select_dispatch(struct event_base* base, void* arg, struct timeval* tv)
 {
-    int res, i, j;
+    int res, i, j, lo, hi, nwords;
     struct selectop* sop = arg;
+    fd_mask* rin = SELECT_WORDS(sop->event_readset_in);
+    fd_mask* win = SELECT_WORDS(sop->event_writeset_in);
+    fd_mask* rout = SELECT_WORDS(sop->event_readset_out);
+    fd_mask* wout = SELECT_WORDS(sop->event_writeset_out);
 
     check_selectop(sop);
 
-    memcpy(sop->event_readset_out, sop->event_readset_in,
-           sop->event_fdsz);
-    memcpy(sop->event_writeset_out, sop->event_writeset_in,
-           sop->event_fdsz);
+    /*
+     * Only the populated words are copied.  Words below that range that
+     * were copied on an earlier pass still hold stale results and would
+     * be examined by select(2), so clear them first.  Words above it lie
+     * beyond event_fds and are never looked at.
+     */
+    nwords = 0;
+    lo = hi = 0;
+    if (sop->event_fds >= 0) {
+        lo = sop->event_loword;
+        hi = SELECT_WORD(sop->event_fds);
+        nwords = hi - lo + 1;
+
+        if (sop->event_out_loword < lo) {
+            memset(rout + sop->event_out_loword, 0,
+                   (lo - sop->event_out_loword) * sizeof(fd_mask));
+            memset(wout + sop->event_out_loword, 0,
+                   (lo - sop->event_out_loword) * sizeof(fd_mask));
+        }
+        sop->event_out_loword = lo;
+        memcpy(rout + lo, rin + lo, nwords * sizeof(fd_mask));
+        memcpy(wout + lo, win + lo, nwords * sizeof(fd_mask));
+    }
 
     res = select(sop->event_fds + 1, sop->event_readset_out,
                  sop->event_writeset_out, NULL, tv);
@@ -182,26 +263,45 @@ select_dispatch(struct event_base* base, void* arg, struct timeval* tv)
     event_debug(("%s: select reports %d", __func__, res));
 
     check_selectop(sop);
-    i = random() % (sop->event_fds + 1);
-    for (j = 0; j <= sop->event_fds; ++j) {
-        struct event* r_ev = NULL, *w_ev = NULL;
-        if (++i >= sop->event_fds + 1)
-            i = 0;
-
-        res = 0;
-        if (FD_ISSET(i, sop->event_readset_out)) {
-            r_ev = sop->event_r_by_fd[i];
-            res |= EV_READ;
-        }
-        if (FD_ISSET(i, sop->event_writeset_out)) {
-            w_ev = sop->event_w_by_fd[i];
-            res |= EV_WRITE;
-        }
-        if (r_ev && (res & r_ev->ev_events)) {
-            event_active(r_ev, res & r_ev->ev_events, 1);
-        }
-        if (w_ev && w_ev != r_ev && (res & w_ev->ev_events)) {
-            event_active(w_ev, res & w_ev->ev_events, 1);
+    if (res <= 0 || nwords <= 0)
+        return (0);
+
+    /*
+     * Walk the result words starting from a random one so that low fds
+     * are not always served first, and stop as soon as every ready fd
+     * has been seen.
+     */
+    i = lo + random() % nwords;
+    for (j = 0; j < nwords && res > 0; ++j, ++i) {
+        unsigned long ready;
+        if (i > hi)
+            i = lo;
+
+        ready = (unsigned long)(rout[i] | wout[i]);
+        while (ready) {
+            int bit = select_ctz(ready);
+            int fd = i * NFDBITS + bit;
+            unsigned long mask = 1UL << bit;
+            struct event* r_ev = NULL, *w_ev = NULL;
+            int what = 0;
+
+            ready &= ~mask;
+            if (rout[i] & mask) {
+                r_ev = sop->event_r_by_fd[fd];
+                what |= EV_READ;
+                --res;
+            }
+            if (wout[i] & mask) {
+                w_ev = sop->event_w_by_fd[fd];
+                what |= EV_WRITE;
+                --res;
+            }
+            if (r_ev && (what & r_ev->ev_events)) {
+                event_active(r_ev, what & r_ev->ev_events, 1);
+            }
+            if (w_ev && w_ev != r_ev && (what & w_ev->ev_events)) {
+                event_active(w_ev, what & w_ev->ev_events, 1);
+            }
         }
     }
     check_selectop(sop);
@@ -209,6 +309,37 @@ select_dispatch(struct event_base* base, void* arg, struct timeval* tv)
     return (0);
 }
 
+/*
+ * Recomputes event_fds and event_loword after the fd at either end of
+ * the populated range went away.
+ */
+static void
+select_update_range(struct selectop* sop)
+{
+    fd_mask* rin = SELECT_WORDS(sop->event_readset_in);
+    fd_mask* win = SELECT_WORDS(sop->event_writeset_in);
+    int lo, hi;
+
+    if (sop->event_fds < 0)
+        return;
+
+    lo = sop->event_loword;
+    hi = SELECT_WORD(sop->event_fds);
+    while (hi >= lo && !(rin[hi] | win[hi]))
+        --hi;
+    if (hi < lo) {
+        sop->event_fds = -1;
+        sop->event_loword = 0;
+        return;
+    }
+    while (!(rin[lo] | win[lo]))
+        ++lo;
+
+    sop->event_fds = hi * NFDBITS +
+                     select_fls((unsigned long)(rin[hi] | win[hi]));
+    sop->event_loword = lo;
+}
+
 
 // 将集合调整到fdsz大小
 static int
@@ -232,23 +363,23 @@ select_resize(struct selectop* sop, int fdsz)
     if (sop->event_readset_in)
         check_selectop(sop);
 
-    if ((readset_in = realloc(sop->event_readset_in, fdsz)) == NULL)
+    if ((readset_in = mm_realloc(sop->event_readset_in, fdsz)) == NULL)
         goto error;
     sop->event_readset_in = readset_in;
-    if ((readset_out = realloc(sop->event_readset_out, fdsz)) == NULL)
+    if ((readset_out = mm_realloc(sop->event_readset_out, fdsz)) == NULL)
         goto error;
     sop->event_readset_out = readset_out;
-    if ((writeset_in = realloc(sop->event_writeset_in, fdsz)) == NULL)
+    if ((writeset_in = mm_realloc(sop->event_writeset_in, fdsz)) == NULL)
         goto error;
     sop->event_writeset_in = writeset_in;
-    if ((writeset_out = realloc(sop->event_writeset_out, fdsz)) == NULL)
+    if ((writeset_out = mm_realloc(sop->event_writeset_out, fdsz)) == NULL)
         goto error;
     sop->event_writeset_out = writeset_out;
-    if ((r_by_fd = realloc(sop->event_r_by_fd,
+    if ((r_by_fd = mm_realloc(sop->event_r_by_fd,
                            n_events * sizeof(struct event*))) == NULL)
         goto error;
     sop->event_r_by_fd = r_by_fd;
-    if ((w_by_fd = realloc(sop->event_w_by_fd,
+    if ((w_by_fd = mm_realloc(sop->event_w_by_fd,
                            n_events * sizeof(struct event*))) == NULL)
         goto error;
     sop->event_w_by_fd = w_by_fd;
@@ -257,6 +388,10 @@ select_resize(struct selectop* sop, int fdsz)
            fdsz - sop->event_fdsz);
     memset((char*)sop->event_writeset_in + sop->event_fdsz, 0,
            fdsz - sop->event_fdsz);
+    memset((char*)sop->event_readset_out + sop->event_fdsz, 0,
+           fdsz - sop->event_fdsz);
+    memset((char*)sop->event_writeset_out + sop->event_fdsz, 0,
+           fdsz - sop->event_fdsz);
     memset(sop->event_r_by_fd + n_events_old, 0,
            (n_events - n_events_old) * sizeof(struct event*));
     memset(sop->event_w_by_fd + n_events_old, 0,
@@ -308,18 +443,24 @@ select_add(void* arg, struct event* ev)
 
         //添加进来的fds文件描述符大于当前保存的文件描述符
         //更新sop->event_fds
+        if (sop->event_fds < 0)
+            sop->event_loword = SELECT_WORD(ev->ev_fd);
         sop->event_fds = ev->ev_fd;
     }
+    if (SELECT_WORD(ev->ev_fd) < sop->event_loword)
+        sop->event_loword = SELECT_WORD(ev->ev_fd);
 
     //将不同ev的文件描述符添加到select的不同set中
     //读event添加到readset，写event添加到writeset
     //将文件描述符作为索引，保存到selectop->event_*_by_fd[ev->ev_fd]=ev中
     if (ev->ev_events & EV_READ) {
-        FD_SET(ev->ev_fd, sop->event_readset_in);
+        SELECT_WORDS(sop->event_readset_in)[SELECT_WORD(ev->ev_fd)] |=
+            SELECT_BIT(ev->ev_fd);
         sop->event_r_by_fd[ev->ev_fd] = ev;
     }
     if (ev->ev_events & EV_WRITE) {
-        FD_SET(ev->ev_fd, sop->event_writeset_in);
+        SELECT_WORDS(sop->event_writeset_in)[SELECT_WORD(ev->ev_fd)] |=
+            SELECT_BIT(ev->ev_fd);
         sop->event_w_by_fd[ev->ev_fd] = ev;
     }
     check_selectop(sop);
@@ -346,15 +487,22 @@ select_del(void* arg, struct event* ev)
     }
 
     if (ev->ev_events & EV_READ) {
-        FD_CLR(ev->ev_fd, sop->event_readset_in);
+        SELECT_WORDS(sop->event_readset_in)[SELECT_WORD(ev->ev_fd)] &=
+            ~SELECT_BIT(ev->ev_fd);
         sop->event_r_by_fd[ev->ev_fd] = NULL;
     }
 
     if (ev->ev_events & EV_WRITE) {
-        FD_CLR(ev->ev_fd, sop->event_writeset_in);
+        SELECT_WORDS(sop->event_writeset_in)[SELECT_WORD(ev->ev_fd)] &=
+            ~SELECT_BIT(ev->ev_fd);
         sop->event_w_by_fd[ev->ev_fd] = NULL;
     }
 
+    // 删除的是范围两端的fd时收缩扫描范围
+    if (ev->ev_fd == sop->event_fds ||
+        SELECT_WORD(ev->ev_fd) == sop->event_loword)
+        select_update_range(sop);
+
     check_selectop(sop);
     return (0);
 }
@@ -366,18 +514,18 @@ select_dealloc(struct event_base* base, void* arg)
 
     evsignal_dealloc(base);
     if (sop->event_readset_in)
-        free(sop->event_readset_in);
+        mm_free(sop->event_readset_in);
     if (sop->event_writeset_in)
-        free(sop->event_writeset_in);
+        mm_free(sop->event_writeset_in);
     if (sop->event_readset_out)
-        free(sop->event_readset_out);
+        mm_free(sop->event_readset_out);
     if (sop->event_writeset_out)
-        free(sop->event_writeset_out);
+        mm_free(sop->event_writeset_out);
     if (sop->event_r_by_fd)
-        free(sop->event_r_by_fd);
+        mm_free(sop->event_r_by_fd);
     if (sop->event_w_by_fd)
-        free(sop->event_w_by_fd);
+        mm_free(sop->event_w_by_fd);
 
     memset(sop, 0, sizeof(struct selectop));
-    free(sop);
+    mm_free(sop);
 }
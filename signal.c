@@ -62,6 +62,7 @@
 #include "evsignal.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 struct event_base* evsignal_base = NULL;
 
@@ -170,7 +171,7 @@ _evsignal_set_handler(struct event_base* base,
         int new_max = evsignal + 1;
         event_debug(("%s: evsignal (%d) >= sh_old_max (%d), resizing",
                      __func__, evsignal, sig->sh_old_max));
-        p = realloc(sig->sh_old, new_max * sizeof(*sig->sh_old));
+        p = mm_realloc(sig->sh_old, new_max * sizeof(*sig->sh_old));
         if (p == NULL) {
             event_warn("realloc");
             return (-1);
@@ -184,7 +185,7 @@ _evsignal_set_handler(struct event_base* base,
     }
 
     /* allocate space for previous handler out of dynamic array */
-    sig->sh_old[evsignal] = malloc(sizeof * sig->sh_old[evsignal]);
+    sig->sh_old[evsignal] = mm_malloc(sizeof * sig->sh_old[evsignal]);
     if (sig->sh_old[evsignal] == NULL) {
         event_warn("malloc");
         return (-1);
@@ -199,7 +200,7 @@ _evsignal_set_handler(struct event_base* base,
 
     if (sigaction(evsignal, &sa, sig->sh_old[evsignal]) == -1) {
         event_warn("sigaction");
-        free(sig->sh_old[evsignal]);
+        mm_free(sig->sh_old[evsignal]);
         sig->sh_old[evsignal] = NULL;
         return (-1);
     }
@@ -207,7 +208,7 @@ _evsignal_set_handler(struct event_base* base,
     // 处理没有sigaction API的情况，只需要管理一个回调
     if ((sh = signal(evsignal, handler)) == SIG_ERR) {
         event_warn("signal");
-        free(sig->sh_old[evsignal]);
+        mm_free(sig->sh_old[evsignal]);
         sig->sh_old[evsignal] = NULL;
         return (-1);
     }
@@ -276,7 +277,7 @@ _evsignal_restore_handler(struct event_base* base, int evsignal)
         ret = -1;
     }
 #endif
-    free(sh);
+    mm_free(sh);
 
     return ret;
 }
@@ -380,9 +381,13 @@ evsignal_dealloc(struct event_base* base)
     }
     base->sig.sh_old_max = 0;
 
+    /* another base may take the signals over */
+    if (evsignal_base == base)
+        evsignal_base = NULL;
+
     /* per index frees are handled in evsig_del() */
     if (base->sig.sh_old) {
-        free(base->sig.sh_old);
+        mm_free(base->sig.sh_old);
         base->sig.sh_old = NULL;
     }
 }
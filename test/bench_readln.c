@@ -0,0 +1,141 @@
+/*
+ * Feeds long header lines into an evbuffer in small pieces and reads
+ * them back the way the HTTP parser does: after every piece the line
+ * is asked for again.
+ *
+ *   bench_readln [-l line length] [-c chunk size] [-n lines] [-e style]
+ *
+ * The style is -1 for evbuffer_readline or an evbuffer_eol_style for
+ * evbuffer_readln.  Prints the time per run in microseconds.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <event.h>
+#include <evutil.h>
+
+static int line_length, chunk_size, num_lines, eol_style;
+static char *data;
+static size_t data_len;
+
+static char *
+read_line(struct evbuffer *buf)
+{
+	size_t n;
+
+	if (eol_style < 0)
+		return (evbuffer_readline(buf));
+	return (evbuffer_readln(buf, &n, eol_style));
+}
+
+static struct timeval *
+run_once(struct evbuffer *buf)
+{
+	static struct timeval ts, te;
+	size_t off;
+	int lines = 0;
+	char *line;
+
+	evutil_gettimeofday(&ts, NULL);
+	for (off = 0; off < data_len; off += chunk_size) {
+		size_t len = data_len - off;
+		if (len > (size_t)chunk_size)
+			len = chunk_size;
+		evbuffer_add(buf, data + off, len);
+
+		/* a "\r" and "\n" split by a piece make an extra empty line */
+		while ((line = read_line(buf)) != NULL) {
+			if (*line != '\0')
+				++lines;
+			free(line);
+		}
+	}
+	evutil_gettimeofday(&te, NULL);
+
+	if (lines != num_lines) {
+		fprintf(stderr, "read %d lines instead of %d\n",
+		    lines, num_lines);
+		return (NULL);
+	}
+
+	evutil_timersub(&te, &ts, &te);
+	return (&te);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct evbuffer *buf;
+	struct timeval *tv;
+	char *p;
+	int i, c;
+
+	line_length = 64 * 1024;
+	chunk_size = 100;
+	num_lines = 4;
+	eol_style = -1;
+	while ((c = getopt(argc, argv, "l:c:n:e:")) != -1) {
+		switch (c) {
+		case 'l':
+			line_length = atoi(optarg);
+			break;
+		case 'c':
+			chunk_size = atoi(optarg);
+			break;
+		case 'n':
+			num_lines = atoi(optarg);
+			break;
+		case 'e':
+			eol_style = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (line_length < 1 || chunk_size < 1 || num_lines < 1) {
+		fprintf(stderr, "Sizes must be positive\n");
+		exit(1);
+	}
+
+	/* "X-Header: aaaa...\r\n" lines */
+	data_len = (size_t)num_lines * (line_length + 2);
+	if ((data = malloc(data_len)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (p = data, i = 0; i < num_lines; i++) {
+		memset(p, 'a', line_length);
+		memcpy(p, "X-Header: ", line_length < 10 ? line_length : 10);
+		p += line_length;
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+
+	if ((buf = evbuffer_new()) == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+
+	for (i = 0; i < 25; i++) {
+		tv = run_once(buf);
+		if (tv == NULL)
+			exit(1);
+		fprintf(stdout, "%ld\n",
+			tv->tv_sec * 1000000L + tv->tv_usec);
+	}
+
+	evbuffer_free(buf);
+	free(data);
+
+	exit(0);
+}
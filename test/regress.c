@@ -54,6 +54,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "event.h"
 #include "evutil.h"
@@ -510,8 +511,6 @@ test_simpletimeout(void)
 }
 
 #ifndef WIN32
-extern struct event_base *current_base;
-
 static void
 child_signal_cb(int fd, short event, void *arg)
 {
@@ -909,6 +908,349 @@ test_event_base_new(void)
 	cleanup_test();
 }
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+static void
+post_break_cb(void *arg)
+{
+	struct event_base *base = arg;
+
+	test_ok = 1;
+	event_base_loopbreak(base);
+}
+
+static void *
+post_thread(void *arg)
+{
+	event_base_post(arg, post_break_cb, arg);
+	return (NULL);
+}
+
+static struct bufferevent *group_bev;
+
+static void
+group_echo_cb(struct bufferevent *bev, void *arg)
+{
+	bufferevent_write_buffer(bev, EVBUFFER_INPUT(bev));
+}
+
+static void
+group_assign_cb(struct event_base *base, int fd, void *arg)
+{
+	group_bev = bufferevent_new(fd, group_echo_cb, NULL, NULL, NULL);
+	bufferevent_base_set(base, group_bev);
+	bufferevent_enable(group_bev, EV_READ);
+}
+
+static pthread_t group_threads[2];
+
+static void
+group_each_cb(struct event_base *base, void *arg)
+{
+	struct event_loop_group *group = arg;
+	int i = event_loop_group_get_base(group, 0) == base ? 0 : 1;
+
+	group_threads[i] = pthread_self();
+}
+
+static void
+test_event_loop_group(void)
+{
+	struct event_loop_group *group;
+	struct event_base *base, *b0, *b1;
+	struct event ev;
+	struct timeval tv;
+	pthread_t thread;
+	char buf[16];
+
+	setup_test("Event loop group: ");
+
+	/* a post from another thread wakes up a blocked loop */
+	base = event_base_new();
+	if (event_base_make_notifiable(base) == -1)
+		goto fail;
+	evtimer_set(&ev, timeout_cb, NULL);
+	event_base_set(base, &ev);
+	tv.tv_sec = 10;
+	tv.tv_usec = 0;
+	evtimer_add(&ev, &tv);
+	pthread_create(&thread, NULL, post_thread, base);
+	event_base_dispatch(base);
+	pthread_join(thread, NULL);
+	event_del(&ev);
+	/* the notification alone does not keep the loop running */
+	if (!test_ok || event_base_dispatch(base) != 1)
+		goto fail;
+	event_base_free(base);
+	test_ok = 0;
+
+	group = event_loop_group_new(2, EVENT_LOOP_GROUP_PIN);
+	if (group == NULL || event_loop_group_size(group) != 2)
+		goto fail;
+	b0 = event_loop_group_get_base(group, 0);
+	b1 = event_loop_group_get_base(group, 1);
+	if (b0 == NULL || b1 == NULL || b0 == b1 ||
+	    event_loop_group_get_base(group, 2) != NULL)
+		goto fail;
+
+	if (event_loop_group_run_on_each(group, group_each_cb, group) == -1 ||
+	    pthread_equal(group_threads[0], group_threads[1]) ||
+	    pthread_equal(group_threads[0], pthread_self()))
+		goto fail;
+
+	/* round robin alternates, least connections fills the gaps */
+	if (event_loop_group_pick(group, EVENT_LOOP_ROUND_ROBIN) != b0 ||
+	    event_loop_group_pick(group, EVENT_LOOP_ROUND_ROBIN) != b1 ||
+	    event_loop_group_pick(group, EVENT_LOOP_ROUND_ROBIN) != b0)
+		goto fail;
+	if (event_loop_group_pick(group, EVENT_LOOP_LEAST_CONNECTIONS) != b1)
+		goto fail;
+	event_loop_group_release(group, b0);
+	event_loop_group_release(group, b0);
+	if (event_loop_group_get_load(group, 0) != 0 ||
+	    event_loop_group_get_load(group, 1) != 2)
+		goto fail;
+
+	/* the socket is served from the chosen loop's thread */
+	if (event_loop_group_assign(group, EVENT_LOOP_LEAST_CONNECTIONS,
+		pair[1], group_assign_cb, NULL) != b0)
+		goto fail;
+	/* wait for the echo from the other thread */
+	fcntl(pair[0], F_SETFL, 0);
+	write(pair[0], TEST1, strlen(TEST1) + 1);
+	if (read(pair[0], buf, sizeof(buf)) != strlen(TEST1) + 1 ||
+	    strcmp(buf, TEST1))
+		goto fail;
+
+	if (event_loop_group_stop(group, NULL) == -1)
+		goto fail;
+	bufferevent_free(group_bev);
+	event_loop_group_free(group);
+
+	test_ok = 1;
+	cleanup_test();
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
+/*
+ * a bufferevent moves between the loops of an event_loop_group and
+ * echoes from the thread of whichever loop it is on
+ */
+
+static pthread_t group_echo_threads[2];
+static int group_echoes;
+
+static void
+group_migrate_readcb(struct bufferevent *bev, void *arg)
+{
+	struct event_loop_group *group = arg;
+
+	group_echo_threads[group_echoes++] = pthread_self();
+	bufferevent_write_buffer(bev, EVBUFFER_INPUT(bev));
+	/* the next message is read on the other loop */
+	if (group_echoes == 1 && bufferevent_migrate(bev,
+		event_loop_group_get_base(group, 1), NULL, NULL) == -1)
+		bufferevent_disable(bev, EV_READ);
+}
+
+static void
+group_migrate_assign_cb(struct event_base *base, int fd, void *arg)
+{
+	group_bev = bufferevent_new(fd, group_migrate_readcb, NULL, NULL,
+	    arg);
+	bufferevent_base_set(base, group_bev);
+	bufferevent_enable(group_bev, EV_READ);
+}
+
+static void
+test_bufferevent_migrate_group(void)
+{
+	struct event_loop_group *group;
+	struct event_base *b0, *b1;
+	char buf[16];
+	int i;
+
+	setup_test("Bufferevent migrate between loops: ");
+
+	group = event_loop_group_new(2, 0);
+	if (group == NULL ||
+	    event_loop_group_run_on_each(group, group_each_cb, group) == -1)
+		goto fail;
+	b0 = event_loop_group_get_base(group, 0);
+	b1 = event_loop_group_get_base(group, 1);
+
+	group_echoes = 0;
+	if (event_loop_group_assign(group, EVENT_LOOP_ROUND_ROBIN, pair[1],
+		group_migrate_assign_cb, group) != b0)
+		goto fail;
+
+	fcntl(pair[0], F_SETFL, 0);
+	for (i = 0; i < 2; ++i) {
+		write(pair[0], TEST1, strlen(TEST1) + 1);
+		if (read(pair[0], buf, sizeof(buf)) != strlen(TEST1) + 1 ||
+		    strcmp(buf, TEST1))
+			goto fail;
+	}
+
+	if (event_loop_group_stop(group, NULL) == -1)
+		goto fail;
+	if (group_echoes != 2 ||
+	    !pthread_equal(group_echo_threads[0], group_threads[0]) ||
+	    !pthread_equal(group_echo_threads[1], group_threads[1]) ||
+	    group_bev->ev_read.ev_base != b1)
+		goto fail;
+	bufferevent_free(group_bev);
+	event_loop_group_free(group);
+
+	test_ok = 1;
+	cleanup_test();
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
+static struct event_work_pool *work_pool;
+static struct event_base *work_base;
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t work_main;
+static int work_ran, work_done;
+
+static void
+work_done_cb(void *arg)
+{
+	if (pthread_equal(pthread_self(), work_main))
+		work_done++;
+}
+
+static void
+work_cb(void *arg)
+{
+	pthread_mutex_lock(&work_lock);
+	if (!pthread_equal(pthread_self(), work_main))
+		work_ran++;
+	pthread_mutex_unlock(&work_lock);
+
+	/* a job may hand out more work, which its worker runs first */
+	if (arg != NULL)
+		event_work_submit(work_pool, work_base, work_cb, work_done_cb,
+		    NULL);
+}
+
+static void
+test_event_work_pool(void)
+{
+	int i;
+
+	setup_test("Event work pool: ");
+
+	work_main = pthread_self();
+	work_ran = work_done = 0;
+	work_base = event_base_new();
+	work_pool = event_work_pool_new(3);
+	if (work_pool == NULL ||
+	    event_work_submit(work_pool, work_base, work_cb, work_done_cb,
+		NULL) != -1)
+		goto fail;
+
+	event_base_make_notifiable(work_base);
+	for (i = 0; i < 100; i++) {
+		if (event_work_submit(work_pool, work_base, work_cb,
+			work_done_cb, i % 10 ? NULL : work_base) == -1)
+			goto fail;
+	}
+
+	/* the loop runs until every job has come back */
+	event_base_dispatch(work_base);
+	if (work_ran != 110 || work_done != 110)
+		goto fail;
+
+	event_work_pool_free(work_pool);
+	event_base_free(work_base);
+
+	test_ok = 1;
+	cleanup_test();
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
+static void
+thread_base_once_cb(int fd, short what, void *arg)
+{
+	*(int *)arg = 1;
+}
+
+static void *
+thread_base_thread(void *arg)
+{
+	struct event_base **pbase = arg;
+	struct event_base *base;
+	struct event ev;
+	int fired = 0;
+
+	/* a thread gets its own default base from event_init() */
+	base = event_init();
+	if (current_base != base || base == *pbase)
+		return (NULL);
+
+	evtimer_set(&ev, thread_base_once_cb, &fired);
+	if (ev.ev_base != base)
+		return (NULL);
+	if (event_once(-1, EV_TIMEOUT, thread_base_once_cb, &fired,
+		NULL) == -1)
+		return (NULL);
+	event_dispatch();
+	if (!fired)
+		return (NULL);
+
+	event_base_free(NULL);
+	if (current_base != NULL)
+		return (NULL);
+
+	return (base);
+}
+
+static void
+test_thread_current_base(void)
+{
+	struct event_base *base;
+	pthread_t thread;
+	void *result = NULL;
+
+	setup_test("Per-thread current base: ");
+
+	/* earlier tests may have freed it; NULL would match any thread */
+	if ((base = event_init()) == NULL)
+		goto fail;
+
+	if (pthread_create(&thread, NULL, thread_base_thread, &base) != 0 ||
+	    pthread_join(thread, &result) != 0 || result == NULL)
+		goto fail;
+
+	/* the main thread keeps its own base */
+	if (current_base != base)
+		goto fail;
+	event_base_free(base);
+
+	test_ok = 1;
+	cleanup_test();
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+#endif
+
 static void
 test_loopexit(void)
 {
@@ -1002,6 +1344,73 @@ test_loopbreak(void)
 	cleanup_test();
 }
 
+static void
+busy_poll_cb(int fd, short what, void *arg)
+{
+	int *pcalled = arg;
+
+	(*pcalled)++;
+}
+
+static void
+test_busy_poll(void)
+{
+	struct event ev;
+	struct timeval tv, spin;
+	clock_t start;
+	int called = 0;
+
+	setup_test("Busy poll loop: ");
+
+	spin.tv_sec = 0;
+	spin.tv_usec = 1000000;
+	if (event_base_set_busy_poll(current_base, &spin, 0) != -1 ||
+	    event_base_set_busy_poll(current_base, NULL, -1) != -1)
+		goto fail;
+
+	spin.tv_sec = 5;
+	spin.tv_usec = 0;
+	if (event_base_set_busy_poll(current_base, &spin, 0) == -1)
+		goto fail;
+
+	/* the loop spins on the CPU until the timer fires */
+	tv.tv_sec = 0;
+	tv.tv_usec = 100 * 1000;
+	evtimer_set(&ev, busy_poll_cb, &called);
+	evtimer_add(&ev, &tv);
+	start = clock();
+	event_loop(EVLOOP_ONCE | EVLOOP_BUSY_POLL);
+	if (called != 1 || clock() - start < CLOCKS_PER_SEC / 50)
+		goto fail;
+
+#ifdef SO_BUSY_POLL
+	/* bufferevents get the socket option where the system allows it */
+	if (evutil_make_socket_busy_poll(pair[0], 10) == 0) {
+		struct bufferevent *bev;
+		int usec = 0;
+		socklen_t len = sizeof(usec);
+
+		event_base_set_busy_poll(current_base, NULL, 20);
+		bev = bufferevent_new(pair[0], NULL, NULL, NULL, NULL);
+		getsockopt(pair[0], SOL_SOCKET, SO_BUSY_POLL, (void *)&usec,
+		    &len);
+		bufferevent_free(bev);
+		if (usec != 20)
+			goto fail;
+	}
+#endif
+
+	event_base_set_busy_poll(current_base, NULL, 0);
+
+	test_ok = 1;
+	cleanup_test();
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
 static void
 test_evbuffer(void) {
 
@@ -1218,6 +1627,56 @@ test_evbuffer_readln(void)
 	if (cp) free(cp);
 }
 
+/* a line that arrives in pieces is found where the last search stopped */
+static void
+test_evbuffer_readln_resume(void)
+{
+	struct evbuffer *evb = evbuffer_new();
+	char *cp = NULL;
+	size_t sz;
+
+	fprintf(stdout, "Testing evbuffer_readln in pieces: ");
+
+	evbuffer_add(evb, "piece", 5);
+	if ((cp = evbuffer_readln(evb, &sz, EVBUFFER_EOL_CRLF_STRICT)) != NULL)
+		goto fail;
+	evbuffer_add(evb, "wise\r", 5);
+	if ((cp = evbuffer_readln(evb, &sz, EVBUFFER_EOL_CRLF_STRICT)) != NULL)
+		goto fail;
+	/* another style must not trust the scan done for the last one */
+	cp = evbuffer_readln(evb, &sz, EVBUFFER_EOL_ANY);
+	if (cp == NULL || sz != 9 || strcmp(cp, "piecewise"))
+		goto fail;
+	free(cp);
+
+	/* draining moves the resume point back */
+	evbuffer_add(evb, "x", 1);
+	if ((cp = evbuffer_readln(evb, &sz, EVBUFFER_EOL_LF)) != NULL)
+		goto fail;
+	evbuffer_drain(evb, 1);
+	evbuffer_add(evb, "ab\ncd", 5);
+	cp = evbuffer_readln(evb, &sz, EVBUFFER_EOL_LF);
+	if (cp == NULL || sz != 2 || strcmp(cp, "ab"))
+		goto fail;
+	free(cp);
+
+	if ((cp = evbuffer_readline(evb)) != NULL)
+		goto fail;
+	evbuffer_add(evb, "ef\r\n", 4);
+	cp = evbuffer_readline(evb);
+	if (cp == NULL || strcmp(cp, "cdef") || EVBUFFER_LENGTH(evb) != 0)
+		goto fail;
+	free(cp);
+
+	evbuffer_free(evb);
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
 static void
 test_evbuffer_find(void)
 {
@@ -1273,114 +1732,1187 @@ test_evbuffer_find(void)
 	evbuffer_free(buf);
 }
 
-/*
- * simple bufferevent test
- */
+static int reserve_cb_calls;
 
 static void
-readcb(struct bufferevent *bev, void *arg)
+reserve_cb(struct evbuffer *buf, size_t old_len, size_t new_len, void *arg)
 {
-	if (EVBUFFER_LENGTH(bev->input) == 8333) {
-		bufferevent_disable(bev, EV_READ);
-		test_ok++;
-	}
+	++reserve_cb_calls;
 }
 
 static void
-writecb(struct bufferevent *bev, void *arg)
+test_evbuffer_reserve_space(void)
 {
-	if (EVBUFFER_LENGTH(bev->output) == 0)
-		test_ok++;
-}
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_iovec vec, bad;
+	int n;
+
+	fprintf(stdout, "Testing evbuffer_reserve_space: ");
+
+	evbuffer_add(buf, "head", 4);
+	evbuffer_setcb(buf, reserve_cb, NULL);
+
+	n = evbuffer_reserve_space(buf, 1000, &vec, 1);
+	if (n != 1 || vec.iov_len < 1000)
+		goto fail;
+	memset(vec.iov_base, 'x', 1000);
+	if (EVBUFFER_LENGTH(buf) != 4 || reserve_cb_calls != 0)
+		goto fail;
+
+	/* the space must be committed as it was handed out */
+	bad = vec;
+	bad.iov_base = (char *)bad.iov_base + 1;
+	bad.iov_len = 10;
+	if (evbuffer_commit_space(buf, &bad, 1) != -1)
+		goto fail;
+	bad = vec;
+	bad.iov_len = vec.iov_len + 1;
+	if (evbuffer_commit_space(buf, &bad, 1) != -1)
+		goto fail;
+
+	vec.iov_len = 1000;
+	if (evbuffer_commit_space(buf, &vec, 1) != 0)
+		goto fail;
+	if (EVBUFFER_LENGTH(buf) != 1004 || reserve_cb_calls != 1 ||
+	    memcmp(EVBUFFER_DATA(buf), "headxxx", 7) ||
+	    EVBUFFER_DATA(buf)[1003] != 'x')
+		goto fail;
+
+	/* committing nothing leaves the buffer alone */
+	n = evbuffer_reserve_space(buf, 1, &vec, 1);
+	vec.iov_len = 0;
+	if (n != 1 || evbuffer_commit_space(buf, &vec, 1) != 0 ||
+	    EVBUFFER_LENGTH(buf) != 1004 || reserve_cb_calls != 1)
+		goto fail;
 
-static void
-errorcb(struct bufferevent *bev, short what, void *arg)
-{
-	test_ok = -2;
+	evbuffer_free(buf);
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
 }
 
 static void
-test_bufferevent(void)
+test_evbuffer_peek(void)
 {
-	struct bufferevent *bev1, *bev2;
-	char buffer[8333];
-	int i;
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_iovec vec[2];
+	int n;
 
-	setup_test("Bufferevent: ");
+	fprintf(stdout, "Testing evbuffer_peek: ");
 
-	bev1 = bufferevent_new(pair[0], readcb, writecb, errorcb, NULL);
-	bev2 = bufferevent_new(pair[1], readcb, writecb, errorcb, NULL);
+	if (evbuffer_peek(buf, -1, 0, vec, 2) != 0)
+		goto fail;
 
-	bufferevent_disable(bev1, EV_READ);
-	bufferevent_enable(bev2, EV_READ);
+	evbuffer_add(buf, "0123456789", 10);
+	evbuffer_drain(buf, 2);
 
-	for (i = 0; i < sizeof(buffer); i++)
-		buffer[i] = i;
+	n = evbuffer_peek(buf, -1, 0, vec, 2);
+	if (n != 1 || vec[0].iov_base != EVBUFFER_DATA(buf) ||
+	    vec[0].iov_len != 8)
+		goto fail;
 
-	bufferevent_write(bev1, buffer, sizeof(buffer));
+	n = evbuffer_peek(buf, 3, 4, vec, 2);
+	if (n != 1 || memcmp(vec[0].iov_base, "678", 3) ||
+	    vec[0].iov_len != 3)
+		goto fail;
 
-	event_dispatch();
+	/* asking for more than there is */
+	n = evbuffer_peek(buf, 100, 6, vec, 2);
+	if (n != 1 || memcmp(vec[0].iov_base, "89", 2) ||
+	    vec[0].iov_len != 2)
+		goto fail;
 
-	bufferevent_free(bev1);
-	bufferevent_free(bev2);
+	/* just counting, and past the end */
+	if (evbuffer_peek(buf, -1, 0, NULL, 0) != 1 ||
+	    evbuffer_peek(buf, -1, 8, vec, 2) != 0 ||
+	    evbuffer_peek(buf, 0, 0, vec, 2) != 0)
+		goto fail;
 
-	if (test_ok != 2)
-		test_ok = 0;
+	/* peeking leaves the data in place */
+	if (EVBUFFER_LENGTH(buf) != 8)
+		goto fail;
 
-	cleanup_test();
-}
+	evbuffer_free(buf);
+	fprintf(stdout, "OK\n");
+	return;
 
-/*
- * test watermarks and bufferevent
- */
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
 
 static void
-wm_readcb(struct bufferevent *bev, void *arg)
+test_evbuffer_shrink(void)
 {
-	int len = EVBUFFER_LENGTH(bev->input);
-	static int nread;
-
-	assert(len >= 10 && len <= 20);
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer *other = evbuffer_new();
+	char data[10000];
+	int i;
 
-	evbuffer_drain(bev->input, len);
+	fprintf(stdout, "Testing evbuffer_shrink: ");
+
+	for (i = 0; i < (int)sizeof(data); i++)
+		data[i] = i;
+
+	/* keeps the data, and only the room asked for */
+	evbuffer_add(buf, data, sizeof(data));
+	evbuffer_drain(buf, 9000);
+	if (evbuffer_shrink(buf, 24) == -1 || buf->totallen != 1024 ||
+	    EVBUFFER_LENGTH(buf) != 1000 ||
+	    memcmp(EVBUFFER_DATA(buf), data + 9000, 1000))
+		goto fail;
+	if (evbuffer_shrink(buf, 100) == -1 || buf->totallen != 1024)
+		goto fail;
+
+	evbuffer_drain(buf, 1000);
+	if (evbuffer_shrink(buf, 0) == -1 || buf->totallen != 0 ||
+	    buf->orig_buffer != NULL)
+		goto fail;
+	evbuffer_add(buf, data, 10);
+	if (EVBUFFER_LENGTH(buf) != 10 || memcmp(EVBUFFER_DATA(buf), data, 10))
+		goto fail;
+	evbuffer_drain(buf, 10);
+
+	/* automatically when emptied, but only above the threshold */
+	evbuffer_set_shrink(buf, 4096);
+	evbuffer_add(buf, data, 100);
+	evbuffer_drain(buf, 100);
+	if (buf->totallen == 0)
+		goto fail;
+	evbuffer_add(buf, data, sizeof(data));
+	evbuffer_drain(buf, 5000);
+	if (buf->totallen < sizeof(data))
+		goto fail;
+	evbuffer_drain(buf, 5000);
+	if (buf->totallen != 0 || buf->orig_buffer != NULL)
+		goto fail;
+
+	/* also when the storage is traded away by evbuffer_add_buffer */
+	evbuffer_add(buf, data, 10);
+	evbuffer_add(other, data, sizeof(data));
+	evbuffer_drain(other, sizeof(data));
+	evbuffer_add_buffer(other, buf);
+	if (buf->totallen != 0 || EVBUFFER_LENGTH(other) != 10)
+		goto fail;
+
+	evbuffer_free(other);
+	evbuffer_free(buf);
+	fprintf(stdout, "OK\n");
+	return;
 
-	nread += len;
-	if (nread == 65000) {
-		bufferevent_disable(bev, EV_READ);
-		test_ok++;
-	}
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
 }
 
 static void
-wm_writecb(struct bufferevent *bev, void *arg)
+test_evbuffer_pool(void)
 {
-	if (EVBUFFER_LENGTH(bev->output) == 0)
-		test_ok++;
-}
+	struct event_base *base = event_base_new();
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer *other = evbuffer_new();
+	char data[3000];
+	size_t size, inuse, cached;
+	u_char *block;
+
+	fprintf(stdout, "Testing evbuffer storage pool: ");
+
+	memset(data, 'x', sizeof(data));
+	evbuffer_set_pool(buf, base);
+
+	/* class 2 holds 1 KB blocks */
+	evbuffer_add(buf, data, 1000);
+	if (event_base_get_buffer_stats(base, 2, &size, &inuse, &cached) ||
+	    size != 1024 || inuse != 1024 || cached != 0)
+		goto fail;
+
+	/* growing trades the block for one of the next class that fits */
+	evbuffer_add(buf, data, 2000);
+	if (buf->totallen != 4096 ||
+	    event_base_get_buffer_stats(base, 2, NULL, &inuse, &cached) ||
+	    inuse != 0 || cached != 1024 ||
+	    event_base_get_buffer_stats(base, 4, NULL, &inuse, NULL) ||
+	    inuse != 4096)
+		goto fail;
+
+	evbuffer_drain(buf, EVBUFFER_LENGTH(buf));
+	block = buf->orig_buffer;
+	evbuffer_shrink(buf, 0);
+	if (event_base_get_buffer_stats(base, 4, NULL, &inuse, &cached) ||
+	    inuse != 0 || cached != 4096)
+		goto fail;
+
+	/* the cached block is handed out again */
+	evbuffer_add(buf, data, 3000);
+	if (buf->orig_buffer != block)
+		goto fail;
+
+	/* storage moved to a buffer outside the pool still goes back */
+	evbuffer_add_buffer(other, buf);
+	evbuffer_free(other);
+	if (event_base_get_buffer_stats(base, 4, NULL, &inuse, &cached) ||
+	    inuse != 0 || cached != 4096)
+		goto fail;
+
+	if (event_base_get_buffer_stats(base, EVBUFFER_POOL_CLASSES,
+		NULL, NULL, NULL) != -1)
+		goto fail;
 
-static void
-wm_errorcb(struct bufferevent *bev, short what, void *arg)
-{
-	test_ok = -2;
+	evbuffer_free(buf);
+	event_base_free(base);
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
 }
 
 static void
-test_bufferevent_watermarks(void)
+test_evbuffer_spill(void)
 {
-	struct bufferevent *bev1, *bev2;
-	char buffer[65000];
-	int i;
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer *other = evbuffer_new();
+	char data[1000], back[20000];
+	char *tmpdir;
+	size_t i, n;
+	int j, fds[2];
 
-	setup_test("Bufferevent Watermarks: ");
+	fprintf(stdout, "Testing evbuffer_set_spill: ");
 
-	bev1 = bufferevent_new(pair[0], NULL, wm_writecb, wm_errorcb, NULL);
-	bev2 = bufferevent_new(pair[1], wm_readcb, NULL, wm_errorcb, NULL);
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+		goto fail;
 
-	bufferevent_disable(bev1, EV_READ);
-	bufferevent_enable(bev2, EV_READ);
+	if (evbuffer_set_spill(buf, 4096) == -1)
+		goto fail;
 
-	for (i = 0; i < sizeof(buffer); i++)
-		buffer[i] = i;
+	/* 100 blocks that differ from each other */
+	for (j = 0; j < 100; j++) {
+		memset(data, j, sizeof(data));
+		evbuffer_add(buf, data, sizeof(data));
+		if (j == 0 && buf->spill->mapped)
+			goto fail;
+	}
+	if (!buf->spill->mapped || buf->spill->fd == -1 ||
+	    EVBUFFER_LENGTH(buf) != 100000)
+		goto fail;
+	for (i = 0; i < 100000; i++)
+		if (EVBUFFER_DATA(buf)[i] != i / 1000)
+			goto fail;
+
+	/* growing after a drain keeps the data in order */
+	evbuffer_drain(buf, 50500);
+	memset(data, 100, sizeof(data));
+	for (j = 0; j < 60; j++)
+		evbuffer_add(buf, data, sizeof(data));
+	if (!buf->spill->mapped || EVBUFFER_LENGTH(buf) != 109500 ||
+	    EVBUFFER_DATA(buf)[0] != 50 || EVBUFFER_DATA(buf)[499] != 50 ||
+	    EVBUFFER_DATA(buf)[500] != 51 || EVBUFFER_DATA(buf)[109499] != 100)
+		goto fail;
+
+	/* writing goes straight from the file */
+	if (evbuffer_write_atmost(buf, fds[0], sizeof(back)) != sizeof(back))
+		goto fail;
+	for (n = 0; n < sizeof(back); n += j) {
+		j = read(fds[1], back + n, sizeof(back) - n);
+		if (j <= 0)
+			goto fail;
+	}
+	if (back[0] != 50 || back[500] != 51 || back[19999] != 70 ||
+	    EVBUFFER_DATA(buf)[0] != 70)
+		goto fail;
+
+	/* moving it elsewhere copies instead of taking the mapping */
+	evbuffer_add_buffer(other, buf);
+	if (other->spill != NULL || EVBUFFER_LENGTH(buf) != 0 ||
+	    EVBUFFER_LENGTH(other) != 89500 || EVBUFFER_DATA(other)[0] != 70)
+		goto fail;
+
+	/* small again, so back into memory */
+	for (j = 0; j < 11; j++)
+		evbuffer_add(buf, data, sizeof(data));
+	if (!buf->spill->mapped)
+		goto fail;
+	evbuffer_drain(buf, 10000);
+	evbuffer_shrink(buf, 0);
+	if (buf->spill->mapped || EVBUFFER_LENGTH(buf) != 1000 ||
+	    EVBUFFER_DATA(buf)[999] != 100)
+		goto fail;
+
+#ifndef WIN32
+	/* without room for the file the data stays in memory */
+	tmpdir = getenv("TMPDIR");
+	if (tmpdir != NULL)
+		tmpdir = strdup(tmpdir);
+	setenv("TMPDIR", "/nonexistent/libevent", 1);
+	evbuffer_set_spill(other, 4096);
+	for (j = 0; j < 10; j++)
+		if (evbuffer_add(other, data, sizeof(data)) == -1)
+			goto fail;
+	if (tmpdir != NULL) {
+		setenv("TMPDIR", tmpdir, 1);
+		free(tmpdir);
+	} else
+		unsetenv("TMPDIR");
+	if (other->spill->mapped || EVBUFFER_LENGTH(other) != 99500)
+		goto fail;
+#endif
+
+	EVUTIL_CLOSESOCKET(fds[0]);
+	EVUTIL_CLOSESOCKET(fds[1]);
+	evbuffer_free(other);
+	evbuffer_free(buf);
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
+static int mem_live, mem_calls;
+
+static void *
+count_malloc(size_t sz)
+{
+	++mem_calls;
+	++mem_live;
+	return (malloc(sz));
+}
+
+static void *
+count_realloc(void *p, size_t sz)
+{
+	++mem_calls;
+	if (p == NULL)
+		++mem_live;
+	return (realloc(p, sz));
+}
+
+static void
+count_free(void *p)
+{
+	++mem_calls;
+	if (p != NULL)
+		--mem_live;
+	free(p);
+}
+
+static void
+test_mem_functions(void)
+{
+	struct event_base *base;
+	struct evbuffer *buf;
+	struct bufferevent *bev;
+	struct msg *msg;
+	char *line;
+
+	fprintf(stdout, "Testing event_set_mem_functions: ");
+
+	event_set_mem_functions(count_malloc, count_realloc, count_free);
+	mem_live = mem_calls = 0;
+
+	base = event_base_new();
+	bev = bufferevent_new(-1, NULL, NULL, NULL, NULL);
+	bufferevent_base_set(base, bev);
+	evbuffer_add(bev->output, "line\n", 5);
+
+	buf = evbuffer_new();
+	evbuffer_add_printf(buf, "%s\n", "a line");
+	line = evbuffer_readline(buf);
+	if (line == NULL || strcmp(line, "a line"))
+		goto fail;
+	event_mm_free(line);
+
+	msg = msg_new();
+	EVTAG_ASSIGN(msg, from_name, "niels");
+	msg_free(msg);
+
+	evbuffer_free(buf);
+	bufferevent_free(bev);
+	event_base_free(base);
+
+	event_set_mem_functions(NULL, NULL, NULL);
+
+	/* everything allocated went through the hooks and came back */
+	if (mem_calls == 0 || mem_live != 0)
+		goto fail;
+
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	event_set_mem_functions(NULL, NULL, NULL);
+	fprintf(stdout, "FAILED (%d blocks left)\n", mem_live);
+	exit(1);
+}
+
+static u_char *
+naive_search(u_char *data, size_t datlen, const u_char *what, size_t len)
+{
+	size_t i;
+	for (i = 0; i + len <= datlen; ++i)
+		if (memcmp(data + i, what, len) == 0)
+			return (data + i);
+	return (NULL);
+}
+
+static void
+test_evbuffer_search(void)
+{
+	struct evbuffer *buf = evbuffer_new();
+	const char *boundary = "\r\n--boundary42";
+	size_t blen = strlen(boundary);
+	unsigned int seed = 1;
+	u_char *p, *data;
+	size_t i, start;
+
+	fprintf(stdout, "Testing evbuffer_search: ");
+
+	evbuffer_add(buf, "abcabcabd", 9);
+	p = evbuffer_search(buf, (u_char *)"abc", 3, 0);
+	if (p != EVBUFFER_DATA(buf))
+		goto fail;
+	p = evbuffer_search(buf, (u_char *)"abc", 3, 1);
+	if (p != EVBUFFER_DATA(buf) + 3)
+		goto fail;
+	p = evbuffer_search(buf, (u_char *)"abc", 3, 4);
+	if (p != NULL)
+		goto fail;
+	p = evbuffer_search(buf, (u_char *)"abd", 3, 6);
+	if (p != EVBUFFER_DATA(buf) + 6)
+		goto fail;
+	if (evbuffer_search(buf, (u_char *)"d", 1, 9) != NULL ||
+	    evbuffer_search(buf, (u_char *)"a", 1, 10) != NULL)
+		goto fail;
+	evbuffer_drain(buf, EVBUFFER_LENGTH(buf));
+
+	/* a multipart-like body with lots of near misses */
+	for (i = 0; i < 64 * 1024; ++i) {
+		u_char c;
+		seed = seed * 1103515245 + 12345;
+		switch ((seed >> 16) % 8) {
+		case 0: c = '\r'; break;
+		case 1: c = '\n'; break;
+		case 2: c = '-'; break;
+		case 3: c = 'b'; break;
+		default: c = 'a' + (seed >> 20) % 26; break;
+		}
+		evbuffer_add(buf, &c, 1);
+		if (i % 9973 == 9000)
+			evbuffer_add(buf, boundary, blen);
+	}
+	evbuffer_add(buf, boundary, blen - 1);
+
+	data = EVBUFFER_DATA(buf);
+	start = 0;
+	do {
+		u_char *expect = naive_search(data + start,
+		    EVBUFFER_LENGTH(buf) - start, (u_char *)boundary, blen);
+		p = evbuffer_search(buf, (u_char *)boundary, blen, start);
+		if (p != expect)
+			goto fail;
+		/* short needles take the other path */
+		expect = naive_search(data + start,
+		    EVBUFFER_LENGTH(buf) - start, (u_char *)"\r\n-", 3);
+		if (evbuffer_search(buf, (u_char *)"\r\n-", 3, start) != expect)
+			goto fail;
+		if (p != NULL)
+			start = p - data + 1;
+	} while (p != NULL);
+
+	/* the truncated boundary at the end completes */
+	evbuffer_add(buf, boundary + blen - 1, 1);
+	p = evbuffer_search(buf, (u_char *)boundary, blen, start);
+	if (p == NULL || p + blen != EVBUFFER_DATA(buf) + EVBUFFER_LENGTH(buf))
+		goto fail;
+
+	evbuffer_free(buf);
+	fprintf(stdout, "OK\n");
+	return;
+
+fail:
+	fprintf(stdout, "FAILED\n");
+	exit(1);
+}
+
+/*
+ * simple bufferevent test
+ */
+
+static void
+readcb(struct bufferevent *bev, void *arg)
+{
+	if (EVBUFFER_LENGTH(bev->input) == 8333) {
+		bufferevent_disable(bev, EV_READ);
+		test_ok++;
+	}
+}
+
+static void
+writecb(struct bufferevent *bev, void *arg)
+{
+	if (EVBUFFER_LENGTH(bev->output) == 0)
+		test_ok++;
+}
+
+static void
+errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = -2;
+}
+
+static void
+test_bufferevent(void)
+{
+	struct bufferevent *bev1, *bev2;
+	char buffer[8333];
+	int i;
+
+	setup_test("Bufferevent: ");
+
+	bev1 = bufferevent_new(pair[0], readcb, writecb, errorcb, NULL);
+	bev2 = bufferevent_new(pair[1], readcb, writecb, errorcb, NULL);
+
+	bufferevent_disable(bev1, EV_READ);
+	bufferevent_enable(bev2, EV_READ);
+
+	for (i = 0; i < sizeof(buffer); i++)
+		buffer[i] = i;
+
+	bufferevent_write(bev1, buffer, sizeof(buffer));
+
+	event_dispatch();
+
+	bufferevent_free(bev1);
+	bufferevent_free(bev2);
+
+	if (test_ok != 2)
+		test_ok = 0;
+
+	cleanup_test();
+}
+
+/*
+ * reads into an empty input buffer borrow from the base's receive pool
+ * and an idle bufferevent holds no input storage
+ */
+
+static void
+pool_readcb(struct bufferevent *bev, void *arg)
+{
+	char buf[64];
+
+	if (bufferevent_read(bev, buf, sizeof(buf)) != strlen(TEST1) + 1 ||
+	    strcmp(buf, TEST1) != 0)
+		return;
+
+	if (bev->input->orig_buffer == NULL && bev->input->totallen == 0)
+		test_ok = 1;
+	bufferevent_disable(bev, EV_READ);
+}
+
+static void
+pool_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = 0;
+}
+
+static void
+test_bufferevent_pooled_read(void)
+{
+	struct bufferevent *bev;
+
+	setup_test("Bufferevent pooled read: ");
+
+	bev = bufferevent_new(pair[1], pool_readcb, NULL, pool_errorcb, NULL);
+	bufferevent_enable(bev, EV_READ);
+
+	if (write(pair[0], TEST1, strlen(TEST1) + 1) < 0) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_dispatch();
+
+	bufferevent_free(bev);
+
+	cleanup_test();
+}
+
+/*
+ * relay data between two socketpairs with bufferevent_pair_splice
+ */
+
+static char splice_wbuf[65000];
+static int splice_woff, splice_roff;
+
+static void
+splice_client_writecb(int fd, short event, void *arg)
+{
+	struct event *ev = arg;
+	int n;
+
+	n = write(fd, splice_wbuf + splice_woff,
+	    sizeof(splice_wbuf) - splice_woff);
+	if (n > 0)
+		splice_woff += n;
+	if (splice_woff < sizeof(splice_wbuf))
+		event_add(ev, NULL);
+}
+
+static void
+splice_server_readcb(int fd, short event, void *arg)
+{
+	struct event *ev = arg;
+	char buf[4096];
+	int n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n <= 0)
+		return;
+	if (memcmp(buf, splice_wbuf + splice_roff, n) != 0)
+		return;
+	splice_roff += n;
+	if (splice_roff < sizeof(splice_wbuf)) {
+		event_add(ev, NULL);
+		return;
+	}
+
+	test_ok = 1;
+	event_loopexit(NULL);
+}
+
+static void
+splice_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = 0;
+	event_loopexit(NULL);
+}
+
+static void
+test_bufferevent_splice(size_t highmark)
+{
+	struct bufferevent *a, *b;
+	struct event wev, rev;
+	int pair2[2];
+	int i;
+
+	setup_test(highmark ? "Bufferevent splice (watermark): " :
+	    "Bufferevent splice: ");
+
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair2) == -1) {
+		fprintf(stderr, "%s: socketpair\n", __func__);
+		exit(1);
+	}
+	evutil_make_socket_nonblocking(pair2[0]);
+	evutil_make_socket_nonblocking(pair2[1]);
+
+	for (i = 0; i < sizeof(splice_wbuf); i++)
+		splice_wbuf[i] = i * 7;
+	splice_woff = splice_roff = 0;
+
+	/* pair[0] is the client, pair2[1] the server */
+	a = bufferevent_new(pair[1], NULL, NULL, splice_errorcb, NULL);
+	b = bufferevent_new(pair2[0], NULL, NULL, splice_errorcb, NULL);
+	if (highmark) {
+		bufferevent_setwatermark(a, EV_READ, 0, highmark);
+		bufferevent_setwatermark(b, EV_READ, 0, highmark);
+	}
+	bufferevent_enable(a, EV_READ);
+	bufferevent_enable(b, EV_READ);
+
+	/* data that is already buffered must be relayed first */
+	evbuffer_add(a->input, splice_wbuf, 10);
+	splice_woff = 10;
+
+	if (bufferevent_pair_splice(a, b) == -1)
+		goto done;
+
+	event_set(&wev, pair[0], EV_WRITE, splice_client_writecb, &wev);
+	event_set(&rev, pair2[1], EV_READ, splice_server_readcb, &rev);
+	event_add(&wev, NULL);
+	event_add(&rev, NULL);
+
+	event_dispatch();
+
+	event_del(&wev);
+	event_del(&rev);
+
+done:
+	bufferevent_free(a);
+	bufferevent_free(b);
+	close(pair2[0]);
+	close(pair2[1]);
+
+	cleanup_test();
+}
+
+static void
+test_bufferevent_splice_unlink(void)
+{
+	struct bufferevent *a, *b;
+	int pair2[2];
+	char buf[64];
+
+	setup_test("Bufferevent splice unlink: ");
+
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair2) == -1) {
+		fprintf(stderr, "%s: socketpair\n", __func__);
+		exit(1);
+	}
+	evutil_make_socket_nonblocking(pair2[0]);
+	evutil_make_socket_nonblocking(pair2[1]);
+
+	a = bufferevent_new(pair[1], NULL, NULL, splice_errorcb, NULL);
+	b = bufferevent_new(pair2[0], NULL, NULL, splice_errorcb, NULL);
+	bufferevent_enable(a, EV_READ);
+	bufferevent_disable(b, EV_WRITE);
+	if (bufferevent_pair_splice(a, b) == -1)
+		goto done;
+
+	/* a reads the data, but b does not get to write it */
+	write(pair[0], TEST1, strlen(TEST1) + 1);
+	event_loop(EVLOOP_ONCE);
+
+	/* what a has read already must still go out through b */
+	bufferevent_free(a);
+	a = NULL;
+	bufferevent_enable(b, EV_WRITE);
+	event_loop(EVLOOP_ONCE);
+
+	if (read(pair2[1], buf, sizeof(buf)) == strlen(TEST1) + 1 &&
+	    strcmp(buf, TEST1) == 0)
+		test_ok = 1;
+
+done:
+	if (a != NULL)
+		bufferevent_free(a);
+	bufferevent_free(b);
+	close(pair2[0]);
+	close(pair2[1]);
+
+	cleanup_test();
+}
+
+/*
+ * limit reading by a group bucket and writing by a per-bufferevent bucket
+ */
+
+#define RATE_TOTAL	4000
+#define RATE_GROUP	400
+
+static struct bufferevent_rate_limit_group *rate_group;
+static int rate_nread, rate_toobig;
+
+static void
+rate_readcb(struct bufferevent *bev, void *arg)
+{
+	int len = EVBUFFER_LENGTH(bev->input);
+
+	if (len > RATE_GROUP)
+		rate_toobig = 1;
+	evbuffer_drain(bev->input, len);
+	rate_nread += len;
+
+	if (rate_nread == RATE_TOTAL) {
+		bufferevent_disable(bev, EV_READ);
+		/* the group timer would keep the loop running */
+		bufferevent_rate_limit_group_free(rate_group);
+		rate_group = NULL;
+		if (!rate_toobig)
+			test_ok = 1;
+	}
+}
+
+static void
+rate_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = 0;
+}
+
+static void
+test_bufferevent_rate_limit(void)
+{
+	struct bufferevent *rbev, *wbev;
+	struct timeval tick = { 0, 50000 }, start, end, elapsed;
+	char buf[RATE_TOTAL];
+
+	setup_test("Bufferevent rate limit: ");
+
+	memset(buf, 'x', sizeof(buf));
+	rate_nread = rate_toobig = 0;
+
+	rbev = bufferevent_new(pair[1], rate_readcb, NULL, rate_errorcb, NULL);
+	wbev = bufferevent_new(pair[0], NULL, NULL, rate_errorcb, NULL);
+
+	rate_group = bufferevent_rate_limit_group_new(NULL,
+	    RATE_GROUP, 0, &tick);
+	if (rate_group == NULL ||
+	    bufferevent_set_rate_limit(rbev, 1000, 0, &tick) == -1 ||
+	    bufferevent_add_to_rate_limit_group(rbev, rate_group) == -1 ||
+	    bufferevent_set_rate_limit(wbev, 0, 1000, &tick) == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	bufferevent_enable(rbev, EV_READ);
+	bufferevent_write(wbev, buf, sizeof(buf));
+
+	evutil_gettimeofday(&start, NULL);
+	event_dispatch();
+	evutil_gettimeofday(&end, NULL);
+
+	/* ten ticks worth of group bandwidth */
+	evutil_timersub(&end, &start, &elapsed);
+	if (elapsed.tv_sec == 0 && elapsed.tv_usec < 400000)
+		test_ok = 0;
+
+	bufferevent_free(rbev);
+	bufferevent_free(wbev);
+
+	cleanup_test();
+}
+
+/*
+ * a read timeout shorter than a second
+ */
+
+static void
+timeout_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	if (what == (EVBUFFER_READ | EVBUFFER_TIMEOUT))
+		test_ok = 1;
+}
+
+static void
+test_bufferevent_timeout(void)
+{
+	struct bufferevent *bev;
+	struct timeval tv = { 0, 100000 }, start, end, elapsed;
+
+	setup_test("Bufferevent millisecond timeout: ");
+
+	bev = bufferevent_new(pair[1], NULL, NULL, timeout_errorcb, NULL);
+	bufferevent_set_timeouts(bev, &tv, NULL);
+	bufferevent_enable(bev, EV_READ);
+
+	evutil_gettimeofday(&start, NULL);
+	event_dispatch();
+	evutil_gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &elapsed);
+	if (elapsed.tv_sec != 0 || elapsed.tv_usec < 90000)
+		test_ok = 0;
+
+	bufferevent_free(bev);
+
+	cleanup_test();
+}
+
+/*
+ * deferred callbacks run once at the end of the loop iteration
+ */
+
+static int deferred_ncalls;
+static size_t deferred_old, deferred_new;
+
+static void
+deferred_buffer_cb(struct evbuffer *buf, size_t old, size_t now, void *arg)
+{
+	deferred_ncalls++;
+	deferred_old = old;
+	deferred_new = now;
+}
+
+static void
+deferred_add_cb(int fd, short what, void *arg)
+{
+	struct evbuffer *buf = arg;
+	int i;
+
+	for (i = 0; i < 10; i++)
+		evbuffer_add(buf, "0123456789", 10);
+
+	/* nothing has been delivered yet */
+	if (deferred_ncalls != 0)
+		test_ok = -1;
+}
+
+static void
+deferred_readcb(struct bufferevent *bev, void *arg)
+{
+	char buf[64];
+
+	deferred_ncalls++;
+	if (bufferevent_read(bev, buf, sizeof(buf)) == strlen(TEST1) + 1 &&
+	    strcmp(buf, TEST1) == 0 && test_ok == 0)
+		test_ok = 1;
+
+	/* freeing from a deferred callback is allowed */
+	bufferevent_free(bev);
+}
+
+static void
+deferred_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = -1;
+}
+
+static void
+test_bufferevent_deferred(void)
+{
+	struct evbuffer *buf;
+	struct bufferevent *bev;
+	struct timeval tv = { 0, 0 };
+
+	setup_test("Bufferevent deferred callbacks: ");
+
+	deferred_ncalls = 0;
+	buf = evbuffer_new();
+	evbuffer_setcb(buf, deferred_buffer_cb, NULL);
+	evbuffer_defer_callbacks(buf, current_base);
+
+	event_once(-1, EV_TIMEOUT, deferred_add_cb, buf, &tv);
+	event_dispatch();
+
+	if (deferred_ncalls != 1 || deferred_old != 0 || deferred_new != 100)
+		test_ok = -1;
+	evbuffer_free(buf);
+
+	deferred_ncalls = 0;
+	bev = bufferevent_new(pair[1], deferred_readcb, NULL,
+	    deferred_errorcb, NULL);
+	bufferevent_set_deferred_callbacks(bev, 1);
+	bufferevent_enable(bev, EV_READ);
+
+	if (write(pair[0], TEST1, strlen(TEST1) + 1) < 0) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_loop(EVLOOP_ONCE);
+
+	if (deferred_ncalls != 1)
+		test_ok = 0;
+
+	cleanup_test();
+}
+
+/*
+ * eager writes reach the socket before the loop runs
+ */
+
+static void
+eager_writecb(struct bufferevent *bev, void *arg)
+{
+	if (EVBUFFER_LENGTH(bev->output) == 0 && test_ok == 1)
+		test_ok = 2;
+}
+
+static void
+eager_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = 0;
+}
+
+static void
+test_bufferevent_eager_write(void)
+{
+	struct bufferevent *bev;
+	char buf[64];
+
+	setup_test("Bufferevent eager write: ");
+
+	bev = bufferevent_new(pair[0], NULL, eager_writecb, eager_errorcb,
+	    NULL);
+	bufferevent_set_eager_write(bev, 1);
+	bufferevent_write(bev, TEST1, strlen(TEST1) + 1);
+
+	/* the data is on the wire and EV_WRITE was never armed */
+	if (recv(pair[1], buf, sizeof(buf), MSG_DONTWAIT) ==
+	    strlen(TEST1) + 1 && strcmp(buf, TEST1) == 0 &&
+	    !(bev->ev_write.ev_flags & EVLIST_INSERTED))
+		test_ok = 1;
+
+	event_dispatch();
+
+	if (test_ok == 2)
+		test_ok = 1;
+	else
+		test_ok = 0;
+
+	bufferevent_free(bev);
+
+	cleanup_test();
+}
+
+/*
+ * corked writes are held back until the uncork or the end of the
+ * loop iteration
+ */
+
+static void
+cork_write_cb(int fd, short what, void *arg)
+{
+	struct bufferevent *bev = arg;
+
+	/* never uncorked; the end of the iteration takes care of it */
+	bufferevent_cork(bev);
+	bufferevent_write(bev, "def", 3);
+	bufferevent_write(bev, "ghi", 4);
+}
+
+static void
+test_bufferevent_cork(void)
+{
+	struct bufferevent *bev;
+	struct timeval tv = { 0, 0 };
+	char buf[64];
+
+	setup_test("Bufferevent cork: ");
+
+	bev = bufferevent_new(pair[0], NULL, NULL, eager_errorcb, NULL);
+
+	bufferevent_cork(bev);
+	bufferevent_write(bev, "a", 1);
+	bufferevent_write(bev, "bc", 2);
+	if (recv(pair[1], buf, sizeof(buf), MSG_DONTWAIT) != -1 ||
+	    event_pending(&bev->ev_write, EV_WRITE, NULL))
+		goto done;
+	bufferevent_uncork(bev);
+
+	event_once(-1, EV_TIMEOUT, cork_write_cb, bev, &tv);
+	event_dispatch();
+
+	if (recv(pair[1], buf, sizeof(buf), MSG_DONTWAIT) == 10 &&
+	    strcmp(buf, "abcdefghi") == 0)
+		test_ok = 1;
+
+done:
+	bufferevent_free(bev);
+
+	cleanup_test();
+}
+
+/*
+ * a bufferevent moved to another base keeps reading there
+ */
+
+static int migrate_done;
+
+static void
+migrate_cb(struct bufferevent *bev, void *arg)
+{
+	migrate_done = 1;
+}
+
+static void
+migrate_readcb(struct bufferevent *bev, void *arg)
+{
+	struct event_base *base = arg;
+	char buf[64];
+
+	if (bev->ev_read.ev_base == base &&
+	    bufferevent_read(bev, buf, sizeof(buf)) == strlen(TEST1) + 1 &&
+	    strcmp(buf, TEST1) == 0)
+		test_ok = 1;
+	bufferevent_disable(bev, EV_READ);
+}
+
+static void
+test_bufferevent_migrate(void)
+{
+	struct event_base *base;
+	struct bufferevent *bev;
+	struct timeval tv = { 10, 0 }, expiry, now;
+
+	setup_test("Bufferevent migrate: ");
+
+	base = event_base_new();
+	migrate_done = 0;
+
+	bev = bufferevent_new(pair[1], migrate_readcb, NULL, eager_errorcb,
+	    base);
+	bufferevent_set_timeouts(bev, &tv, NULL);
+	bufferevent_enable(bev, EV_READ);
+
+	/* base is not notifiable, so the move is done on return */
+	if (bufferevent_migrate(bev, base, migrate_cb, NULL) == -1 ||
+	    !migrate_done || event_base_loop(current_base, EVLOOP_NONBLOCK) != 1)
+		goto done;
+
+	/* the read timeout was carried over, not started again */
+	evutil_gettimeofday(&now, NULL);
+	if (!event_pending(&bev->ev_read, EV_READ | EV_TIMEOUT, &expiry) ||
+	    expiry.tv_sec > now.tv_sec + 10)
+		goto done;
+
+	if (write(pair[0], TEST1, strlen(TEST1) + 1) < 0)
+		goto done;
+	event_base_dispatch(base);
+
+done:
+	bufferevent_free(bev);
+	event_base_free(base);
+
+	cleanup_test();
+}
+
+/*
+ * test watermarks and bufferevent
+ */
+
+static void
+wm_readcb(struct bufferevent *bev, void *arg)
+{
+	int len = EVBUFFER_LENGTH(bev->input);
+	static int nread;
+
+	assert(len >= 10 && len <= 20);
+
+	evbuffer_drain(bev->input, len);
+
+	nread += len;
+	if (nread == 65000) {
+		bufferevent_disable(bev, EV_READ);
+		test_ok++;
+	}
+}
+
+static void
+wm_writecb(struct bufferevent *bev, void *arg)
+{
+	if (EVBUFFER_LENGTH(bev->output) == 0)
+		test_ok++;
+}
+
+static void
+wm_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	test_ok = -2;
+}
+
+static void
+test_bufferevent_watermarks(void)
+{
+	struct bufferevent *bev1, *bev2;
+	char buffer[65000];
+	int i;
+
+	setup_test("Bufferevent Watermarks: ");
+
+	bev1 = bufferevent_new(pair[0], NULL, wm_writecb, wm_errorcb, NULL);
+	bev2 = bufferevent_new(pair[1], wm_readcb, NULL, wm_errorcb, NULL);
+
+	bufferevent_disable(bev1, EV_READ);
+	bufferevent_enable(bev2, EV_READ);
+
+	for (i = 0; i < sizeof(buffer); i++)
+		buffer[i] = i;
 
 	bufferevent_write(bev1, buffer, sizeof(buffer));
 
@@ -1678,6 +3210,47 @@ evtag_tag_encoding(void)
 	fprintf(stdout, "\t%s: OK\n", __func__);
 }
 
+static void
+evtag_marshal_test(void)
+{
+	struct evbuffer *tmp = evbuffer_new();
+	uint32_t integers[TEST_MAX_INT] = {
+		0xaf0, 0x1000, 0x1, 0xdeadbeef, 0x00, 0xbef000
+	};
+	uint32_t integer;
+	struct timeval tv;
+	int i;
+
+	for (i = 0; i < TEST_MAX_INT; i++) {
+		evtag_marshal_int(tmp, 0x1000 + i, integers[i]);
+		tv.tv_sec = integers[i];
+		tv.tv_usec = i * 100000;
+		evtag_marshal_timeval(tmp, i, &tv);
+	}
+
+	for (i = 0; i < TEST_MAX_INT; i++) {
+		if (evtag_unmarshal_int(tmp, 0x1000 + i, &integer) == -1 ||
+		    integer != integers[i]) {
+			fprintf(stderr, "int %d failed", i);
+			exit(1);
+		}
+		if (evtag_unmarshal_timeval(tmp, i, &tv) == -1 ||
+		    (uint32_t)tv.tv_sec != integers[i] ||
+		    tv.tv_usec != i * 100000) {
+			fprintf(stderr, "timeval %d failed", i);
+			exit(1);
+		}
+	}
+
+	if (EVBUFFER_LENGTH(tmp) != 0) {
+		fprintf(stderr, "trailing data");
+		exit(1);
+	}
+	evbuffer_free(tmp);
+
+	fprintf(stdout, "\t%s: OK\n", __func__);
+}
+
 static void
 evtag_test(void)
 {
@@ -1688,6 +3261,7 @@ evtag_test(void)
 	evtag_fuzz();
 
 	evtag_tag_encoding();
+	evtag_marshal_test();
 
 	fprintf(stdout, "OK\n");
 }
@@ -1839,14 +3413,40 @@ main (int argc, char **argv)
 
 	test_evbuffer();
 	test_evbuffer_find();
+	test_evbuffer_search();
+	test_evbuffer_reserve_space();
+	test_evbuffer_peek();
+	test_evbuffer_shrink();
+	test_evbuffer_pool();
+	test_evbuffer_spill();
+	test_mem_functions();
 	test_evbuffer_readln();
+	test_evbuffer_readln_resume();
 	
 	test_bufferevent();
 	test_bufferevent_watermarks();
+	test_bufferevent_pooled_read();
+	test_bufferevent_splice(0);
+	test_bufferevent_splice(1000);
+	/* larger than the default pipe */
+	test_bufferevent_splice(1 << 20);
+	test_bufferevent_splice_unlink();
+	test_bufferevent_rate_limit();
+	test_bufferevent_timeout();
+	test_bufferevent_deferred();
+	test_bufferevent_eager_write();
+	test_bufferevent_cork();
+	test_bufferevent_migrate();
 
 	test_free_active_base();
 
 	test_event_base_new();
+#ifdef HAVE_PTHREAD
+	test_event_loop_group();
+	test_bufferevent_migrate_group();
+	test_event_work_pool();
+	test_thread_current_base();
+#endif
 
 	http_suite();
 
@@ -1878,6 +3478,7 @@ main (int argc, char **argv)
 #endif
 	test_loopexit();
 	test_loopbreak();
+	test_busy_poll();
 
 	test_loopexit_multiple();
 	
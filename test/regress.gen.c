@@ -45,7 +45,7 @@ struct msg *
 msg_new(void)
 {
   struct msg *tmp;
-  if ((tmp = malloc(sizeof(struct msg))) == NULL) {
+  if ((tmp = event_mm_malloc(sizeof(struct msg))) == NULL) {
     event_warn("%s: malloc", __func__);
     return (NULL);
   }
@@ -78,7 +78,7 @@ msg_run_add(struct msg *msg)
     int tobe_allocated = msg->run_num_allocated;
     struct run ** new_data = NULL;
     tobe_allocated = !tobe_allocated ? 1 : tobe_allocated << 1;
-    new_data = (struct run **) realloc(msg->run_data,
+    new_data = (struct run **) event_mm_realloc(msg->run_data,
         tobe_allocated * sizeof(struct run *));
     if (new_data == NULL)
       goto error;
@@ -101,8 +101,8 @@ msg_from_name_assign(struct msg *msg,
     const char * value)
 {
   if (msg->from_name_data != NULL)
-    free(msg->from_name_data);
-  if ((msg->from_name_data = strdup(value)) == NULL)
+    event_mm_free(msg->from_name_data);
+  if ((msg->from_name_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->from_name_set = 1;
   return (0);
@@ -113,8 +113,8 @@ msg_to_name_assign(struct msg *msg,
     const char * value)
 {
   if (msg->to_name_data != NULL)
-    free(msg->to_name_data);
-  if ((msg->to_name_data = strdup(value)) == NULL)
+    event_mm_free(msg->to_name_data);
+  if ((msg->to_name_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->to_name_set = 1;
   return (0);
@@ -228,12 +228,12 @@ void
 msg_clear(struct msg *tmp)
 {
   if (tmp->from_name_set == 1) {
-    free (tmp->from_name_data);
+    event_mm_free(tmp->from_name_data);
     tmp->from_name_data = NULL;
     tmp->from_name_set = 0;
   }
   if (tmp->to_name_set == 1) {
-    free (tmp->to_name_data);
+    event_mm_free(tmp->to_name_data);
     tmp->to_name_data = NULL;
     tmp->to_name_set = 0;
   }
@@ -247,7 +247,7 @@ msg_clear(struct msg *tmp)
     for (i = 0; i < tmp->run_length; ++i) {
       run_free(tmp->run_data[i]);
     }
-    free(tmp->run_data);
+    event_mm_free(tmp->run_data);
     tmp->run_data = NULL;
     tmp->run_set = 0;
     tmp->run_length = 0;
@@ -259,9 +259,9 @@ void
 msg_free(struct msg *tmp)
 {
   if (tmp->from_name_data != NULL)
-      free (tmp->from_name_data); 
+      event_mm_free(tmp->from_name_data); 
   if (tmp->to_name_data != NULL)
-      free (tmp->to_name_data); 
+      event_mm_free(tmp->to_name_data); 
   if (tmp->attack_data != NULL)
       kill_free(tmp->attack_data); 
   if (tmp->run_data != NULL) {
@@ -270,12 +270,12 @@ msg_free(struct msg *tmp)
       run_free(tmp->run_data[i]); 
       tmp->run_data[i] = NULL;
     }
-    free(tmp->run_data);
+    event_mm_free(tmp->run_data);
     tmp->run_data = NULL;
     tmp->run_length = 0;
     tmp->run_num_allocated = 0;
   }
-  free(tmp);
+  event_mm_free(tmp);
 }
 
 void
@@ -429,7 +429,7 @@ struct kill *
 kill_new(void)
 {
   struct kill *tmp;
-  if ((tmp = malloc(sizeof(struct kill))) == NULL) {
+  if ((tmp = event_mm_malloc(sizeof(struct kill))) == NULL) {
     event_warn("%s: malloc", __func__);
     return (NULL);
   }
@@ -455,8 +455,8 @@ kill_weapon_assign(struct kill *msg,
     const char * value)
 {
   if (msg->weapon_data != NULL)
-    free(msg->weapon_data);
-  if ((msg->weapon_data = strdup(value)) == NULL)
+    event_mm_free(msg->weapon_data);
+  if ((msg->weapon_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->weapon_set = 1;
   return (0);
@@ -467,8 +467,8 @@ kill_action_assign(struct kill *msg,
     const char * value)
 {
   if (msg->action_data != NULL)
-    free(msg->action_data);
-  if ((msg->action_data = strdup(value)) == NULL)
+    event_mm_free(msg->action_data);
+  if ((msg->action_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->action_set = 1;
   return (0);
@@ -513,12 +513,12 @@ void
 kill_clear(struct kill *tmp)
 {
   if (tmp->weapon_set == 1) {
-    free (tmp->weapon_data);
+    event_mm_free(tmp->weapon_data);
     tmp->weapon_data = NULL;
     tmp->weapon_set = 0;
   }
   if (tmp->action_set == 1) {
-    free (tmp->action_data);
+    event_mm_free(tmp->action_data);
     tmp->action_data = NULL;
     tmp->action_set = 0;
   }
@@ -529,10 +529,10 @@ void
 kill_free(struct kill *tmp)
 {
   if (tmp->weapon_data != NULL)
-      free (tmp->weapon_data); 
+      event_mm_free(tmp->weapon_data); 
   if (tmp->action_data != NULL)
-      free (tmp->action_data); 
-  free(tmp);
+      event_mm_free(tmp->action_data); 
+  event_mm_free(tmp);
 }
 
 void
@@ -655,7 +655,7 @@ struct run *
 run_new(void)
 {
   struct run *tmp;
-  if ((tmp = malloc(sizeof(struct run))) == NULL) {
+  if ((tmp = event_mm_malloc(sizeof(struct run))) == NULL) {
     event_warn("%s: malloc", __func__);
     return (NULL);
   }
@@ -682,8 +682,8 @@ run_how_assign(struct run *msg,
     const char * value)
 {
   if (msg->how_data != NULL)
-    free(msg->how_data);
-  if ((msg->how_data = strdup(value)) == NULL)
+    event_mm_free(msg->how_data);
+  if ((msg->how_data = event_mm_strdup(value)) == NULL)
     return (-1);
   msg->how_set = 1;
   return (0);
@@ -693,8 +693,8 @@ int
 run_some_bytes_assign(struct run *msg, const ev_uint8_t * value, ev_uint32_t len)
 {
   if (msg->some_bytes_data != NULL)
-    free (msg->some_bytes_data);
-  msg->some_bytes_data = malloc(len);
+    event_mm_free(msg->some_bytes_data);
+  msg->some_bytes_data = event_mm_malloc(len);
   if (msg->some_bytes_data == NULL)
     return (-1);
   msg->some_bytes_set = 1;
@@ -743,12 +743,12 @@ void
 run_clear(struct run *tmp)
 {
   if (tmp->how_set == 1) {
-    free (tmp->how_data);
+    event_mm_free(tmp->how_data);
     tmp->how_data = NULL;
     tmp->how_set = 0;
   }
   if (tmp->some_bytes_set == 1) {
-    free (tmp->some_bytes_data);
+    event_mm_free(tmp->some_bytes_data);
     tmp->some_bytes_data = NULL;
     tmp->some_bytes_length = 0;
     tmp->some_bytes_set = 0;
@@ -761,10 +761,10 @@ void
 run_free(struct run *tmp)
 {
   if (tmp->how_data != NULL)
-      free (tmp->how_data); 
+      event_mm_free(tmp->how_data); 
   if (tmp->some_bytes_data != NULL)
-      free (tmp->some_bytes_data); 
-  free(tmp);
+      event_mm_free(tmp->some_bytes_data); 
+  event_mm_free(tmp);
 }
 
 void
@@ -804,7 +804,7 @@ run_unmarshal(struct run *tmp,  struct evbuffer *evbuf)
           return (-1);
         if (tmp->some_bytes_length > EVBUFFER_LENGTH(evbuf))
           return (-1);
-        if ((tmp->some_bytes_data = malloc(tmp->some_bytes_length)) == NULL)
+        if ((tmp->some_bytes_data = event_mm_malloc(tmp->some_bytes_length)) == NULL)
           return (-1);
         if (evtag_unmarshal_fixed(evbuf, RUN_SOME_BYTES, tmp->some_bytes_data, tmp->some_bytes_length) == -1) {
           event_warnx("%s: failed to unmarshal some_bytes", __func__);
@@ -54,7 +54,9 @@
 
 #include "event.h"
 #include "evhttp.h"
+#include "evdns.h"
 #include "log.h"
+#include "event-internal.h"
 #include "http-internal.h"
 
 extern int pair[];
@@ -909,6 +911,105 @@ http_post_cb(struct evhttp_request *req, void *arg)
 	evbuffer_free(evb);
 }
 
+/*
+ * Bodies larger than the spill threshold end up in a temporary file on
+ * both ends, and the echoed reply is written out from one.
+ */
+
+#define SPILL_BODY_SIZE (256 * 1024)
+
+static int
+http_spill_check(struct evbuffer *buf)
+{
+	size_t i;
+
+	if (EVBUFFER_LENGTH(buf) != SPILL_BODY_SIZE)
+		return (-1);
+	for (i = 0; i < SPILL_BODY_SIZE; i++)
+		if (EVBUFFER_DATA(buf)[i] != 'a' + i % 26)
+			return (-1);
+	if (buf->spill == NULL || !buf->spill->mapped)
+		return (-1);
+	return (0);
+}
+
+static void
+http_spill_cb(struct evhttp_request *req, void *arg)
+{
+	if (http_spill_check(req->input_buffer) == -1) {
+		fprintf(stdout, "FAILED (request body)\n");
+		exit(1);
+	}
+	test_ok = 1;
+	evhttp_send_reply(req, HTTP_OK, "Everything is fine",
+	    req->input_buffer);
+}
+
+static void
+http_spill_done(struct evhttp_request *req, void *arg)
+{
+	if (req == NULL || req->response_code != HTTP_OK ||
+	    http_spill_check(req->input_buffer) == -1) {
+		fprintf(stdout, "FAILED (reply body)\n");
+		exit(1);
+	}
+	test_ok = 2;
+	event_loopexit(NULL);
+}
+
+static void
+http_body_spill_test(void)
+{
+	short port = -1;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req = NULL;
+	char *body;
+	size_t i;
+
+	test_ok = 0;
+	fprintf(stdout, "Testing HTTP Body Spilling: ");
+
+	http = http_setup(&port, NULL);
+	evhttp_set_cb(http, "/spill", http_spill_cb, NULL);
+	evhttp_set_body_spill(http, 4096);
+
+	evcon = evhttp_connection_new("127.0.0.1", port);
+	if (evcon == NULL) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+	evhttp_connection_set_body_spill(evcon, 4096);
+
+	if ((body = malloc(SPILL_BODY_SIZE)) == NULL) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+	for (i = 0; i < SPILL_BODY_SIZE; i++)
+		body[i] = 'a' + i % 26;
+
+	req = evhttp_request_new(http_spill_done, NULL);
+	evhttp_add_header(req->output_headers, "Host", "somehost");
+	evbuffer_add(req->output_buffer, body, SPILL_BODY_SIZE);
+	free(body);
+
+	if (evhttp_make_request(evcon, req, EVHTTP_REQ_POST, "/spill") == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_dispatch();
+
+	evhttp_connection_free(evcon);
+	evhttp_free(http);
+
+	if (test_ok != 2) {
+		fprintf(stdout, "FAILED: %d\n", test_ok);
+		exit(1);
+	}
+
+	fprintf(stdout, "OK\n");
+}
+
 void
 http_postrequest_done(struct evhttp_request *req, void *arg)
 {
@@ -1722,6 +1823,373 @@ http_terminate_chunked_test(void)
 		evhttp_free(http);
 }
 
+static void
+http_idle_timeout_readcb(int fd, short what, void *arg)
+{
+	char buf[64];
+
+	/* the server closes the idle connection */
+	if (what == EV_READ && read(fd, buf, sizeof(buf)) == 0)
+		test_ok = 1;
+	event_loopexit(NULL);
+}
+
+static void
+http_idle_timeout_test(void)
+{
+	short port = -1;
+	int fd;
+	struct event ev;
+	struct timeval tv = { 0, 200000 }, start, end, elapsed;
+
+	test_ok = 0;
+	fprintf(stdout, "Testing HTTP millisecond timeout: ");
+
+	http = http_setup(&port, NULL);
+	evhttp_set_timeout_tv(http, &tv);
+
+	fd = http_connect("127.0.0.1", port);
+
+	/* give up after a few seconds */
+	tv.tv_sec = 3;
+	tv.tv_usec = 0;
+	event_set(&ev, fd, EV_READ, http_idle_timeout_readcb, NULL);
+	event_add(&ev, &tv);
+
+	evutil_gettimeofday(&start, NULL);
+	event_dispatch();
+	evutil_gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &elapsed);
+	if (test_ok != 1 || elapsed.tv_sec >= 1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_del(&ev);
+	EVUTIL_CLOSESOCKET(fd);
+	evhttp_free(http);
+
+	fprintf(stdout, "OK\n");
+}
+
+static void
+http_dns_server_cb(struct evdns_server_request *req, void *arg)
+{
+	struct in_addr ans;
+	int i;
+	/* the first address of race.example.test never answers */
+	u_int32_t race[2];
+
+	ans.s_addr = htonl(0x7f000001UL); /* 127.0.0.1 */
+	race[0] = htonl(0x7f000002UL);
+	race[1] = ans.s_addr;
+	for (i = 0; i < req->nquestions; ++i) {
+		if (req->questions[i]->type != EVDNS_TYPE_A)
+			continue;
+		if (!strcmp(req->questions[i]->name, "www.example.test"))
+			evdns_server_request_add_a_reply(req,
+			    req->questions[i]->name, 1, &ans.s_addr, 10);
+		else if (!strcmp(req->questions[i]->name, "race.example.test"))
+			evdns_server_request_add_a_reply(req,
+			    req->questions[i]->name, 2, race, 10);
+	}
+	evdns_server_request_respond(req, 0);
+}
+
+/*
+ * The nameserver runs on the same loop as the client, so a blocking
+ * lookup would never get an answer.
+ */
+static void
+http_dns_test(void)
+{
+	short port = -1;
+	int sock;
+	struct sockaddr_in sin;
+	struct evdns_server_port *dns_port;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req = NULL;
+#ifdef AF_INET6
+	struct sockaddr_in6 sin6;
+	int sock6;
+#endif
+
+	test_ok = 0;
+	fprintf(stdout, "Testing HTTP connect through evdns: ");
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	evutil_make_socket_nonblocking(sock);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001UL);
+	sin.sin_port = htons(35354);
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		fprintf(stdout, "FAILED (bind)\n");
+		exit(1);
+	}
+	dns_port = evdns_add_server_port(sock, 0, http_dns_server_cb, NULL);
+	evdns_nameserver_ip_add("127.0.0.1:35354");
+
+	http = http_setup(&port, NULL);
+
+	evcon = evhttp_connection_new("www.example.test", port);
+	if (evcon == NULL) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	req = evhttp_request_new(http_request_done, NULL);
+	evhttp_add_header(req->output_headers, "Host", "somehost");
+
+	if (evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/test") == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_dispatch();
+
+	if (test_ok != 1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	evhttp_connection_free(evcon);
+
+#ifdef AF_INET6
+	/* an IPv6 literal is connected to directly, not looked up */
+	if ((sock6 = socket(AF_INET6, SOCK_STREAM, 0)) != -1) {
+		memset(&sin6, 0, sizeof(sin6));
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_addr = in6addr_loopback;
+		sin6.sin6_port = htons(port);
+		evutil_make_socket_nonblocking(sock6);
+		if (bind(sock6, (struct sockaddr *)&sin6, sizeof(sin6)) == -1 ||
+		    listen(sock6, 10) == -1 ||
+		    evhttp_accept_socket(http, sock6) == -1) {
+			/* no IPv6 here */
+			EVUTIL_CLOSESOCKET(sock6);
+		} else {
+			test_ok = 0;
+			evcon = evhttp_connection_new("::1", port);
+			req = evhttp_request_new(http_request_done, NULL);
+			evhttp_add_header(req->output_headers, "Host",
+			    "somehost");
+			if (evhttp_make_request(evcon, req, EVHTTP_REQ_GET,
+				"/test") == -1) {
+				fprintf(stdout, "FAILED\n");
+				exit(1);
+			}
+
+			event_dispatch();
+
+			if (test_ok != 1) {
+				fprintf(stdout, "FAILED (IPv6)\n");
+				exit(1);
+			}
+			evhttp_connection_free(evcon);
+		}
+	}
+#endif
+
+	evhttp_free(http);
+	evdns_close_server_port(dns_port);
+	evdns_shutdown(0);
+	EVUTIL_CLOSESOCKET(sock);
+
+	fprintf(stdout, "OK\n");
+}
+
+/*
+ * race.example.test resolves to an address whose listen queue is full,
+ * so a connect to it hangs, followed by the address of the server.  The
+ * second attempt has to start long before the connect timeout.
+ */
+static void
+http_connect_race_test(void)
+{
+	short port = -1;
+	int sock, stuck, i;
+	int fillers[4];
+	struct sockaddr_in sin;
+	struct evdns_server_port *dns_port;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req = NULL;
+	struct timeval start, end, elapsed;
+
+	test_ok = 0;
+	fprintf(stdout, "Testing HTTP connect racing addresses: ");
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	evutil_make_socket_nonblocking(sock);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001UL);
+	sin.sin_port = htons(35354);
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		fprintf(stdout, "FAILED (bind)\n");
+		exit(1);
+	}
+	dns_port = evdns_add_server_port(sock, 0, http_dns_server_cb, NULL);
+	evdns_nameserver_ip_add("127.0.0.1:35354");
+
+	http = http_setup(&port, NULL);
+
+	/* a listener on 127.0.0.2 that never accepts */
+	stuck = socket(AF_INET, SOCK_STREAM, 0);
+	sin.sin_addr.s_addr = htonl(0x7f000002UL);
+	sin.sin_port = htons(port);
+	if (bind(stuck, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(stuck, 0) < 0) {
+		fprintf(stdout, "FAILED (listen)\n");
+		exit(1);
+	}
+	for (i = 0; i < 4; ++i) {
+		fillers[i] = socket(AF_INET, SOCK_STREAM, 0);
+		evutil_make_socket_nonblocking(fillers[i]);
+		connect(fillers[i], (struct sockaddr *)&sin, sizeof(sin));
+	}
+
+	evcon = evhttp_connection_new("race.example.test", port);
+	if (evcon == NULL) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	req = evhttp_request_new(http_request_done, NULL);
+	evhttp_add_header(req->output_headers, "Host", "somehost");
+
+	evutil_gettimeofday(&start, NULL);
+	if (evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/test") == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_dispatch();
+	evutil_gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &elapsed);
+	if (test_ok != 1 || elapsed.tv_sec >= 2) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	evhttp_connection_free(evcon);
+	for (i = 0; i < 4; ++i)
+		EVUTIL_CLOSESOCKET(fillers[i]);
+	EVUTIL_CLOSESOCKET(stuck);
+	evhttp_free(http);
+	evdns_close_server_port(dns_port);
+	evdns_shutdown(0);
+	EVUTIL_CLOSESOCKET(sock);
+
+	fprintf(stdout, "OK\n");
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * an idle client connection moves to the loop of an event_loop_group and
+ * sends its next request from there; the server stays on this thread
+ */
+
+static struct event_base *migrate_base;
+
+static void
+http_migrate_exit_cb(void *arg)
+{
+	event_base_loopexit(arg, NULL);
+}
+
+static void
+http_migrate_done(struct evhttp_request *req, void *arg)
+{
+	struct evhttp_connection *evcon = arg;
+
+	if (req->response_code == HTTP_OK && evcon->base == migrate_base)
+		test_ok++;
+	if (migrate_base == base)
+		event_base_loopexit(base, NULL);
+	else
+		event_base_post(base, http_migrate_exit_cb, base);
+}
+
+static void
+http_migrate_cb(struct evhttp_connection *evcon, void *arg)
+{
+	struct evhttp_request *req;
+
+	/* runs on the thread of the group's loop */
+	if (evcon->base != migrate_base)
+		return;
+	req = evhttp_request_new(http_migrate_done, evcon);
+	evhttp_add_header(req->output_headers, "Host", "somehost");
+	evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/test");
+}
+
+static void
+http_connection_migrate_test(void)
+{
+	short port = -1;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req = NULL;
+	struct event_loop_group *group;
+
+	test_ok = 0;
+	fprintf(stdout, "Testing HTTP connection migrate: ");
+
+	base = event_base_new();
+	if (event_base_make_notifiable(base) == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+	http = http_setup(&port, base);
+
+	evcon = evhttp_connection_new("127.0.0.1", port);
+	evhttp_connection_set_base(evcon, base);
+	migrate_base = base;
+
+	req = evhttp_request_new(http_migrate_done, evcon);
+	evhttp_add_header(req->output_headers, "Host", "somehost");
+	if (evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/test") == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	event_base_dispatch(base);
+
+	/* the connection is kept open and waits for the next request */
+	if (test_ok != 1 || evcon->state != EVCON_IDLE) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	group = event_loop_group_new(1, 0);
+	migrate_base = event_loop_group_get_base(group, 0);
+	if (evhttp_connection_migrate(evcon, migrate_base, http_migrate_cb,
+		NULL) == -1) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	/* serve the request from the other thread until it is done */
+	event_base_dispatch(base);
+
+	event_loop_group_stop(group, NULL);
+	if (test_ok != 2) {
+		fprintf(stdout, "FAILED\n");
+		exit(1);
+	}
+
+	evhttp_connection_free(evcon);
+	event_loop_group_free(group);
+	evhttp_free(http);
+	event_base_free(base);
+	base = NULL;
+
+	fprintf(stdout, "OK\n");
+}
+#endif
+
 void
 http_suite(void)
 {
@@ -1733,11 +2201,18 @@ http_suite(void)
 	http_connection_test(1 /* persistent */);
 	http_close_detection(0 /* without delay */);
 	http_close_detection(1 /* with delay */);
+	http_idle_timeout_test();
 	http_bad_request();
 	http_post_test();
+	http_body_spill_test();
 	http_failure_test();
 	http_highport_test();
 	http_dispatcher_test();
+	http_dns_test();
+	http_connect_race_test();
+#ifdef HAVE_PTHREAD
+	http_connection_migrate_test();
+#endif
 
 	http_multi_line_header_test();
 	http_negative_content_length_test();
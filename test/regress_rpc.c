@@ -57,6 +57,7 @@
 #include "evhttp.h"
 #include "log.h"
 #include "evrpc.h"
+#include "evrpc-internal.h"
 
 #include "regress.gen.h"
 
@@ -620,6 +621,92 @@ rpc_client_timeout(void)
 	evhttp_free(http);
 }
 
+static void
+GotNoTimeoutCb(struct evrpc_status *status,
+    struct msg *msg, struct kill *kill, void *arg)
+{
+	if (status->error == EVRPC_STATUS_ERR_NONE)
+		test_ok += 1;
+
+	event_loopexit(NULL);
+}
+
+static void
+rpc_client_stop_waiting(int fd, short what, void *arg)
+{
+	event_loopexit(NULL);
+}
+
+static void
+rpc_client_no_timeout(void)
+{
+	short port;
+	struct evhttp *http = NULL;
+	struct evrpc_base *base = NULL;
+	struct evrpc_pool *pool = NULL;
+	struct msg *msg;
+	struct kill *kill;
+	struct timeval tv;
+
+	fprintf(stdout, "Testing RPC Client Without Timeout: ");
+
+	rpc_setup(&http, &port, &base);
+
+	pool = rpc_pool_with_connection(port);
+
+	/* NULL takes back the one second timeout */
+	evrpc_pool_set_timeout(pool, 1);
+	evrpc_pool_set_timeout_tv(pool, NULL);
+	if (pool->timeout.tv_sec != -1) {
+		fprintf(stdout, "FAILED (1)\n");
+		exit(1);
+	}
+
+	/* set up the basic message */
+	msg = msg_new();
+	EVTAG_ASSIGN(msg, from_name, "niels");
+	EVTAG_ASSIGN(msg, to_name, "tester");
+
+	kill = kill_new();
+
+	EVRPC_MAKE_REQUEST(NeverReply, pool, msg, kill, GotNoTimeoutCb, NULL);
+
+	test_ok = 0;
+
+	/* the request is still waiting for its reply after two seconds */
+	evutil_timerclear(&tv);
+	tv.tv_sec = 2;
+	event_once(-1, EV_TIMEOUT, rpc_client_stop_waiting, NULL, &tv);
+	event_dispatch();
+
+	if (test_ok != 1) {
+		fprintf(stdout, "FAILED (2)\n");
+		exit(1);
+	}
+
+	/* the late reply still arrives */
+	EVTAG_ASSIGN(saved_rpc->reply, weapon, "dagger");
+	EVTAG_ASSIGN(saved_rpc->reply, action, "wave around like an idiot");
+	EVRPC_REQUEST_DONE(saved_rpc);
+
+	event_dispatch();
+
+	rpc_teardown(base);
+	
+	if (test_ok != 2) {
+		fprintf(stdout, "FAILED (3)\n");
+		exit(1);
+	}
+
+	fprintf(stdout, "OK\n");
+
+	msg_free(msg);
+	kill_free(kill);
+
+	evrpc_pool_free(pool);
+	evhttp_free(http);
+}
+
 void
 rpc_suite(void)
 {
@@ -628,4 +715,5 @@ rpc_suite(void)
 	rpc_basic_client();
 	rpc_basic_queued_client();
 	rpc_client_timeout();
+	rpc_client_no_timeout();
 }
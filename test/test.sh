@@ -7,6 +7,7 @@ setup () {
 	 EVENT_NOSELECT=yes; export EVENT_NOSELECT
 	 EVENT_NOEPOLL=yes; export EVENT_NOEPOLL
 	 EVENT_NOEVPORT=yes; export EVENT_NOEVPORT
+	 EVENT_NOIOURING=yes; export EVENT_NOIOURING
 }
 
 test () {
@@ -81,6 +82,12 @@ export EVENT_NOEPOLL
 echo "EPOLL"
 test
 
+setup
+unset EVENT_NOIOURING
+export EVENT_NOIOURING
+echo "IO_URING"
+test
+
 setup
 unset EVENT_NOEVPORT
 export EVENT_NOEVPORT